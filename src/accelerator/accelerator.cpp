@@ -1,5 +1,6 @@
 #include "accelerator.h"
 
+#include "cpu/image/image_mixer.h"
 #include "ogl/image/image_mixer.h"
 #include "ogl/util/device.h"
 
@@ -19,8 +20,12 @@ struct accelerator::impl
 
     impl() {}
 
-    std::unique_ptr<core::image_mixer> create_image_mixer(int channel_id)
+    std::unique_ptr<core::image_mixer> create_image_mixer(int channel_id, image_mixer_backend backend)
     {
+        if (backend == image_mixer_backend::cpu) {
+            return std::make_unique<cpu::image_mixer>(channel_id);
+        }
+
         return std::make_unique<ogl::image_mixer>(spl::make_shared_ptr(get_device()), channel_id);
     }
 
@@ -41,9 +46,9 @@ accelerator::accelerator()
 
 accelerator::~accelerator() {}
 
-std::unique_ptr<core::image_mixer> accelerator::create_image_mixer(int channel_id)
+std::unique_ptr<core::image_mixer> accelerator::create_image_mixer(int channel_id, image_mixer_backend backend)
 {
-    return impl_->create_image_mixer(channel_id);
+    return impl_->create_image_mixer(channel_id, backend);
 }
 
 std::shared_ptr<accelerator_device> accelerator::get_device() const
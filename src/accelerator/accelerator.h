@@ -17,6 +17,12 @@ class accelerator_device
     virtual std::future<void>            gc()         = 0;
 };
 
+enum class image_mixer_backend
+{
+    ogl,
+    cpu,
+};
+
 class accelerator
 {
   public:
@@ -26,7 +32,8 @@ class accelerator
 
     accelerator& operator=(accelerator&) = delete;
 
-    std::unique_ptr<caspar::core::image_mixer> create_image_mixer(int channel_id);
+    std::unique_ptr<caspar::core::image_mixer>
+    create_image_mixer(int channel_id, image_mixer_backend backend = image_mixer_backend::ogl);
 
     std::shared_ptr<accelerator_device> get_device() const;
 
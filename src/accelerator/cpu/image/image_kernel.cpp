@@ -0,0 +1,405 @@
+#include "image_kernel.h"
+
+#include "../util/blend.h"
+
+#include <common/log.h>
+
+#include <boost/range/algorithm/equal.hpp>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <string>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+namespace {
+
+const double epsilon = 0.001;
+
+// BT.601 / BT.709 coefficients scaled by 256, matching the ogl shader.
+struct ycbcr_coefficients
+{
+    int y;
+    int cr_r;
+    int cr_g;
+    int cb_g;
+    int cb_b;
+};
+
+const ycbcr_coefficients sd_coefficients = {298, 409, 208, 100, 517};
+const ycbcr_coefficients hd_coefficients = {298, 459, 137, 55, 541};
+
+inline std::uint8_t clamp_u8(int value)
+{
+    return static_cast<std::uint8_t>(std::max(0, std::min(255, value)));
+}
+
+inline void ycbcra_to_bgra(std::uint8_t* dest, int y, int cb, int cr, int a, const ycbcr_coefficients& k)
+{
+    auto l  = k.y * (y - 16) + 128;
+    cb     -= 128;
+    cr     -= 128;
+    dest[0] = clamp_u8((l + k.cb_b * cb) >> 8);
+    dest[1] = clamp_u8((l - k.cr_g * cr - k.cb_g * cb) >> 8);
+    dest[2] = clamp_u8((l + k.cr_r * cr) >> 8);
+    dest[3] = static_cast<std::uint8_t>(a);
+}
+
+std::array<std::uint8_t, 256> make_luma_lut()
+{
+    std::array<std::uint8_t, 256> lut;
+    for (int n = 0; n < 256; ++n) {
+        lut[n] = clamp_u8(static_cast<int>(std::lround((n - 0.065 * 255.0) / 0.859)));
+    }
+    return lut;
+}
+
+std::array<std::uint8_t, 256> make_levels_lut(const core::levels& levels)
+{
+    std::array<std::uint8_t, 256> lut;
+    for (int n = 0; n < 256; ++n) {
+        auto value = n / 255.0;
+        value      = std::min(std::max(value - levels.min_input, 0.0) / (levels.max_input - levels.min_input), 1.0);
+        value      = std::pow(value, 1.0 / levels.gamma);
+        value      = levels.min_output + (levels.max_output - levels.min_output) * value;
+        lut[n]     = clamp_u8(static_cast<int>(std::lround(value * 255.0)));
+    }
+    return lut;
+}
+
+bool has_levels(const core::levels& levels)
+{
+    return levels.min_input > epsilon || levels.max_input < 1.0 - epsilon || levels.min_output > epsilon ||
+           levels.max_output < 1.0 - epsilon || std::abs(levels.gamma - 1.0) > epsilon;
+}
+
+bool has_perspective(const core::corners& corners)
+{
+    static const core::corners identity;
+    return corners.ul != identity.ul || corners.ur != identity.ur || corners.lr != identity.lr ||
+           corners.ll != identity.ll;
+}
+
+// Maps destination pixels [0, size) to source texels through an axis aligned quad, returns the destination range
+// covered by the quad.
+std::pair<int, int> map_axis(double                           vertex_begin,
+                             double                           vertex_end,
+                             double                           texture_begin,
+                             double                           texture_end,
+                             int                              size,
+                             std::pair<int, int>              clip,
+                             const core::pixel_format_desc&   desc,
+                             bool                             is_x,
+                             std::array<std::vector<int>, 4>& result)
+{
+    auto lo    = std::min(vertex_begin, vertex_end) * size;
+    auto hi    = std::max(vertex_begin, vertex_end) * size;
+    auto begin = std::max(clip.first, static_cast<int>(std::ceil(lo - 0.5)));
+    auto end   = std::min(clip.second, static_cast<int>(std::ceil(hi - 0.5)));
+
+    if (end <= begin || std::abs(vertex_end - vertex_begin) < std::numeric_limits<double>::epsilon()) {
+        return std::make_pair(0, 0);
+    }
+
+    for (std::size_t p = 0; p < desc.planes.size() && p < result.size(); ++p) {
+        auto texels = is_x ? desc.planes[p].width : desc.planes[p].height;
+
+        result[p].resize(end - begin);
+        for (int n = begin; n < end; ++n) {
+            auto t  = ((n + 0.5) / size - vertex_begin) / (vertex_end - vertex_begin);
+            auto uv = texture_begin + t * (texture_end - texture_begin);
+
+            result[p][n - begin] = std::max(0, std::min(texels - 1, static_cast<int>(std::floor(uv * texels))));
+        }
+    }
+
+    return std::make_pair(begin, end);
+}
+
+} // namespace
+
+struct image_kernel::impl
+{
+    const std::array<std::uint8_t, 256> luma_lut_ = make_luma_lut();
+    std::set<std::wstring>              warned_;
+
+    void warn_unsupported(const std::wstring& feature)
+    {
+        if (warned_.insert(feature).second) {
+            CASPAR_LOG(warning) << L"[cpu_image_kernel] " << feature << L" is not supported and will be ignored.";
+        }
+    }
+
+    void draw(const draw_params& params)
+    {
+        if (params.planes.empty() || !params.background) {
+            return;
+        }
+
+        if (params.planes.size() != params.pix_desc.planes.size() || params.planes.size() > 4) {
+            return;
+        }
+
+        const auto& transform = params.transform;
+        const auto  opacity   = transform.is_key ? 1.0 : transform.opacity;
+
+        if (opacity < epsilon) {
+            return;
+        }
+
+        const auto& coords = params.geometry.data();
+
+        if (params.geometry.type() != core::frame_geometry::geometry_type::quad || coords.size() != 4) {
+            warn_unsupported(L"Non quad geometry");
+            return;
+        }
+
+        bool is_default_geometry = boost::equal(coords, core::frame_geometry::get_default().data()) ||
+                                   boost::equal(coords, core::frame_geometry::get_default_vflip().data());
+
+        if (!is_default_geometry) {
+            warn_unsupported(L"Non default geometry");
+        }
+
+        if (std::abs(transform.angle) > epsilon) {
+            warn_unsupported(L"Rotation");
+        }
+
+        if (has_perspective(transform.perspective)) {
+            warn_unsupported(L"Perspective");
+        }
+
+        if (transform.chroma.enable) {
+            warn_unsupported(L"Chroma key");
+        }
+
+        if (std::abs(transform.brightness - 1.0) > epsilon || std::abs(transform.saturation - 1.0) > epsilon ||
+            std::abs(transform.contrast - 1.0) > epsilon) {
+            warn_unsupported(L"Contrast, saturation and brightness");
+        }
+
+        if (params.blend_mode != core::blend_mode::normal && !transform.is_key) {
+            warn_unsupported(L"Blend mode " + core::get_blend_mode(params.blend_mode));
+        }
+
+        // Upper left and lower right corners, anything else is treated as an axis aligned quad.
+
+        auto ul = coords[0];
+        auto lr = coords[2];
+
+        if (is_default_geometry) {
+            for (auto coord : {&ul, &lr}) {
+                coord->vertex_x  = std::min(std::max(coord->vertex_x, transform.crop.ul[0]), transform.crop.lr[0]);
+                coord->vertex_y  = std::min(std::max(coord->vertex_y, transform.crop.ul[1]), transform.crop.lr[1]);
+                coord->texture_x = std::min(std::max(coord->texture_x, transform.crop.ul[0]), transform.crop.lr[0]);
+                coord->texture_y = std::min(std::max(coord->texture_y, transform.crop.ul[1]), transform.crop.lr[1]);
+            }
+        }
+
+        for (auto coord : {&ul, &lr}) {
+            coord->vertex_x = (coord->vertex_x - transform.anchor[0]) * transform.fill_scale[0] +
+                              transform.fill_translation[0];
+            coord->vertex_y = (coord->vertex_y - transform.anchor[1]) * transform.fill_scale[1] +
+                              transform.fill_translation[1];
+        }
+
+        auto& background = *params.background;
+        auto  width      = background.width;
+        auto  height     = background.height;
+
+        auto clip_x = std::make_pair(0, width);
+        auto clip_y = std::make_pair(0, height);
+
+        auto m_p = transform.clip_translation;
+        auto m_s = transform.clip_scale;
+
+        if (m_p[0] > std::numeric_limits<double>::epsilon() || m_p[1] > std::numeric_limits<double>::epsilon() ||
+            m_s[0] < 1.0 - std::numeric_limits<double>::epsilon() ||
+            m_s[1] < 1.0 - std::numeric_limits<double>::epsilon()) {
+            auto x = static_cast<int>(m_p[0] * width);
+            auto y = static_cast<int>(m_p[1] * height);
+            clip_x = std::make_pair(std::max(0, x), std::min(width, x + std::max(0, static_cast<int>(m_s[0] * width))));
+            clip_y =
+                std::make_pair(std::max(0, y), std::min(height, y + std::max(0, static_cast<int>(m_s[1] * height))));
+        }
+
+        std::array<std::vector<int>, 4> cols;
+        std::array<std::vector<int>, 4> rows;
+
+        auto range_x = map_axis(
+            ul.vertex_x, lr.vertex_x, ul.texture_x, lr.texture_x, width, clip_x, params.pix_desc, true, cols);
+        auto range_y = map_axis(
+            ul.vertex_y, lr.vertex_y, ul.texture_y, lr.texture_y, height, clip_y, params.pix_desc, false, rows);
+
+        if (range_x.second <= range_x.first || range_y.second <= range_y.first) {
+            return;
+        }
+
+        const auto count      = static_cast<std::size_t>(range_x.second - range_x.first);
+        const auto is_levels  = has_levels(transform.levels);
+        const auto levels_lut = is_levels ? make_levels_lut(transform.levels) : std::array<std::uint8_t, 256>{};
+        const auto alpha      = static_cast<int>(std::lround(std::min(opacity, 1.0) * 255.0));
+        const auto& k         = params.pix_desc.planes.at(0).height > 700 ? hd_coefficients : sd_coefficients;
+
+        // BGRA sources which are neither scaled nor offset horizontally can be blended straight from the frame.
+        const auto is_direct = params.pix_desc.format == core::pixel_format::bgra && !is_levels && !transform.invert &&
+                               cols[0].front() == 0 && cols[0].back() == static_cast<int>(count) - 1 &&
+                               static_cast<std::size_t>(params.pix_desc.planes[0].width) >= count;
+
+        tbb::parallel_for(tbb::blocked_range<int>(range_y.first, range_y.second), [&](const tbb::blocked_range<int>& r) {
+            std::vector<std::uint8_t> color(is_direct ? 0 : count * 4);
+            std::vector<std::uint8_t> mask(params.local_key && params.layer_key ? count : 0);
+            std::vector<std::uint8_t> scaled(transform.invert ? count * 4 : 0);
+
+            for (auto y = r.begin(); y != r.end(); ++y) {
+                std::array<const std::uint8_t*, 4> src = {};
+                for (std::size_t p = 0; p < params.planes.size(); ++p) {
+                    src[p] = params.planes[p].data() +
+                             static_cast<std::size_t>(rows[p][y - range_y.first]) * params.pix_desc.planes[p].linesize;
+                }
+
+                const std::uint8_t* source = is_direct ? src[0] : color.data();
+
+                if (!is_direct) {
+                    fetch(params.pix_desc.format, src, cols, count, k, color.data());
+
+                    if (is_levels) {
+                        for (std::size_t n = 0; n < count; ++n) {
+                            color[n * 4 + 0] = levels_lut[color[n * 4 + 0]];
+                            color[n * 4 + 1] = levels_lut[color[n * 4 + 1]];
+                            color[n * 4 + 2] = levels_lut[color[n * 4 + 2]];
+                        }
+                    }
+                }
+
+                const std::uint8_t* key = nullptr;
+                if (params.local_key && params.layer_key) {
+                    multiply_key(mask.data(),
+                                 params.local_key->row(y) + range_x.first,
+                                 params.layer_key->row(y) + range_x.first,
+                                 count);
+                    key = mask.data();
+                } else if (params.local_key) {
+                    key = params.local_key->row(y) + range_x.first;
+                } else if (params.layer_key) {
+                    key = params.layer_key->row(y) + range_x.first;
+                }
+
+                auto row_alpha = alpha;
+
+                if (transform.invert) {
+                    // Inversion is applied after keying, the same way the ogl shader does it.
+                    std::fill(scaled.begin(), scaled.end(), 0);
+                    blend_additive(scaled.data(), color.data(), key, alpha, count);
+                    std::transform(scaled.begin(), scaled.end(), color.begin(), [](std::uint8_t value) {
+                        return static_cast<std::uint8_t>(255 - value);
+                    });
+                    key       = nullptr;
+                    row_alpha = 255;
+                }
+
+                auto dest = background.row(y) + range_x.first * background.stride;
+
+                if (background.stride == 1) {
+                    blend_key(dest, source, count);
+                } else if (params.keyer == keyer::additive) {
+                    blend_additive(dest, source, key, row_alpha, count);
+                } else {
+                    blend_normal(dest, source, key, row_alpha, count);
+                }
+            }
+        });
+    }
+
+    void fetch(core::pixel_format                        format,
+               const std::array<const std::uint8_t*, 4>& src,
+               const std::array<std::vector<int>, 4>&    cols,
+               std::size_t                               count,
+               const ycbcr_coefficients&                 k,
+               std::uint8_t*                             dest) const
+    {
+        auto for_each = [&](auto&& func) {
+            for (std::size_t n = 0; n < count; ++n) {
+                func(n, dest + n * 4);
+            }
+        };
+
+        auto swizzle = [&](int stride, int b, int g, int r, int a) {
+            for_each([&](std::size_t n, std::uint8_t* d) {
+                auto s = src[0] + cols[0][n] * stride;
+                d[0]   = s[b];
+                d[1]   = s[g];
+                d[2]   = s[r];
+                d[3]   = a < 0 ? 255 : s[a];
+            });
+        };
+
+        switch (format) {
+            case core::pixel_format::gray:
+                for_each([&](std::size_t n, std::uint8_t* d) {
+                    d[0] = d[1] = d[2] = src[0][cols[0][n]];
+                    d[3]               = 255;
+                });
+                break;
+            case core::pixel_format::luma:
+                for_each([&](std::size_t n, std::uint8_t* d) {
+                    d[0] = d[1] = d[2] = luma_lut_[src[0][cols[0][n]]];
+                    d[3]               = 255;
+                });
+                break;
+            case core::pixel_format::bgra:
+                swizzle(4, 0, 1, 2, 3);
+                break;
+            case core::pixel_format::rgba:
+                swizzle(4, 2, 1, 0, 3);
+                break;
+            case core::pixel_format::argb:
+                swizzle(4, 3, 2, 1, 0);
+                break;
+            case core::pixel_format::abgr:
+                swizzle(4, 1, 2, 3, 0);
+                break;
+            case core::pixel_format::bgr:
+                swizzle(3, 0, 1, 2, -1);
+                break;
+            case core::pixel_format::rgb:
+                swizzle(3, 2, 1, 0, -1);
+                break;
+            case core::pixel_format::ycbcr:
+                for_each([&](std::size_t n, std::uint8_t* d) {
+                    ycbcra_to_bgra(d, src[0][cols[0][n]], src[1][cols[1][n]], src[2][cols[2][n]], 255, k);
+                });
+                break;
+            case core::pixel_format::ycbcra:
+                for_each([&](std::size_t n, std::uint8_t* d) {
+                    ycbcra_to_bgra(
+                        d, src[0][cols[0][n]], src[1][cols[1][n]], src[2][cols[2][n]], src[3][cols[3][n]], k);
+                });
+                break;
+            case core::pixel_format::uyvy:
+                for_each([&](std::size_t n, std::uint8_t* d) {
+                    auto c = src[1] + cols[1][n] * 4;
+                    ycbcra_to_bgra(d, src[0][cols[0][n] * 2 + 1], c[0], c[2], 255, k);
+                });
+                break;
+            default:
+                std::fill(dest, dest + count * 4, 0);
+                break;
+        }
+    }
+};
+
+image_kernel::image_kernel()
+    : impl_(new impl())
+{
+}
+image_kernel::~image_kernel() {}
+void image_kernel::draw(const draw_params& params) { impl_->draw(params); }
+
+}}} // namespace caspar::accelerator::cpu
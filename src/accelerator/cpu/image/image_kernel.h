@@ -0,0 +1,71 @@
+#pragma once
+
+#include <core/mixer/image/blend_modes.h>
+
+#include <common/array.h>
+
+#include <core/frame/frame_transform.h>
+#include <core/frame/geometry.h>
+#include <core/frame/pixel_format.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+enum class keyer
+{
+    linear = 0,
+    additive,
+};
+
+// Row major, tightly packed image with stride 4 (premultiplied BGRA) or 1 (key).
+struct surface final
+{
+    int                       width  = 0;
+    int                       height = 0;
+    int                       stride = 0;
+    std::vector<std::uint8_t> data;
+
+    surface(int width, int height, int stride)
+        : width(width)
+        , height(height)
+        , stride(stride)
+        , data(static_cast<std::size_t>(width) * height * stride, 0)
+    {
+    }
+
+    std::uint8_t* row(int y) { return data.data() + static_cast<std::size_t>(y) * width * stride; }
+};
+
+struct draw_params final
+{
+    core::pixel_format_desc                pix_desc = core::pixel_format::invalid;
+    std::vector<array<const std::uint8_t>> planes;
+    core::image_transform                  transform;
+    core::frame_geometry                   geometry   = core::frame_geometry::get_default();
+    core::blend_mode                       blend_mode = core::blend_mode::normal;
+    cpu::keyer                             keyer      = cpu::keyer::linear;
+    std::shared_ptr<surface>               background;
+    std::shared_ptr<surface>               local_key;
+    std::shared_ptr<surface>               layer_key;
+};
+
+class image_kernel final
+{
+    image_kernel(const image_kernel&);
+    image_kernel& operator=(const image_kernel&);
+
+  public:
+    image_kernel();
+    ~image_kernel();
+
+    void draw(const draw_params& params);
+
+  private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
+
+}}} // namespace caspar::accelerator::cpu
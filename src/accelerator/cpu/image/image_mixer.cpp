@@ -0,0 +1,286 @@
+#include "image_mixer.h"
+
+#include "image_kernel.h"
+
+#include <common/array.h>
+#include <common/except.h>
+#include <common/executor.h>
+#include <common/future.h>
+#include <common/log.h>
+
+#include <core/frame/frame.h>
+#include <core/frame/frame_transform.h>
+#include <core/frame/geometry.h>
+#include <core/frame/pixel_format.h>
+#include <core/video_format.h>
+
+#include <tbb/concurrent_queue.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+struct item
+{
+    core::pixel_format_desc                pix_desc = core::pixel_format::invalid;
+    std::vector<array<const std::uint8_t>> planes;
+    core::image_transform                  transform;
+    core::frame_geometry                   geometry = core::frame_geometry::get_default();
+};
+
+struct layer
+{
+    std::vector<layer> sublayers;
+    std::vector<item>  items;
+    core::blend_mode   blend_mode;
+
+    explicit layer(core::blend_mode blend_mode)
+        : blend_mode(blend_mode)
+    {
+    }
+};
+
+class image_renderer
+{
+    using surface_pool = tbb::concurrent_bounded_queue<std::shared_ptr<surface>>;
+
+    image_kernel                  kernel_;
+    std::shared_ptr<surface_pool> pool_ = std::make_shared<surface_pool>();
+
+  public:
+    image_renderer() { pool_->set_capacity(4); }
+
+    array<const std::uint8_t> operator()(std::vector<layer> layers, const core::video_format_desc& format_desc)
+    {
+        auto target = create_target(format_desc.width, format_desc.height);
+
+        draw(target, std::move(layers));
+
+        return array<const std::uint8_t>(target->data.data(), format_desc.size, std::move(target));
+    }
+
+  private:
+    // Output surfaces are recycled once all consumers have released the frame.
+    std::shared_ptr<surface> create_target(int width, int height)
+    {
+        std::shared_ptr<surface> target;
+        if (pool_->try_pop(target) && target->width == width && target->height == height) {
+            std::fill(target->data.begin(), target->data.end(), 0);
+        } else {
+            target = std::make_shared<surface>(width, height, 4);
+        }
+
+        std::weak_ptr<surface_pool> weak_pool = pool_;
+        return std::shared_ptr<surface>(target.get(), [target, weak_pool](surface*) {
+            auto pool = weak_pool.lock();
+            if (pool) {
+                pool->try_push(target);
+            }
+        });
+    }
+
+    void draw(std::shared_ptr<surface>& target, std::vector<layer> layers)
+    {
+        std::shared_ptr<surface> layer_key;
+
+        for (auto& layer : layers) {
+            draw(target, layer.sublayers);
+            draw(target, std::move(layer), layer_key);
+        }
+    }
+
+    void draw(std::shared_ptr<surface>& target, layer layer, std::shared_ptr<surface>& layer_key)
+    {
+        if (layer.items.empty())
+            return;
+
+        std::shared_ptr<surface> local_key;
+        std::shared_ptr<surface> local_mix;
+
+        for (auto& item : layer.items)
+            draw(target, std::move(item), layer.blend_mode, layer_key, local_key, local_mix);
+
+        draw(target, std::move(local_mix));
+
+        layer_key = std::move(local_key);
+    }
+
+    void draw(std::shared_ptr<surface>& target,
+              item                      item,
+              core::blend_mode          blend_mode,
+              std::shared_ptr<surface>& layer_key,
+              std::shared_ptr<surface>& local_key,
+              std::shared_ptr<surface>& local_mix)
+    {
+        draw_params draw_params;
+        draw_params.pix_desc   = std::move(item.pix_desc);
+        draw_params.planes     = std::move(item.planes);
+        draw_params.transform  = std::move(item.transform);
+        draw_params.geometry   = item.geometry;
+        draw_params.blend_mode = blend_mode;
+
+        if (draw_params.transform.is_key) {
+            local_key = local_key ? local_key : std::make_shared<surface>(target->width, target->height, 1);
+
+            draw_params.background = local_key;
+            draw_params.local_key  = nullptr;
+            draw_params.layer_key  = nullptr;
+
+            kernel_.draw(draw_params);
+        } else if (draw_params.transform.is_mix) {
+            local_mix = local_mix ? local_mix : std::make_shared<surface>(target->width, target->height, 4);
+
+            draw_params.background = local_mix;
+            draw_params.local_key  = std::move(local_key);
+            draw_params.layer_key  = layer_key;
+
+            draw_params.keyer = keyer::additive;
+
+            kernel_.draw(draw_params);
+        } else {
+            draw(target, std::move(local_mix));
+
+            draw_params.background = target;
+            draw_params.local_key  = std::move(local_key);
+            draw_params.layer_key  = layer_key;
+
+            kernel_.draw(draw_params);
+        }
+    }
+
+    void draw(std::shared_ptr<surface>& target, std::shared_ptr<surface>&& source)
+    {
+        if (!source)
+            return;
+
+        draw_params draw_params;
+        draw_params.pix_desc.format = core::pixel_format::bgra;
+        draw_params.pix_desc.planes = {core::pixel_format_desc::plane(source->width, source->height, 4)};
+        draw_params.planes          = {array<const std::uint8_t>(source->data.data(), source->data.size(), source)};
+        draw_params.background      = target;
+
+        kernel_.draw(draw_params);
+    }
+};
+
+struct image_mixer::impl : public core::frame_factory
+{
+    image_renderer                     renderer_;
+    std::vector<core::image_transform> transform_stack_;
+    std::vector<layer>                 layers_; // layer/stream/items
+    std::vector<layer*>                layer_stack_;
+    executor                           executor_;
+
+  public:
+    explicit impl(int channel_id)
+        : transform_stack_(1)
+        , executor_(L"cpu image mixer " + std::to_wstring(channel_id))
+    {
+        CASPAR_LOG(info) << L"Initialized CPU Image Mixer for channel " << channel_id;
+    }
+
+    void push(const core::frame_transform& transform)
+    {
+        auto previous_layer_depth = transform_stack_.back().layer_depth;
+        transform_stack_.push_back(transform_stack_.back() * transform.image_transform);
+        auto new_layer_depth = transform_stack_.back().layer_depth;
+
+        if (previous_layer_depth < new_layer_depth) {
+            layer new_layer(transform_stack_.back().blend_mode);
+
+            if (layer_stack_.empty()) {
+                layers_.push_back(std::move(new_layer));
+                layer_stack_.push_back(&layers_.back());
+            } else {
+                layer_stack_.back()->sublayers.push_back(std::move(new_layer));
+                layer_stack_.push_back(&layer_stack_.back()->sublayers.back());
+            }
+        }
+    }
+
+    void visit(const core::const_frame& frame)
+    {
+        if (frame.pixel_format_desc().format == core::pixel_format::invalid)
+            return;
+
+        if (frame.pixel_format_desc().planes.empty())
+            return;
+
+        item item;
+        item.pix_desc  = frame.pixel_format_desc();
+        item.transform = transform_stack_.back();
+        item.geometry  = frame.geometry();
+
+        for (int n = 0; n < static_cast<int>(item.pix_desc.planes.size()); ++n) {
+            item.planes.push_back(frame.image_data(n));
+        }
+
+        layer_stack_.back()->items.push_back(std::move(item));
+    }
+
+    void pop()
+    {
+        transform_stack_.pop_back();
+        layer_stack_.resize(transform_stack_.back().layer_depth);
+    }
+
+    std::future<array<const std::uint8_t>> render(const core::video_format_desc& format_desc)
+    {
+        auto layers = std::move(layers_);
+        layers_.clear();
+
+        if (layers.empty()) { // Bypass mixing with empty frame.
+            static const std::vector<uint8_t> buffer(8192 * 8192 * 8, 0);
+            return make_ready_future(array<const std::uint8_t>(buffer.data(), format_desc.size, true));
+        }
+
+        return executor_.begin_invoke([this, layers = std::move(layers), format_desc]() mutable {
+            return renderer_(std::move(layers), format_desc);
+        });
+    }
+
+    core::mutable_frame create_frame(const void* tag, const core::pixel_format_desc& desc) override
+    {
+        std::vector<array<std::uint8_t>> image_data;
+        for (auto& plane : desc.planes) {
+            image_data.push_back(array<std::uint8_t>(plane.size));
+        }
+
+        return core::mutable_frame(tag, std::move(image_data), array<int32_t>{}, desc);
+    }
+
+#ifdef WIN32
+    core::const_frame
+    import_d3d_texture(const void* tag, const std::shared_ptr<d3d::d3d_texture2d>& d3d_texture, bool vflip) override
+    {
+        CASPAR_THROW_EXCEPTION(not_supported() << msg_info("The CPU image mixer cannot import d3d textures."));
+    }
+#endif
+};
+
+image_mixer::image_mixer(int channel_id)
+    : impl_(std::make_unique<impl>(channel_id))
+{
+}
+image_mixer::~image_mixer() {}
+void image_mixer::push(const core::frame_transform& transform) { impl_->push(transform); }
+void image_mixer::visit(const core::const_frame& frame) { impl_->visit(frame); }
+void image_mixer::pop() { impl_->pop(); }
+std::future<array<const std::uint8_t>> image_mixer::operator()(const core::video_format_desc& format_desc)
+{
+    return impl_->render(format_desc);
+}
+core::mutable_frame image_mixer::create_frame(const void* tag, const core::pixel_format_desc& desc)
+{
+    return impl_->create_frame(tag, desc);
+}
+
+#ifdef WIN32
+core::const_frame
+image_mixer::import_d3d_texture(const void* tag, const std::shared_ptr<d3d::d3d_texture2d>& d3d_texture, bool vflip)
+{
+    return impl_->import_d3d_texture(tag, d3d_texture, vflip);
+}
+#endif
+}}} // namespace caspar::accelerator::cpu
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common/array.h>
+
+#include <core/frame/frame.h>
+#include <core/mixer/image/image_mixer.h>
+#include <core/video_format.h>
+
+#include <future>
+#include <memory>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+class image_mixer final : public core::image_mixer
+{
+  public:
+    explicit image_mixer(int channel_id);
+    image_mixer(const image_mixer&) = delete;
+
+    ~image_mixer();
+
+    image_mixer& operator=(const image_mixer&) = delete;
+
+    std::future<array<const std::uint8_t>> operator()(const core::video_format_desc& format_desc) override;
+    core::mutable_frame                    create_frame(const void* tag, const core::pixel_format_desc& desc) override;
+#ifdef WIN32
+    core::const_frame
+    import_d3d_texture(const void* tag, const std::shared_ptr<d3d::d3d_texture2d>& d3d_texture, bool vflip) override;
+#endif
+
+    // core::image_mixer
+
+    void push(const core::frame_transform& frame) override;
+    void visit(const core::const_frame& frame) override;
+    void pop() override;
+
+  private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
+
+}}} // namespace caspar::accelerator::cpu
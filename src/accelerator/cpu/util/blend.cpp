@@ -0,0 +1,214 @@
+#include "blend.h"
+
+#include <common/simd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+namespace {
+
+inline int div255(int x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+inline __m128i div255(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+CASPAR_AVX2 inline __m256i div255(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+inline int scale(const std::uint8_t* key, int opacity, std::size_t n)
+{
+    return key ? div255(key[n] * opacity) : opacity;
+}
+
+// Expands 4 key values into per channel 16 bit multipliers for pixel 0-1 (lo) and 2-3 (hi).
+inline void load_scale(const std::uint8_t* key, int opacity, __m128i& lo, __m128i& hi)
+{
+    if (!key) {
+        lo = hi = _mm_set1_epi16(static_cast<short>(opacity));
+        return;
+    }
+
+    std::int32_t k4;
+    std::memcpy(&k4, key, sizeof(k4));
+
+    auto k = _mm_unpacklo_epi8(_mm_cvtsi32_si128(k4), _mm_setzero_si128());
+    k      = _mm_unpacklo_epi16(k, k);
+    lo     = div255(_mm_mullo_epi16(_mm_unpacklo_epi32(k, k), _mm_set1_epi16(static_cast<short>(opacity))));
+    hi     = div255(_mm_mullo_epi16(_mm_unpackhi_epi32(k, k), _mm_set1_epi16(static_cast<short>(opacity))));
+}
+
+// Expands 8 key values into per channel 16 bit multipliers matching the in-lane order of _mm256_unpack*_epi8, i.e.
+// pixel 0-1, 4-5 (lo) and 2-3, 6-7 (hi).
+CASPAR_AVX2 inline void load_scale(const std::uint8_t* key, int opacity, __m256i& lo, __m256i& hi)
+{
+    if (!key) {
+        lo = hi = _mm256_set1_epi16(static_cast<short>(opacity));
+        return;
+    }
+
+    auto k8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(key));
+    k8      = _mm_shuffle_epi8(k8, _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1));
+
+    auto k_lo = _mm256_cvtepu8_epi64(k8);
+    auto k_hi = _mm256_cvtepu8_epi64(_mm_srli_si128(k8, 4));
+    k_lo      = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(k_lo, 0), 0);
+    k_hi      = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(k_hi, 0), 0);
+
+    lo = div255(_mm256_mullo_epi16(k_lo, _mm256_set1_epi16(static_cast<short>(opacity))));
+    hi = div255(_mm256_mullo_epi16(k_hi, _mm256_set1_epi16(static_cast<short>(opacity))));
+}
+
+template <bool Additive>
+void blend_scalar(std::uint8_t* dest, const std::uint8_t* source, const std::uint8_t* key, int opacity, std::size_t count)
+{
+    for (std::size_t n = 0; n < count; ++n, dest += 4, source += 4) {
+        auto m  = scale(key, opacity, n);
+        auto ia = Additive ? 255 : 255 - div255(source[3] * m);
+        for (int c = 0; c < 4; ++c) {
+            dest[c] = static_cast<std::uint8_t>(std::min(255, div255(source[c] * m) + div255(dest[c] * ia)));
+        }
+    }
+}
+
+template <bool Additive>
+std::size_t blend_sse2(std::uint8_t* dest, const std::uint8_t* source, const std::uint8_t* key, int opacity, std::size_t count)
+{
+    const auto zero     = _mm_setzero_si128();
+    const auto full     = _mm_set1_epi16(255);
+    const auto is_unity = !key && opacity == 255;
+
+    std::size_t n = 0;
+    for (; n + 4 <= count; n += 4) {
+        auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n * 4));
+        auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + n * 4));
+
+        auto s_lo = _mm_unpacklo_epi8(s, zero);
+        auto s_hi = _mm_unpackhi_epi8(s, zero);
+
+        if (!is_unity) {
+            __m128i m_lo, m_hi;
+            load_scale(key ? key + n : nullptr, opacity, m_lo, m_hi);
+            s_lo = div255(_mm_mullo_epi16(s_lo, m_lo));
+            s_hi = div255(_mm_mullo_epi16(s_hi, m_hi));
+        }
+
+        if (Additive) {
+            d = _mm_adds_epu8(_mm_packus_epi16(s_lo, s_hi), d);
+        } else {
+            auto ia_lo = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xFF), 0xFF));
+            auto ia_hi = _mm_sub_epi16(full, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xFF), 0xFF));
+
+            auto d_lo = _mm_add_epi16(s_lo, div255(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo)));
+            auto d_hi = _mm_add_epi16(s_hi, div255(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi)));
+
+            d = _mm_packus_epi16(d_lo, d_hi);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + n * 4), d);
+    }
+    return n;
+}
+
+template <bool Additive>
+CASPAR_AVX2 std::size_t
+blend_avx2(std::uint8_t* dest, const std::uint8_t* source, const std::uint8_t* key, int opacity, std::size_t count)
+{
+    const auto zero     = _mm256_setzero_si256();
+    const auto full     = _mm256_set1_epi16(255);
+    const auto is_unity = !key && opacity == 255;
+
+    std::size_t n = 0;
+    for (; n + 8 <= count; n += 8) {
+        auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + n * 4));
+        auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + n * 4));
+
+        auto s_lo = _mm256_unpacklo_epi8(s, zero);
+        auto s_hi = _mm256_unpackhi_epi8(s, zero);
+
+        if (!is_unity) {
+            __m256i m_lo, m_hi;
+            load_scale(key ? key + n : nullptr, opacity, m_lo, m_hi);
+            s_lo = div255(_mm256_mullo_epi16(s_lo, m_lo));
+            s_hi = div255(_mm256_mullo_epi16(s_hi, m_hi));
+        }
+
+        if (Additive) {
+            d = _mm256_adds_epu8(_mm256_packus_epi16(s_lo, s_hi), d);
+        } else {
+            auto ia_lo = _mm256_sub_epi16(full, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_lo, 0xFF), 0xFF));
+            auto ia_hi = _mm256_sub_epi16(full, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s_hi, 0xFF), 0xFF));
+
+            auto d_lo = _mm256_add_epi16(s_lo, div255(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia_lo)));
+            auto d_hi = _mm256_add_epi16(s_hi, div255(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia_hi)));
+
+            d = _mm256_packus_epi16(d_lo, d_hi);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + n * 4), d);
+    }
+    return n;
+}
+
+template <bool Additive>
+void blend(std::uint8_t* dest, const std::uint8_t* source, const std::uint8_t* key, int opacity, std::size_t count)
+{
+    if (opacity <= 0) {
+        return;
+    }
+    opacity = std::min(opacity, 255);
+
+    std::size_t n = 0;
+    if (has_avx2()) {
+        n += blend_avx2<Additive>(dest, source, key, opacity, count);
+    }
+    n += blend_sse2<Additive>(dest + n * 4, source + n * 4, key ? key + n : nullptr, opacity, count - n);
+    blend_scalar<Additive>(dest + n * 4, source + n * 4, key ? key + n : nullptr, opacity, count - n);
+}
+
+} // namespace
+
+void blend_normal(std::uint8_t*       dest,
+                  const std::uint8_t* source,
+                  const std::uint8_t* key,
+                  int                 opacity,
+                  std::size_t         count)
+{
+    blend<false>(dest, source, key, opacity, count);
+}
+
+void blend_additive(std::uint8_t*       dest,
+                    const std::uint8_t* source,
+                    const std::uint8_t* key,
+                    int                 opacity,
+                    std::size_t         count)
+{
+    blend<true>(dest, source, key, opacity, count);
+}
+
+void blend_key(std::uint8_t* dest, const std::uint8_t* source, std::size_t count)
+{
+    for (std::size_t n = 0; n < count; ++n, source += 4) {
+        dest[n] = static_cast<std::uint8_t>(std::min(255, source[2] + div255(dest[n] * (255 - source[3]))));
+    }
+}
+
+void multiply_key(std::uint8_t* dest, const std::uint8_t* a, const std::uint8_t* b, std::size_t count)
+{
+    for (std::size_t n = 0; n < count; ++n) {
+        dest[n] = static_cast<std::uint8_t>(div255(a[n] * b[n]));
+    }
+}
+
+}}} // namespace caspar::accelerator::cpu
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace caspar { namespace accelerator { namespace cpu {
+
+// All blend functions operate on rows of premultiplied BGRA pixels. The source is scaled by opacity (0-255) and, if
+// key is not null, by a per pixel key (0-255) before it is blended.
+
+// dest = source + (1 - source.a) * dest
+void blend_normal(std::uint8_t*       dest,
+                  const std::uint8_t* source,
+                  const std::uint8_t* key,
+                  int                 opacity,
+                  std::size_t         count);
+
+// dest = min(source + dest, 1)
+void blend_additive(std::uint8_t*       dest,
+                    const std::uint8_t* source,
+                    const std::uint8_t* key,
+                    int                 opacity,
+                    std::size_t         count);
+
+// Single channel key, dest = source.r + (1 - source.a) * dest
+void blend_key(std::uint8_t* dest, const std::uint8_t* source, std::size_t count);
+
+// dest = a * b
+void multiply_key(std::uint8_t* dest, const std::uint8_t* a, const std::uint8_t* b, std::size_t count);
+
+}}} // namespace caspar::accelerator::cpu
@@ -27,6 +27,7 @@
 #include "../util/texture.h"
 
 #include <common/array.h>
+#include <common/diagnostics/graph.h>
 #include <common/future.h>
 #include <common/log.h>
 
@@ -73,8 +74,9 @@ struct layer
 
 class image_renderer
 {
-    spl::shared_ptr<device> ogl_;
-    image_kernel            kernel_;
+    spl::shared_ptr<device>             ogl_;
+    image_kernel                        kernel_;
+    std::shared_ptr<diagnostics::graph> graph_;
 
   public:
     explicit image_renderer(const spl::shared_ptr<device>& ogl)
@@ -83,6 +85,12 @@ class image_renderer
     {
     }
 
+    void set_graph(const spl::shared_ptr<diagnostics::graph>& graph)
+    {
+        graph_ = graph;
+        graph_->set_color("readback-time", diagnostics::color(0.6f, 0.6f, 1.0f, 0.8f));
+    }
+
     std::future<array<const std::uint8_t>> operator()(std::vector<layer>             layers,
                                                       const core::video_format_desc& format_desc)
     {
@@ -91,12 +99,19 @@ class image_renderer
             return make_ready_future(array<const std::uint8_t>(buffer.data(), format_desc.size, true));
         }
 
+        std::function<void(double)> on_latency;
+        if (graph_) {
+            on_latency = [graph = graph_, fps = format_desc.fps](double latency) {
+                graph->set_value("readback-time", latency * fps * 0.5);
+            };
+        }
+
         return flatten(ogl_->dispatch_async([=]() mutable -> std::shared_future<array<const std::uint8_t>> {
             auto target_texture = ogl_->create_texture(format_desc.width, format_desc.height, 4);
 
             draw(target_texture, std::move(layers), format_desc);
 
-            return ogl_->copy_async(target_texture);
+            return ogl_->copy_async(target_texture, std::move(on_latency));
         }));
     }
 
@@ -298,6 +313,8 @@ struct image_mixer::impl
         layer_stack_.resize(transform_stack_.back().layer_depth);
     }
 
+    void set_graph(const spl::shared_ptr<diagnostics::graph>& graph) { renderer_.set_graph(graph); }
+
     std::future<array<const std::uint8_t>> render(const core::video_format_desc& format_desc)
     {
         return renderer_(std::move(layers_), format_desc);
@@ -380,6 +397,7 @@ image_mixer::~image_mixer() {}
 void image_mixer::push(const core::frame_transform& transform) { impl_->push(transform); }
 void image_mixer::visit(const core::const_frame& frame) { impl_->visit(frame); }
 void image_mixer::pop() { impl_->pop(); }
+void image_mixer::set_graph(const spl::shared_ptr<diagnostics::graph>& graph) { impl_->set_graph(graph); }
 std::future<array<const std::uint8_t>> image_mixer::operator()(const core::video_format_desc& format_desc)
 {
     return impl_->render(format_desc);
@@ -55,6 +55,8 @@ class image_mixer final : public core::image_mixer
     void visit(const core::const_frame& frame) override;
     void pop() override;
 
+    void set_graph(const spl::shared_ptr<diagnostics::graph>& graph) override;
+
   private:
     struct impl;
     std::shared_ptr<impl> impl_;
@@ -30,6 +30,7 @@
 #include <common/except.h>
 #include <common/gl/gl_check.h>
 #include <common/os/thread.h>
+#include <common/timer.h>
 
 #include <GL/glew.h>
 
@@ -42,34 +43,195 @@
 
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <tbb/concurrent_queue.h>
-#include <tbb/concurrent_unordered_map.h>
 
-#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <future>
+#include <list>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 
 namespace caspar { namespace accelerator { namespace ogl {
 
 using namespace boost::asio;
 
-struct device::impl : public std::enable_shared_from_this<impl>
+namespace {
+
+// Unused textures or buffers keyed by size class. Once the pool holds more than max_size bytes, or an object has
+// been unused for longer than max_age, objects are evicted least recently used first. Evicted objects are returned
+// to the caller since they must be destroyed on the device thread.
+template <typename T>
+class object_pool
 {
-    using texture_queue_t = tbb::concurrent_bounded_queue<std::shared_ptr<texture>>;
-    using buffer_queue_t  = tbb::concurrent_bounded_queue<std::shared_ptr<buffer>>;
+    using clock = std::chrono::steady_clock;
+
+    struct entry
+    {
+        std::uint64_t      key;
+        std::size_t        size;
+        std::shared_ptr<T> object;
+        clock::time_point  released;
+    };
+
+    using lru_t = std::list<entry>;
+
+    using free_t = std::unordered_map<std::uint64_t, std::deque<typename lru_t::iterator>>;
+
+    mutable std::mutex mutex_;
+    lru_t              lru_; // Least recently used first.
+    free_t             free_;
+    std::size_t        size_      = 0;
+    std::uint64_t      hits_      = 0;
+    std::uint64_t      misses_    = 0;
+    std::uint64_t      evictions_ = 0;
+
+    const std::size_t     max_size_;
+    const clock::duration max_age_;
+
+  public:
+    object_pool(std::size_t max_size, clock::duration max_age)
+        : max_size_(max_size)
+        , max_age_(max_age)
+    {
+    }
+
+    std::shared_ptr<T> try_pop(std::uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = free_.find(key);
+        if (it == free_.end() || it->second.empty()) {
+            misses_ += 1;
+            return nullptr;
+        }
+
+        // Prefer the most recently used object, which is the most likely to still be resident.
+        auto pos    = it->second.back();
+        auto object = std::move(pos->object);
+        size_ -= pos->size;
+        it->second.pop_back();
+        lru_.erase(pos);
+        hits_ += 1;
+
+        return object;
+    }
+
+    std::vector<std::shared_ptr<T>> push(std::uint64_t key, std::size_t size, std::shared_ptr<T> object)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        const auto now = clock::now();
+
+        free_[key].push_back(lru_.insert(lru_.end(), entry{key, size, std::move(object), now}));
+        size_ += size;
+
+        std::vector<std::shared_ptr<T>> evicted;
+        while (!lru_.empty() && (size_ > max_size_ || now - lru_.front().released > max_age_)) {
+            auto& front = lru_.front();
+            auto& queue = free_[front.key];
+            queue.pop_front();
+            if (queue.empty()) {
+                free_.erase(front.key);
+            }
+            size_ -= front.size;
+            evicted.push_back(std::move(front.object));
+            lru_.pop_front();
+            evictions_ += 1;
+        }
+
+        return evicted;
+    }
+
+    std::vector<std::shared_ptr<T>> clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::vector<std::shared_ptr<T>> evicted;
+        for (auto& e : lru_) {
+            evicted.push_back(std::move(e.object));
+        }
+        lru_.clear();
+        free_.clear();
+        size_ = 0;
+
+        return evicted;
+    }
+
+    template <typename Func>
+    void for_each(Func&& func) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto& p : free_) {
+            func(p.first, p.second.size());
+        }
+    }
+
+    boost::property_tree::wptree info() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        boost::property_tree::wptree info;
+        info.add(L"size", size_);
+        info.add(L"max_size", max_size_);
+        info.add(L"count", lru_.size());
+        info.add(L"hits", hits_);
+        info.add(L"misses", misses_);
+        info.add(L"evictions", evictions_);
+        return info;
+    }
+};
+
+// Textures are pooled by exact dimensions, since they are sampled and uploaded in full.
+std::uint64_t texture_key(int width, int height, int stride)
+{
+    return static_cast<std::uint64_t>(stride) << 32 | static_cast<std::uint64_t>(width) << 16 |
+           static_cast<std::uint64_t>(height);
+}
+
+// Rounds up to a step of a sixteenth to an eighth of the size, at least 4 KiB, so that similar sizes share buffers.
+std::size_t buffer_size_class(std::size_t size)
+{
+    std::size_t step = 4096;
+    while (step * 16 <= size) {
+        step *= 2;
+    }
+    return (size + step - 1) / step * step;
+}
+
+std::uint64_t buffer_key(std::size_t size, bool write)
+{
+    return static_cast<std::uint64_t>(size) << 1 | (write ? 1 : 0);
+}
+
+} // namespace
 
+struct device::impl : public std::enable_shared_from_this<impl>
+{
     sf::Context device_;
 
-    std::array<tbb::concurrent_unordered_map<size_t, texture_queue_t>, 4> device_pools_;
-    std::array<tbb::concurrent_unordered_map<size_t, buffer_queue_t>, 2>  host_pools_;
+    object_pool<texture> texture_pool_;
+    object_pool<buffer>  buffer_pool_;
 
     using sync_queue_t = tbb::concurrent_bounded_queue<std::shared_ptr<buffer>>;
 
     sync_queue_t sync_queue_;
 
+    struct pending_fence
+    {
+        GLsync                fence = nullptr;
+        std::function<void()> signaled;
+    };
+
+    tbb::concurrent_bounded_queue<pending_fence> fences_;
+
     GLuint fbo_;
 
     std::wstring version_;
@@ -83,10 +245,20 @@ struct device::impl : public std::enable_shared_from_this<impl>
     decltype(make_work_guard(service_)) work_;
     std::thread                         thread_;
 
+    sf::Context fence_device_;
+    std::thread fence_thread_;
+
     impl()
         : device_(sf::ContextSettings(0, 0, 0, 4, 5, sf::ContextSettings::Attribute::Core), 1, 1)
+        , texture_pool_(env::properties().get(L"configuration.ogl.pool-max-device-size", 2048) * 1024ULL * 1024ULL,
+                        std::chrono::seconds(env::properties().get(L"configuration.ogl.pool-max-age", 60)))
+        , buffer_pool_(env::properties().get(L"configuration.ogl.pool-max-host-size", 1024) * 1024ULL * 1024ULL,
+                       std::chrono::seconds(env::properties().get(L"configuration.ogl.pool-max-age", 60)))
         , work_(make_work_guard(service_))
+        , fence_device_(sf::ContextSettings(0, 0, 0, 4, 5, sf::ContextSettings::Attribute::Core), 1, 1)
     {
+        fence_device_.setActive(false);
+
         CASPAR_LOG(info) << L"Initializing OpenGL Device.";
 
         device_.setActive(true);
@@ -139,6 +311,27 @@ struct device::impl : public std::enable_shared_from_this<impl>
             service_.run();
             device_.setActive(false);
         });
+
+        // Waits on fences in a shared context so that readbacks complete as soon as the GPU is done.
+        fence_thread_ = std::thread([&] {
+            fence_device_.setActive(true);
+            set_thread_name(L"OpenGL Fence");
+            while (true) {
+                pending_fence pending;
+                fences_.pop(pending);
+                if (!pending.fence) {
+                    break;
+                }
+
+                // Fences signal in submission order, so any fences queued behind this one are usually done by
+                // the time it is.
+                while (glClientWaitSync(pending.fence, 0, 100000000) == GL_TIMEOUT_EXPIRED) {
+                }
+
+                pending.signaled();
+            }
+            fence_device_.setActive(false);
+        });
     }
 
     ~impl()
@@ -146,13 +339,13 @@ struct device::impl : public std::enable_shared_from_this<impl>
         work_.reset();
         thread_.join();
 
-        device_.setActive(true);
+        fences_.push(pending_fence{});
+        fence_thread_.join();
 
-        for (auto& pool : host_pools_)
-            pool.clear();
+        device_.setActive(true);
 
-        for (auto& pool : device_pools_)
-            pool.clear();
+        buffer_pool_.clear();
+        texture_pool_.clear();
 
         sync_queue_.clear();
 
@@ -189,6 +382,22 @@ struct device::impl : public std::enable_shared_from_this<impl>
         return dispatch_async(std::forward<Func>(func)).get();
     }
 
+    void wait_async(GLsync fence, yield_context yield)
+    {
+        GL(glFlush());
+
+        deadline_timer timer(service_);
+        timer.expires_at(boost::posix_time::pos_infin);
+
+        // Handlers only run once the coroutine has yielded, so the timer is waiting by the time it is cancelled.
+        fences_.push(pending_fence{fence, [&] { post(service_, [&] { timer.cancel(); }); }});
+
+        boost::system::error_code ec;
+        timer.async_wait(yield[ec]);
+
+        glDeleteSync(fence);
+    }
+
     std::wstring version() { return version_; }
 
     std::shared_ptr<texture> create_texture(int width, int height, int stride, bool clear)
@@ -196,11 +405,10 @@ struct device::impl : public std::enable_shared_from_this<impl>
         CASPAR_VERIFY(stride > 0 && stride < 5);
         CASPAR_VERIFY(width > 0 && height > 0);
 
-        // TODO (perf) Shared pool.
-        auto pool = &device_pools_[stride - 1][(width << 16 & 0xFFFF0000) | (height & 0x0000FFFF)];
+        const auto key = texture_key(width, height, stride);
 
-        std::shared_ptr<texture> tex;
-        if (!pool->try_pop(tex)) {
+        auto tex = texture_pool_.try_pop(key);
+        if (!tex) {
             tex = std::make_shared<texture>(width, height, stride);
         }
 
@@ -209,19 +417,32 @@ struct device::impl : public std::enable_shared_from_this<impl>
         }
 
         auto ptr = tex.get();
-        return std::shared_ptr<texture>(
-            ptr, [tex = std::move(tex), pool, self = shared_from_this()](texture*) mutable { pool->push(tex); });
+        return std::shared_ptr<texture>(ptr, [tex = std::move(tex), key, self = shared_from_this()](texture*) mutable {
+            const auto size    = tex->size();
+            auto       evicted = self->texture_pool_.push(key, size, std::move(tex));
+            if (!evicted.empty()) {
+                // Textures must be deleted with the context current.
+                post(self->service_, [evicted = std::move(evicted)] {});
+            }
+        });
+    }
+
+    // Only called on the device thread, where evicted buffers can be deleted right away.
+    void release_buffer(std::shared_ptr<buffer> buf)
+    {
+        const auto key  = buffer_key(buf->size(), buf->write());
+        const auto size = buf->size();
+        buffer_pool_.push(key, size, std::move(buf));
     }
 
     std::shared_ptr<buffer> create_buffer(int size, bool write)
     {
         CASPAR_VERIFY(size > 0);
 
-        // TODO (perf) Shared pool.
-        auto pool = &host_pools_[static_cast<int>(write ? 1 : 0)][size];
+        size = static_cast<int>(buffer_size_class(size));
 
-        std::shared_ptr<buffer> buf;
-        if (!pool->try_pop(buf)) {
+        auto buf = buffer_pool_.try_pop(buffer_key(size, write));
+        if (!buf) {
             // TODO (perf) Avoid blocking in create_array.
             dispatch_sync([&] { buf = std::make_shared<buffer>(size, write); });
         }
@@ -236,7 +457,7 @@ struct device::impl : public std::enable_shared_from_this<impl>
     {
         auto buf = create_buffer(size, true);
         auto ptr = reinterpret_cast<uint8_t*>(buf->data());
-        return array<uint8_t>(ptr, buf->size(), buf);
+        return array<uint8_t>(ptr, size, buf);
     }
 
     std::future<std::shared_ptr<texture>>
@@ -261,7 +482,8 @@ struct device::impl : public std::enable_shared_from_this<impl>
         });
     }
 
-    std::future<array<const uint8_t>> copy_async(const std::shared_ptr<texture>& source)
+    std::future<array<const uint8_t>> copy_async(const std::shared_ptr<texture>&  source,
+                                                 std::function<void(double)> on_latency)
     {
         return spawn_async([=](yield_context yield) {
             auto buf = create_buffer(source->size(), false);
@@ -269,34 +491,23 @@ struct device::impl : public std::enable_shared_from_this<impl>
 
             sync_queue_.push(nullptr);
 
-            auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-
-            GL(glFlush());
+            caspar::timer latency_timer;
 
-            deadline_timer timer(service_);
-            for (auto n = 0; true; ++n) {
-                // TODO (perf) Smarter non-polling solution?
-                timer.expires_from_now(boost::posix_time::milliseconds(2));
-                timer.async_wait(yield);
+            wait_async(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), yield);
 
-                auto wait = glClientWaitSync(fence, 0, 1);
-                if (wait == GL_ALREADY_SIGNALED || wait == GL_CONDITION_SATISFIED) {
-                    break;
-                }
+            if (on_latency) {
+                on_latency(latency_timer.elapsed());
             }
 
-            glDeleteSync(fence);
-
             {
                 std::shared_ptr<buffer> buf2;
                 while (sync_queue_.try_pop(buf2) && buf2) {
-                    auto pool = &host_pools_[static_cast<int>(buf2->write() ? 1 : 0)][buf2->size()];
-                    pool->push(std::move(buf2));
+                    release_buffer(std::move(buf2));
                 }
             }
 
             auto ptr  = reinterpret_cast<uint8_t*>(buf->data());
-            auto size = buf->size();
+            auto size = source->size();
             return array<const uint8_t>(ptr, size, std::move(buf));
         });
     }
@@ -309,23 +520,7 @@ struct device::impl : public std::enable_shared_from_this<impl>
 
             tex->copy_from(source);
 
-            auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-
-            GL(glFlush());
-
-            deadline_timer timer(service_);
-            for (auto n = 0; true; ++n) {
-                // TODO (perf) Smarter non-polling solution?
-                timer.expires_from_now(boost::posix_time::milliseconds(2));
-                timer.async_wait(yield);
-
-                auto wait = glClientWaitSync(fence, 0, 1);
-                if (wait == GL_ALREADY_SIGNALED || wait == GL_CONDITION_SATISFIED) {
-                    break;
-                }
-            }
-
-            glDeleteSync(fence);
+            wait_async(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), yield);
 
             return tex;
         });
@@ -340,35 +535,26 @@ struct device::impl : public std::enable_shared_from_this<impl>
         size_t                       total_pooled_device_buffer_size  = 0;
         size_t                       total_pooled_device_buffer_count = 0;
 
-        for (size_t i = 0; i < device_pools_.size(); ++i) {
-            auto& pools      = device_pools_.at(i);
-            bool  mipmapping = i > 3;
-            auto  stride     = mipmapping ? i - 3 : i + 1;
-
-            for (auto& pool : pools) {
-                auto width  = pool.first >> 16;
-                auto height = pool.first & 0x0000FFFF;
-                auto size   = width * height * stride;
-                auto count  = pool.second.size();
+        texture_pool_.for_each([&](std::uint64_t key, std::size_t count) {
+            auto stride = static_cast<int>(key >> 32);
+            auto width  = static_cast<int>(key >> 16 & 0xFFFF);
+            auto height = static_cast<int>(key & 0xFFFF);
+            auto size   = static_cast<std::size_t>(width) * height * stride;
 
-                if (count == 0)
-                    continue;
+            boost::property_tree::wptree pool_info;
 
-                boost::property_tree::wptree pool_info;
+            pool_info.add(L"stride", stride);
+            pool_info.add(L"mipmapping", false);
+            pool_info.add(L"width", width);
+            pool_info.add(L"height", height);
+            pool_info.add(L"size", size);
+            pool_info.add(L"count", count);
 
-                pool_info.add(L"stride", stride);
-                pool_info.add(L"mipmapping", mipmapping);
-                pool_info.add(L"width", width);
-                pool_info.add(L"height", height);
-                pool_info.add(L"size", size);
-                pool_info.add(L"count", count);
+            total_pooled_device_buffer_size += size * count;
+            total_pooled_device_buffer_count += count;
 
-                total_pooled_device_buffer_size += size * count;
-                total_pooled_device_buffer_count += count;
-
-                pooled_device_buffers.add_child(L"device_buffer_pool", pool_info);
-            }
-        }
+            pooled_device_buffers.add_child(L"device_buffer_pool", pool_info);
+        });
 
         info.add_child(L"gl.details.pooled_device_buffers", pooled_device_buffers);
 
@@ -378,38 +564,32 @@ struct device::impl : public std::enable_shared_from_this<impl>
         size_t                       total_read_count  = 0;
         size_t                       total_write_count = 0;
 
-        for (size_t i = 0; i < host_pools_.size(); ++i) {
-            auto& pools    = host_pools_.at(i);
-            auto  is_write = i == 1;
-
-            for (auto& pool : pools) {
-                auto size  = pool.first;
-                auto count = pool.second.size();
+        buffer_pool_.for_each([&](std::uint64_t key, std::size_t count) {
+            auto size     = static_cast<std::size_t>(key >> 1);
+            auto is_write = (key & 1) != 0;
 
-                if (count == 0)
-                    continue;
+            boost::property_tree::wptree pool_info;
 
-                boost::property_tree::wptree pool_info;
+            pool_info.add(L"usage", is_write ? L"write_only" : L"read_only");
+            pool_info.add(L"size", size);
+            pool_info.add(L"count", count);
 
-                pool_info.add(L"usage", is_write ? L"write_only" : L"read_only");
-                pool_info.add(L"size", size);
-                pool_info.add(L"count", count);
+            pooled_host_buffers.add_child(L"host_buffer_pool", pool_info);
 
-                pooled_host_buffers.add_child(L"host_buffer_pool", pool_info);
-
-                (is_write ? total_write_count : total_read_count) += count;
-                (is_write ? total_write_size : total_read_size) += size * count;
-            }
-        }
+            (is_write ? total_write_count : total_read_count) += count;
+            (is_write ? total_write_size : total_read_size) += size * count;
+        });
 
         info.add_child(L"gl.details.pooled_host_buffers", pooled_host_buffers);
         info.add(L"gl.summary.pooled_device_buffers.total_count", total_pooled_device_buffer_count);
         info.add(L"gl.summary.pooled_device_buffers.total_size", total_pooled_device_buffer_size);
+        info.add_child(L"gl.summary.pooled_device_buffers.pool", texture_pool_.info());
         // info.add_child(L"gl.summary.all_device_buffers", texture::info());
         info.add(L"gl.summary.pooled_host_buffers.total_read_count", total_read_count);
         info.add(L"gl.summary.pooled_host_buffers.total_write_count", total_write_count);
         info.add(L"gl.summary.pooled_host_buffers.total_read_size", total_read_size);
         info.add(L"gl.summary.pooled_host_buffers.total_write_size", total_write_size);
+        info.add_child(L"gl.summary.pooled_host_buffers.pool", buffer_pool_.info());
         info.add_child(L"gl.summary.all_host_buffers", buffer::info());
 
         return info;
@@ -421,14 +601,8 @@ struct device::impl : public std::enable_shared_from_this<impl>
             CASPAR_LOG(info) << " ogl: Running GC.";
 
             try {
-                for (auto& pools : device_pools_) {
-                    for (auto& pool : pools)
-                        pool.second.clear();
-                }
-                for (auto& pools : host_pools_) {
-                    for (auto& pool : pools)
-                        pool.second.clear();
-                }
+                texture_pool_.clear();
+                buffer_pool_.clear();
             } catch (...) {
                 CASPAR_LOG_CURRENT_EXCEPTION();
             }
@@ -451,9 +625,10 @@ device::copy_async(const array<const uint8_t>& source, int width, int height, in
 {
     return impl_->copy_async(source, width, height, stride);
 }
-std::future<array<const uint8_t>> device::copy_async(const std::shared_ptr<texture>& source)
+std::future<array<const uint8_t>> device::copy_async(const std::shared_ptr<texture>&  source,
+                                                     std::function<void(double)> on_latency)
 {
-    return impl_->copy_async(source);
+    return impl_->copy_async(source, std::move(on_latency));
 }
 #ifdef WIN32
 std::shared_ptr<void>                 device::d3d_interop() const { return impl_->interop_handle_; }
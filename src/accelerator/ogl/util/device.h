@@ -50,7 +50,9 @@ class device final
 
     std::future<std::shared_ptr<class texture>>
                                       copy_async(const array<const uint8_t>& source, int width, int height, int stride);
-    std::future<array<const uint8_t>> copy_async(const std::shared_ptr<class texture>& source);
+    // on_latency receives the seconds from issuing the readback until its fence signalled.
+    std::future<array<const uint8_t>> copy_async(const std::shared_ptr<class texture>& source,
+                                                 std::function<void(double)>          on_latency = nullptr);
 #ifdef WIN32
     std::shared_ptr<void>                 d3d_interop() const;
     std::future<std::shared_ptr<texture>> copy_async(GLuint source, int width, int height, int stride);
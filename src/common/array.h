@@ -48,6 +48,14 @@ class array final
     {
     }
 
+    // Refers to the storage of other while keeping owner alive.
+    explicit array(T* ptr, std::size_t size, const array<T>& other, std::shared_ptr<void> owner)
+        : ptr_(ptr)
+        , size_(size)
+        , storage_(std::move(owner), other.storage_.get())
+    {
+    }
+
     array(const array<T>&) = delete;
 
     array(array&& other)
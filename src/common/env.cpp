@@ -25,6 +25,7 @@
 #include "except.h"
 #include "log.h"
 #include "os/filesystem.h"
+#include "os/folder_cache.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -112,6 +113,10 @@ void configure(const std::wstring& filename)
     ensure_writable(log);
     ensure_writable(ftemplate);
     ensure_writable(data);
+
+    folder_cache::watch(media);
+    folder_cache::watch(ftemplate);
+    folder_cache::watch(data);
 }
 
 const std::wstring& initial_folder()
@@ -21,6 +21,7 @@
 #include "log.h"
 
 #include "except.h"
+#include "os/thread.h"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -41,8 +42,16 @@
 #include <boost/smart_ptr/make_shared_object.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <tbb/concurrent_queue.h>
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace logging  = boost::log;
 namespace src      = boost::log::sources;
@@ -159,23 +168,182 @@ void my_formatter(bool print_all_characters, const boost::log::record_view& rec,
     }
 }
 
-void add_file_sink(const std::wstring& file)
+enum class overflow_policy
+{
+    block,
+    drop_oldest,
+    drop_debug
+};
+
+// Queueing strategy of the file sink. Records are formatted and written by a thread of its own, so that logging
+// threads don't wait for the disk. Unless the policy is block, records are dropped rather than waiting for space.
+class bounded_record_queue
+{
+    tbb::concurrent_bounded_queue<logging::record_view> queue_;
+    overflow_policy                                     policy_ = overflow_policy::drop_oldest;
+    std::atomic<std::uint64_t>                          dropped_{0};
+    std::atomic<bool>                                   waiting_{false};
+    std::mutex                                          mutex_;
+    std::condition_variable                             cond_;
+
+    void drop_oldest()
+    {
+        logging::record_view oldest;
+        if (queue_.try_pop(oldest)) {
+            dropped_ += 1;
+        }
+    }
+
+    void notify()
+    {
+        if (waiting_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
+    }
+
+  protected:
+    bounded_record_queue() = default;
+
+    template <typename ArgsT>
+    explicit bounded_record_queue(const ArgsT&)
+    {
+    }
+
+    void enqueue(const logging::record_view& rec)
+    {
+        if (policy_ == overflow_policy::block) {
+            queue_.push(rec);
+        } else {
+            if (policy_ == overflow_policy::drop_debug && queue_.size() >= queue_.capacity() / 4 * 3) {
+                auto severity = logging::extract<logging::trivial::severity_level>("Severity", rec);
+                if (!severity || *severity <= logging::trivial::debug) {
+                    dropped_ += 1;
+                    return;
+                }
+            }
+            while (!queue_.try_push(rec)) {
+                drop_oldest();
+            }
+        }
+        notify();
+    }
+
+    bool try_enqueue(const logging::record_view& rec)
+    {
+        if (!queue_.try_push(rec)) {
+            return false;
+        }
+        notify();
+        return true;
+    }
+
+    bool try_dequeue_ready(logging::record_view& rec) { return queue_.try_pop(rec); }
+
+    bool try_dequeue(logging::record_view& rec) { return queue_.try_pop(rec); }
+
+    // There is no dedicated feeding thread, file_writer feeds the sink.
+    bool dequeue_ready(logging::record_view& rec) { return queue_.try_pop(rec); }
+
+    void interrupt_dequeue() { notify(); }
+
+  public:
+    void configure(std::ptrdiff_t capacity, overflow_policy policy)
+    {
+        queue_.set_capacity(capacity);
+        policy_ = policy;
+    }
+
+    void wait_for_records(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_ = true;
+        cond_.wait_for(lock, timeout, [&] { return !queue_.empty(); });
+        waiting_ = false;
+    }
+
+    std::uint64_t take_dropped() { return dropped_.exchange(0); }
+};
+
+using file_sink_type = sinks::asynchronous_sink<sinks::text_file_backend, bounded_record_queue>;
+
+// Writes whatever is queued in one batch with a single flush, then waits for more.
+class file_writer
 {
-    using file_sink_type = boost::log::sinks::synchronous_sink<boost::log::sinks::text_file_backend>;
+    boost::shared_ptr<file_sink_type> sink_;
+    std::atomic<bool>                 stop_{false};
+    std::thread                       thread_;
+
+  public:
+    explicit file_writer(boost::shared_ptr<file_sink_type> sink)
+        : sink_(std::move(sink))
+        , thread_([this] { run(); })
+    {
+    }
+
+    ~file_writer()
+    {
+        stop_ = true;
+        thread_.join();
+    }
+
+    void run()
+    {
+        set_thread_name(L"[log]");
+
+        std::uint64_t total_dropped = 0;
+        while (true) {
+            const bool stop = stop_;
+
+            sink_->flush();
+
+            const auto dropped = sink_->take_dropped();
+            if (dropped > 0) {
+                total_dropped += dropped;
+                CASPAR_LOG(warning) << L"[log] Dropped " << dropped << L" records waiting to be written to file ("
+                                    << total_dropped << L" in total).";
+            }
+
+            if (stop) {
+                break;
+            }
+
+            // Bounds the wait, in case a notification is missed.
+            sink_->wait_for_records(std::chrono::milliseconds(100));
+        }
+    }
+};
+
+void add_file_sink(const std::wstring& file, int queue_size, const std::wstring& overflow)
+{
+    // Created after the logging core, so that it is destroyed, and the last records written, before the core is.
+    static std::unique_ptr<file_writer> writer;
 
     try {
         if (!boost::filesystem::is_directory(boost::filesystem::path(file).parent_path())) {
             CASPAR_THROW_EXCEPTION(directory_not_found());
         }
 
-        auto file_sink = boost::make_shared<file_sink_type>(
+        auto policy = overflow_policy::drop_oldest;
+        if (boost::iequals(overflow, L"block"))
+            policy = overflow_policy::block;
+        else if (boost::iequals(overflow, L"drop-debug"))
+            policy = overflow_policy::drop_debug;
+        else if (!boost::iequals(overflow, L"drop-oldest"))
+            std::wcerr << L"Invalid log overflow policy [" << overflow << L"], using drop-oldest." << std::endl;
+
+        auto file_backend = boost::make_shared<sinks::text_file_backend>(
             boost::log::keywords::file_name           = file + L"_%Y-%m-%d.log",
             boost::log::keywords::time_based_rotation = boost::log::sinks::file::rotation_at_time_point(0, 0, 0),
-            boost::log::keywords::auto_flush          = true,
+            boost::log::keywords::auto_flush          = false,
             boost::log::keywords::open_mode           = std::ios::app);
 
+        auto file_sink = boost::make_shared<file_sink_type>(file_backend, false);
+        file_sink->configure(std::max(queue_size, 1), policy);
         file_sink->set_formatter(boost::bind(&my_formatter<boost::log::formatting_ostream>, true, _1, _2));
 
+        writer.reset(new file_writer(file_sink));
+
         boost::log::core::get()->add_sink(file_sink);
     } catch (...) {
         std::wcerr << L"Failed to Setup File Logging Sink" << std::endl << std::endl;
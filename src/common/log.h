@@ -60,7 +60,10 @@ using caspar_logger = boost::log::sources::wseverity_logger<boost::log::trivial:
 BOOST_LOG_INLINE_GLOBAL_LOGGER_DEFAULT(logger, caspar_logger)
 #define CASPAR_LOG(lvl) BOOST_LOG_SEV(::caspar::log::logger::get(), boost::log::trivial::severity_level::lvl)
 
-void          add_file_sink(const std::wstring& file);
+// Records are written to file on a thread of their own. queue_size records may wait to be written, beyond that
+// overflow decides: block waits for space, drop-oldest and drop-debug drop records, the latter trace and debug
+// records first once the queue is three quarters full.
+void          add_file_sink(const std::wstring& file, int queue_size, const std::wstring& overflow);
 void          add_cout_sink();
 bool          set_log_level(const std::wstring& lvl);
 std::wstring& get_log_level();
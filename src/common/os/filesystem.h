@@ -27,6 +27,7 @@
 
 namespace caspar {
 
+// Below folders given to folder_cache::watch this is answered from cached listings.
 boost::optional<std::wstring> find_case_insensitive(const std::wstring& case_insensitive);
 
 std::wstring clean_path(std::wstring path);
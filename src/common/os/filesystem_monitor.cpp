@@ -0,0 +1,96 @@
+#include "../stdafx.h"
+
+#include "filesystem_monitor.h"
+
+#include "../log.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+namespace caspar {
+
+struct filesystem_monitor::watcher
+{
+    std::mutex             mutex;
+    std::map<int, handler> handlers;
+    int                    next_id = 0;
+    std::atomic<bool>      healthy{true};
+
+    // Last, so that the watcher thread is stopped before anything it uses is destroyed.
+    std::shared_ptr<impl> platform;
+
+    void notify(const std::wstring& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& p : handlers) {
+            try {
+                p.second(path);
+            } catch (...) {
+                CASPAR_LOG_CURRENT_EXCEPTION();
+            }
+        }
+    }
+};
+
+std::unique_ptr<filesystem_monitor> filesystem_monitor::create(const std::wstring& folder, handler on_change)
+{
+    static std::mutex                                      mutex;
+    static std::map<std::wstring, std::weak_ptr<watcher>> watchers;
+
+    auto path = boost::filesystem::absolute(folder).generic_wstring();
+    while (path.size() > 1 && path.back() == L'/') {
+        path.pop_back();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto w = watchers[path].lock();
+    if (!w || !w->healthy) {
+        try {
+            w           = std::make_shared<watcher>();
+            auto p      = w.get();
+            w->platform = open(
+                path, [p](const std::wstring& changed) { p->notify(changed); }, [p] { p->healthy = false; });
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+            watchers.erase(path);
+            return nullptr;
+        }
+        watchers[path] = w;
+    }
+
+    // Changes are reported below folder as it was given, which may be spelled differently from the watched path.
+    auto prefix = folder;
+    while (prefix.size() > 1 && (prefix.back() == L'/' || prefix.back() == L'\\')) {
+        prefix.pop_back();
+    }
+    auto translate = [prefix, size = path.size(), on_change = std::move(on_change)](const std::wstring& changed) {
+        on_change(prefix + changed.substr(std::min(size, changed.size())));
+    };
+
+    std::lock_guard<std::mutex> watcher_lock(w->mutex);
+    const auto                  id = w->next_id++;
+    w->handlers.emplace(id, std::move(translate));
+
+    return std::unique_ptr<filesystem_monitor>(new filesystem_monitor(std::move(w), id));
+}
+
+filesystem_monitor::filesystem_monitor(std::shared_ptr<watcher> watcher, int id)
+    : watcher_(std::move(watcher))
+    , id_(id)
+{
+}
+
+filesystem_monitor::~filesystem_monitor()
+{
+    std::lock_guard<std::mutex> lock(watcher_->mutex);
+    watcher_->handlers.erase(id_);
+}
+
+bool filesystem_monitor::healthy() const { return watcher_->healthy; }
+
+} // namespace caspar
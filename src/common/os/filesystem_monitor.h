@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace caspar {
+
+// Reports changes below a folder, on a thread of its own. The handler is given the path which changed. That may be a
+// folder, in which case anything below it may have changed. Monitors of the same folder share one watcher.
+class filesystem_monitor
+{
+  public:
+    using handler = std::function<void(const std::wstring& path)>;
+
+    // Returns nullptr if the folder can't be monitored, callers then have to rescan on their own.
+    static std::unique_ptr<filesystem_monitor> create(const std::wstring& folder, handler on_change);
+
+    // The handler is not called once this returns.
+    ~filesystem_monitor();
+
+    // False once changes may have been missed for good, e.g. because a folder below the root couldn't be watched or
+    // the watcher stopped. Callers then have to rescan on their own.
+    bool healthy() const;
+
+  private:
+    struct impl;
+    struct watcher;
+
+    // Starts watching folder, implemented per platform. Throws if the folder can't be watched at all.
+    static std::shared_ptr<impl> open(const std::wstring& folder, handler on_change, std::function<void()> on_failure);
+
+    filesystem_monitor(std::shared_ptr<watcher> watcher, int id);
+
+    std::shared_ptr<watcher> watcher_;
+    int                      id_;
+};
+
+} // namespace caspar
@@ -0,0 +1,252 @@
+#include "../stdafx.h"
+
+#include "folder_cache.h"
+
+#include "filesystem_monitor.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace caspar { namespace folder_cache {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct listing
+{
+    // Real names by lower case name, and by lower case name without extension.
+    std::multimap<std::wstring, std::wstring> names;
+    std::multimap<std::wstring, std::wstring> stems;
+};
+
+// Absolute, without redundant separators, "." or "..", so that paths can be compared as strings.
+fs::path normalize(const fs::path& path)
+{
+    fs::path result;
+    for (auto& part : fs::absolute(path)) {
+        if (part.empty() || part == L".") {
+            continue;
+        }
+        if (part == L"..") {
+            if (result.has_relative_path()) {
+                result = result.parent_path();
+            }
+            continue;
+        }
+        result /= part;
+    }
+    return result;
+}
+
+std::wstring key(const fs::path& path)
+{
+#ifdef _WIN32
+    return boost::to_lower_copy(path.generic_wstring());
+#else
+    return path.generic_wstring();
+#endif
+}
+
+bool is_below(const std::wstring& path, const std::wstring& folder)
+{
+    return boost::starts_with(path, folder) &&
+           (path.size() == folder.size() || folder.back() == L'/' || path[folder.size()] == L'/');
+}
+
+struct cache
+{
+    std::mutex                                             mutex;
+    std::map<std::wstring, std::shared_ptr<const listing>> listings;
+    std::uint64_t                                          generation = 0;
+
+    // Last, so that the monitors are stopped before anything their handlers use is destroyed.
+    std::vector<std::pair<fs::path, std::unique_ptr<filesystem_monitor>>> roots;
+
+    void invalidate(const fs::path& path)
+    {
+        const auto k = key(path);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        generation += 1;
+        listings.erase(key(path.parent_path()));
+        for (auto it = listings.lower_bound(k); it != listings.end() && is_below(it->first, k);) {
+            it = listings.erase(it);
+        }
+    }
+
+    fs::path root_of(const fs::path& path)
+    {
+        const auto k = key(path);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Roots whose monitor may have missed changes are no longer answered for.
+        fs::path result;
+        for (auto& root : roots) {
+            if (root.second->healthy() && is_below(k, key(root.first)) &&
+                root.first.native().size() > result.native().size()) {
+                result = root.first;
+            }
+        }
+        return result;
+    }
+
+    std::shared_ptr<const listing> get(const fs::path& folder)
+    {
+        const auto k = key(folder);
+
+        std::uint64_t listed_generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            const auto it = listings.find(k);
+            if (it != listings.end()) {
+                return it->second;
+            }
+            listed_generation = generation;
+        }
+
+        auto result = std::make_shared<listing>();
+
+        boost::system::error_code ec;
+        for (auto it = fs::directory_iterator(folder, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            const auto& path = it->path();
+            result->names.emplace(boost::to_lower_copy(path.filename().wstring()), path.filename().wstring());
+            result->stems.emplace(boost::to_lower_copy(path.stem().wstring()), path.filename().wstring());
+        }
+        if (ec) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Anything which changed while listing may be missing from the listing, so it is only used this once.
+        if (listed_generation == generation) {
+            listings.emplace(k, result);
+        }
+        return result;
+    }
+};
+
+boost::optional<std::wstring> find_name(const listing& folder, const std::wstring& name)
+{
+    const auto range = folder.names.equal_range(boost::to_lower_copy(name));
+    if (range.first == range.second) {
+        return boost::none;
+    }
+
+    // Prefer an exact match if several names differ only by case.
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == name) {
+            return it->second;
+        }
+    }
+    return range.first->second;
+}
+
+cache& instance()
+{
+    static cache instance;
+    return instance;
+}
+
+} // namespace
+
+void watch(const std::wstring& root)
+{
+    auto& c    = instance();
+    auto  path = normalize(root);
+
+    auto monitor =
+        filesystem_monitor::create(path.wstring(), [&c](const std::wstring& changed) { c.invalidate(changed); });
+    if (!monitor) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.roots.emplace_back(std::move(path), std::move(monitor));
+}
+
+bool covers(const std::wstring& path) { return !instance().root_of(normalize(path)).empty(); }
+
+boost::optional<std::wstring> find(const std::wstring& path)
+{
+    auto&      c    = instance();
+    const auto p    = normalize(path);
+    const auto root = c.root_of(p);
+
+    if (root.empty()) {
+        return boost::none;
+    }
+
+    auto part = p.begin();
+    std::advance(part, std::distance(root.begin(), root.end()));
+
+    auto result = root;
+    for (; part != p.end(); ++part) {
+        auto folder = c.get(result);
+        auto name   = folder ? find_name(*folder, part->wstring()) : boost::none;
+
+        if (!name) {
+            // The file may just have been written, before its change notification arrived, or on a network share
+            // which doesn't report changes made by other hosts. A miss is only trusted after listing the folder again.
+            c.invalidate(result / *part);
+            folder = c.get(result);
+            name   = folder ? find_name(*folder, part->wstring()) : boost::none;
+        }
+
+        if (!name) {
+            return boost::none;
+        }
+
+        result /= *name;
+    }
+
+    return result.wstring();
+}
+
+std::vector<std::wstring> find_stem(const std::wstring& stem)
+{
+    const auto p      = normalize(stem);
+    const auto parent = find(p.parent_path().wstring());
+
+    std::vector<std::wstring> result;
+    if (!parent) {
+        return result;
+    }
+
+    auto&      c      = instance();
+    auto       folder = c.get(*parent);
+    const auto lower  = boost::to_lower_copy(p.filename().wstring());
+
+    // As in find, a miss is only trusted after listing the folder again.
+    if (folder && folder->stems.find(lower) == folder->stems.end()) {
+        c.invalidate(fs::path(*parent) / p.filename());
+        folder = c.get(*parent);
+    }
+    if (!folder) {
+        return result;
+    }
+
+    const auto range = folder->stems.equal_range(lower);
+    for (auto it = range.first; it != range.second; ++it) {
+        result.push_back((fs::path(*parent) / it->second).wstring());
+    }
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+}} // namespace caspar::folder_cache
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <boost/optional.hpp>
+
+#include <string>
+#include <vector>
+
+namespace caspar { namespace folder_cache {
+
+// Keeps the listings of root and the folders below it in memory, keyed by lower case name and kept current through
+// filesystem_monitor. Lookups of existing files below root then don't walk folders. Names which aren't in a cached
+// listing are looked up in a fresh listing, since not every change is reported, e.g. on network shares. Does nothing
+// if root can't be monitored, and stops answering for root if its monitor may have missed changes.
+void watch(const std::wstring& root);
+
+// Whether path is below a watched root, i.e. whether find and find_stem can answer for it.
+bool covers(const std::wstring& path);
+
+// The real path of path, ignoring case.
+boost::optional<std::wstring> find(const std::wstring& path);
+
+// The real paths of the files next to stem whose name without extension matches the file name of stem, ignoring
+// case. Sorted by name.
+std::vector<std::wstring> find_stem(const std::wstring& stem);
+
+}} // namespace caspar::folder_cache
@@ -22,6 +22,7 @@
 #include "../../stdafx.h"
 
 #include "../filesystem.h"
+#include "../folder_cache.h"
 
 #include <list>
 
@@ -34,6 +35,9 @@ namespace caspar {
 
 boost::optional<std::wstring> find_case_insensitive(const std::wstring& case_insensitive)
 {
+    if (folder_cache::covers(case_insensitive))
+        return folder_cache::find(case_insensitive);
+
     path p(case_insensitive);
 
     if (exists(p))
@@ -0,0 +1,195 @@
+#include "../filesystem_monitor.h"
+
+#include "../../except.h"
+#include "../../log.h"
+#include "../../utf.h"
+#include "../thread.h"
+
+#include <boost/filesystem.hpp>
+
+#include <map>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace caspar {
+
+struct filesystem_monitor::impl
+{
+    const boost::filesystem::path root_;
+    const handler                 on_change_;
+    const std::function<void()>   on_failure_;
+
+    int                                    fd_   = -1;
+    int                                    stop_ = -1;
+    std::map<int, boost::filesystem::path> watches_;
+    std::thread                            thread_;
+
+    impl(const std::wstring& folder, handler on_change, std::function<void()> on_failure)
+        : root_(folder)
+        , on_change_(std::move(on_change))
+        , on_failure_(std::move(on_failure))
+    {
+        fd_   = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        stop_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd_ < 0 || stop_ < 0) {
+            close();
+            CASPAR_THROW_EXCEPTION(operation_failed() << msg_info("inotify_init1 failed"));
+        }
+
+        if (!watch(root_)) {
+            close();
+            CASPAR_THROW_EXCEPTION(operation_failed() << msg_info(L"Failed to watch " + root_.wstring()));
+        }
+
+        thread_ = std::thread([this] {
+            set_thread_name(L"[filesystem_monitor]");
+            run();
+        });
+    }
+
+    ~impl()
+    {
+        uint64_t value = 1;
+        if (::write(stop_, &value, sizeof(value)) != sizeof(value)) {
+            CASPAR_LOG(error) << L"[filesystem_monitor] Failed to stop.";
+        }
+        thread_.join();
+        close();
+    }
+
+    void close()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (stop_ >= 0) {
+            ::close(stop_);
+        }
+    }
+
+    // inotify isn't recursive, every folder below the root needs a watch of its own. Returns false if folder itself
+    // couldn't be watched. Folders below it which can't be watched mark the monitor as failed.
+    bool watch(const boost::filesystem::path& folder)
+    {
+        if (!add_watch(folder)) {
+            return false;
+        }
+
+        boost::system::error_code ec;
+        for (auto it = boost::filesystem::recursive_directory_iterator(folder, ec);
+             !ec && it != boost::filesystem::recursive_directory_iterator();
+             it.increment(ec)) {
+            if (boost::filesystem::is_directory(it->status()) && !add_watch(it->path())) {
+                on_failure_();
+            }
+        }
+        return true;
+    }
+
+    bool add_watch(const boost::filesystem::path& folder)
+    {
+        const auto mask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                          IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+        const auto wd = inotify_add_watch(fd_, folder.c_str(), mask);
+        if (wd < 0) {
+            CASPAR_LOG(warning) << L"[filesystem_monitor] Failed to watch " << folder.wstring()
+                                << L". Raise fs.inotify.max_user_watches for large folders.";
+            return false;
+        }
+        watches_[wd] = folder;
+        return true;
+    }
+
+    void notify(const boost::filesystem::path& path)
+    {
+        try {
+            on_change_(path.wstring());
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+        }
+    }
+
+    void run()
+    {
+        try {
+            read_events();
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+            on_failure_();
+        }
+    }
+
+    void read_events()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+
+        while (true) {
+            pollfd fds[2] = {{fd_, POLLIN, 0}, {stop_, POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                CASPAR_LOG(error) << L"[filesystem_monitor] poll failed.";
+                on_failure_();
+                return;
+            }
+
+            if (fds[1].revents) {
+                return;
+            }
+
+            while (true) {
+                const auto len = ::read(fd_, buffer, sizeof(buffer));
+                if (len <= 0) {
+                    break;
+                }
+
+                for (auto ptr = buffer; ptr < buffer + len;) {
+                    const auto event = reinterpret_cast<const inotify_event*>(ptr);
+                    ptr += sizeof(inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        notify(root_);
+                        continue;
+                    }
+
+                    const auto it = watches_.find(event->wd);
+                    if (it == watches_.end()) {
+                        continue;
+                    }
+
+                    if (event->mask & IN_IGNORED) {
+                        // The root is gone, e.g. unmounted, and nothing below it is reported any more.
+                        if (it->second == root_) {
+                            CASPAR_LOG(warning) << L"[filesystem_monitor] Lost the watch of " << root_.wstring();
+                            on_failure_();
+                        }
+                        watches_.erase(it);
+                        continue;
+                    }
+
+                    const auto path = event->len > 0 ? it->second / event->name : it->second;
+
+                    if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && !watch(path)) {
+                        on_failure_();
+                    }
+
+                    notify(path);
+                }
+            }
+        }
+    }
+};
+
+std::shared_ptr<filesystem_monitor::impl>
+filesystem_monitor::open(const std::wstring& folder, handler on_change, std::function<void()> on_failure)
+{
+    return std::make_shared<impl>(folder, std::move(on_change), std::move(on_failure));
+}
+
+} // namespace caspar
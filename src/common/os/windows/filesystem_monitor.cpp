@@ -0,0 +1,149 @@
+#include "../filesystem_monitor.h"
+
+#include "../../except.h"
+#include "../../log.h"
+#include "../thread.h"
+
+#include <boost/filesystem.hpp>
+
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+namespace caspar {
+
+struct filesystem_monitor::impl
+{
+    const boost::filesystem::path root_;
+    const handler                 on_change_;
+    const std::function<void()>   on_failure_;
+
+    HANDLE      dir_   = INVALID_HANDLE_VALUE;
+    HANDLE      stop_  = nullptr;
+    HANDLE      event_ = nullptr;
+    std::thread thread_;
+
+    impl(const std::wstring& folder, handler on_change, std::function<void()> on_failure)
+        : root_(folder)
+        , on_change_(std::move(on_change))
+        , on_failure_(std::move(on_failure))
+    {
+        dir_   = CreateFileW(folder.c_str(),
+                           FILE_LIST_DIRECTORY,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                           nullptr);
+        stop_  = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        event_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (dir_ == INVALID_HANDLE_VALUE || !stop_ || !event_) {
+            close();
+            CASPAR_THROW_EXCEPTION(operation_failed() << msg_info(L"Failed to open " + folder));
+        }
+
+        thread_ = std::thread([this] {
+            set_thread_name(L"[filesystem_monitor]");
+            run();
+        });
+    }
+
+    ~impl()
+    {
+        SetEvent(stop_);
+        thread_.join();
+        close();
+    }
+
+    void close()
+    {
+        if (dir_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(dir_);
+        }
+        if (stop_) {
+            CloseHandle(stop_);
+        }
+        if (event_) {
+            CloseHandle(event_);
+        }
+    }
+
+    void notify(const boost::filesystem::path& path)
+    {
+        try {
+            on_change_(path.wstring());
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+        }
+    }
+
+    void run()
+    {
+        // DWORD aligned, as required by ReadDirectoryChangesW.
+        std::vector<DWORD> buffer(16 * 1024);
+
+        const auto filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE |
+                            FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+        while (true) {
+            OVERLAPPED overlapped = {};
+            overlapped.hEvent     = event_;
+            ResetEvent(event_);
+
+            if (!ReadDirectoryChangesW(dir_,
+                                       buffer.data(),
+                                       static_cast<DWORD>(buffer.size() * sizeof(DWORD)),
+                                       TRUE,
+                                       filter,
+                                       nullptr,
+                                       &overlapped,
+                                       nullptr)) {
+                CASPAR_LOG(error) << L"[filesystem_monitor] ReadDirectoryChangesW failed for " << root_.wstring();
+                on_failure_();
+                return;
+            }
+
+            HANDLE     handles[] = {stop_, event_};
+            const auto result    = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+
+            DWORD size = 0;
+            if (result != WAIT_OBJECT_0 + 1) {
+                CancelIo(dir_);
+                GetOverlappedResult(dir_, &overlapped, &size, TRUE);
+                return;
+            }
+
+            if (!GetOverlappedResult(dir_, &overlapped, &size, FALSE)) {
+                CASPAR_LOG(error) << L"[filesystem_monitor] Failed to read changes for " << root_.wstring();
+                on_failure_();
+                return;
+            }
+
+            // The buffer overflowed, anything may have changed.
+            if (size == 0) {
+                notify(root_);
+                continue;
+            }
+
+            auto ptr = reinterpret_cast<const char*>(buffer.data());
+            while (true) {
+                const auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(ptr);
+                notify(root_ / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+
+                if (info->NextEntryOffset == 0) {
+                    break;
+                }
+                ptr += info->NextEntryOffset;
+            }
+        }
+    }
+};
+
+std::shared_ptr<filesystem_monitor::impl>
+filesystem_monitor::open(const std::wstring& folder, handler on_change, std::function<void()> on_failure)
+{
+    return std::make_shared<impl>(folder, std::move(on_change), std::move(on_failure));
+}
+
+} // namespace caspar
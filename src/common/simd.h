@@ -0,0 +1,37 @@
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Functions using AVX2 intrinsics must be tagged with CASPAR_AVX2 and only be
+// called after checking has_avx2(), the rest of the code is built for SSE4.1.
+#ifdef _MSC_VER
+#define CASPAR_AVX2
+#else
+#define CASPAR_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace caspar {
+
+inline bool has_avx2()
+{
+    static const bool result = [] {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return result;
+}
+
+} // namespace caspar
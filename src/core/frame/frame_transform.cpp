@@ -237,6 +237,9 @@ bool operator!=(const image_transform& lhs, const image_transform& rhs) { return
 
 audio_transform& audio_transform::operator*=(const audio_transform& other)
 {
+    if (previous_volume || other.previous_volume) {
+        previous_volume = previous_volume.value_or(volume) * other.previous_volume.value_or(other.volume);
+    }
     volume *= other.volume;
     return *this;
 }
@@ -313,13 +316,37 @@ const frame_transform& tweened_transform::dest() const { return dest_; }
 
 frame_transform tweened_transform::fetch()
 {
-    return time_ == duration_
-               ? dest_
-               : frame_transform::tween(
-                     static_cast<double>(time_), source_, dest_, static_cast<double>(duration_), tweener_);
+    auto result = time_ == duration_
+                      ? dest_
+                      : frame_transform::tween(
+                            static_cast<double>(time_), source_, dest_, static_cast<double>(duration_), tweener_);
+
+    // Ramp audio from where the previous frame ended, source_ is what was fetched before this tween started. Once the
+    // tween is over the volume is constant again.
+    if (ramp_from_) {
+        auto previous = *ramp_from_ == 0 ? source_.audio_transform
+                                         : audio_transform::tween(static_cast<double>(*ramp_from_),
+                                                                  source_.audio_transform,
+                                                                  dest_.audio_transform,
+                                                                  static_cast<double>(duration_),
+                                                                  tweener_);
+        if (!eq(previous.volume, result.audio_transform.volume)) {
+            result.audio_transform.previous_volume = previous.volume;
+        }
+    }
+
+    return result;
 }
 
-void tweened_transform::tick(int num) { time_ = std::min(time_ + num, duration_); }
+void tweened_transform::tick(int num)
+{
+    const auto previous = time_;
+    time_               = std::min(time_ + num, duration_);
+
+    // The first frame after the transform was applied ramps as well, so that a cut does.
+    ramp_from_ = time_ != previous || !ticked_ ? boost::optional<int>(previous) : boost::none;
+    ticked_    = true;
+}
 
 boost::optional<chroma::legacy_type> get_chroma_mode(const std::wstring& str)
 {
@@ -115,6 +115,9 @@ struct audio_transform final
 {
     double volume = 1.0;
 
+    // Volume at the start of the frame, the mixer ramps linearly from it to volume across the frame's samples.
+    boost::optional<double> previous_volume;
+
     audio_transform& operator*=(const audio_transform& other);
     audio_transform  operator*(const audio_transform& other) const;
 
@@ -157,6 +160,10 @@ class tweened_transform
     int             time_     = 0;
     tweener         tweener_;
 
+    // The time of the previous frame, if the last tick advanced the tween.
+    boost::optional<int> ramp_from_;
+    bool                 ticked_ = false;
+
   public:
     tweened_transform() = default;
 
@@ -28,11 +28,16 @@
 #include <core/monitor/monitor.h>
 
 #include <common/diagnostics/graph.h>
+#include <common/simd.h>
 
 #include <boost/container/flat_map.hpp>
 #include <boost/range/algorithm.hpp>
 
+#include <tbb/concurrent_queue.h>
+
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <stack>
 #include <vector>
 
@@ -46,15 +51,180 @@ struct audio_item
     array<const int32_t> samples;
 };
 
-using audio_buffer_ps = std::vector<double>;
+namespace {
+
+// 2^31, the smallest float which does not fit in an int32_t.
+const float sample_limit = 2147483648.0f;
+
+// dest = source * volume (+ dest), where volume ramps linearly from begin to end across the samples. The ramp is per
+// sample rather than per sample frame, which keeps it a single multiply-add away from the flat case.
+
+void accumulate_scalar(float*         dest,
+                       const int32_t* source,
+                       float          begin,
+                       float          step,
+                       std::size_t    offset,
+                       std::size_t    count,
+                       bool           overwrite)
+{
+    for (std::size_t n = 0; n < count; ++n) {
+        auto volume = begin + step * static_cast<float>(offset + n);
+        dest[n]     = static_cast<float>(source[n]) * volume + (overwrite ? 0.0f : dest[n]);
+    }
+}
+
+std::size_t
+accumulate_sse2(float* dest, const int32_t* source, float begin, float step, std::size_t count, bool overwrite)
+{
+    const auto b = _mm_set1_ps(begin);
+    const auto s = _mm_set1_ps(step);
+
+    auto index = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    std::size_t n = 0;
+    for (; n + 4 <= count; n += 4) {
+        auto v = step == 0.0f ? b : _mm_add_ps(b, _mm_mul_ps(index, s));
+        auto x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + n))), v);
+        if (!overwrite) {
+            x = _mm_add_ps(x, _mm_loadu_ps(dest + n));
+        }
+        _mm_storeu_ps(dest + n, x);
+        index = _mm_add_ps(index, _mm_set1_ps(4.0f));
+    }
+    return n;
+}
+
+CASPAR_AVX2 std::size_t
+accumulate_avx2(float* dest, const int32_t* source, float begin, float step, std::size_t count, bool overwrite)
+{
+    const auto b = _mm256_set1_ps(begin);
+    const auto s = _mm256_set1_ps(step);
+
+    auto index = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    std::size_t n = 0;
+    for (; n + 8 <= count; n += 8) {
+        auto v = step == 0.0f ? b : _mm256_add_ps(b, _mm256_mul_ps(index, s));
+        auto x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + n))), v);
+        if (!overwrite) {
+            x = _mm256_add_ps(x, _mm256_loadu_ps(dest + n));
+        }
+        _mm256_storeu_ps(dest + n, x);
+        index = _mm256_add_ps(index, _mm256_set1_ps(8.0f));
+    }
+    return n;
+}
+
+void accumulate(float* dest, const int32_t* source, float begin, float step, std::size_t count, bool overwrite)
+{
+    std::size_t n = 0;
+    if (has_avx2()) {
+        n += accumulate_avx2(dest, source, begin, step, count, overwrite);
+    }
+    n += accumulate_sse2(dest + n, source + n, begin + step * n, step, count - n, overwrite);
+    accumulate_scalar(dest + n, source + n, begin, step, n, count - n, overwrite);
+}
+
+// Scales interleaved samples by volume, clamps them to int32_t into dest (if not null) and tracks the absolute peak
+// of every channel, all in a single pass. Channels are vectorized within each sample frame.
+
+inline __m128 load_ps(const float* source) { return _mm_loadu_ps(source); }
+inline __m128 load_ps(const int32_t* source)
+{
+    return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+}
+CASPAR_AVX2 inline __m256 load256_ps(const float* source) { return _mm256_loadu_ps(source); }
+CASPAR_AVX2 inline __m256 load256_ps(const int32_t* source)
+{
+    return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)));
+}
+
+template <typename T>
+void finalize_scalar(int32_t* dest, const T* source, float volume, float* peaks, int channels, int begin)
+{
+    for (int ch = begin; ch < channels; ++ch) {
+        auto x    = static_cast<float>(source[ch]) * volume;
+        peaks[ch] = std::max(peaks[ch], std::abs(x));
+        if (dest) {
+            dest[ch] = x >= sample_limit    ? std::numeric_limits<int32_t>::max()
+                       : x <= -sample_limit ? std::numeric_limits<int32_t>::min()
+                                            : static_cast<int32_t>(x);
+        }
+    }
+}
+
+template <typename T>
+int finalize_sse2(int32_t* dest, const T* source, float volume, float* peaks, int channels)
+{
+    const auto v     = _mm_set1_ps(volume);
+    const auto sign  = _mm_set1_ps(-0.0f);
+    const auto upper = _mm_set1_ps(sample_limit);
+    const auto lower = _mm_set1_ps(-sample_limit);
+
+    int ch = 0;
+    for (; ch + 4 <= channels; ch += 4) {
+        auto x = _mm_mul_ps(load_ps(source + ch), v);
+        _mm_storeu_ps(peaks + ch, _mm_max_ps(_mm_loadu_ps(peaks + ch), _mm_andnot_ps(sign, x)));
+        if (dest) {
+            // Values >= 2^31 convert to 0x80000000, flipping all bits turns them into INT32_MAX.
+            auto over = _mm_castps_si128(_mm_cmpge_ps(x, upper));
+            auto i    = _mm_xor_si128(_mm_cvttps_epi32(_mm_max_ps(x, lower)), over);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + ch), i);
+        }
+    }
+    return ch;
+}
+
+template <typename T>
+CASPAR_AVX2 int finalize_avx2(int32_t* dest, const T* source, float volume, float* peaks, int channels)
+{
+    const auto v     = _mm256_set1_ps(volume);
+    const auto sign  = _mm256_set1_ps(-0.0f);
+    const auto upper = _mm256_set1_ps(sample_limit);
+    const auto lower = _mm256_set1_ps(-sample_limit);
+
+    int ch = 0;
+    for (; ch + 8 <= channels; ch += 8) {
+        auto x = _mm256_mul_ps(load256_ps(source + ch), v);
+        _mm256_storeu_ps(peaks + ch, _mm256_max_ps(_mm256_loadu_ps(peaks + ch), _mm256_andnot_ps(sign, x)));
+        if (dest) {
+            auto over = _mm256_castps_si256(_mm256_cmp_ps(x, upper, _CMP_GE_OQ));
+            auto i    = _mm256_xor_si256(_mm256_cvttps_epi32(_mm256_max_ps(x, lower)), over);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + ch), i);
+        }
+    }
+    return ch;
+}
+
+template <typename T>
+void finalize(int32_t* dest, const T* source, float volume, float* peaks, int channels, std::size_t frames)
+{
+    const auto avx2 = has_avx2() && channels >= 8;
+
+    for (std::size_t n = 0; n < frames; ++n, source += channels, dest = dest ? dest + channels : nullptr) {
+        int ch = 0;
+        if (avx2) {
+            ch += finalize_avx2(dest, source, volume, peaks, channels);
+        }
+        ch += finalize_sse2(dest ? dest + ch : nullptr, source + ch, volume, peaks + ch, channels - ch);
+        finalize_scalar(dest, source, volume, peaks, channels, ch);
+    }
+}
+
+} // namespace
 
 struct audio_mixer::impl
 {
+    using buffer_pool = tbb::concurrent_bounded_queue<std::shared_ptr<std::vector<int32_t>>>;
+
     monitor::state                      state_;
     std::stack<core::audio_transform>   transform_stack_;
     std::vector<audio_item>             items_;
     std::atomic<float>                  master_volume_{1.0f};
     spl::shared_ptr<diagnostics::graph> graph_;
+    std::vector<float>                  mixed_;
+    std::vector<float>                  peaks_;
+    std::shared_ptr<buffer_pool>        pool_ = std::make_shared<buffer_pool>();
 
     impl(const impl&) = delete;
     impl& operator=(const impl&) = delete;
@@ -65,6 +235,7 @@ struct audio_mixer::impl
         graph_->set_color("volume", diagnostics::color(1.0f, 0.8f, 0.1f));
         graph_->set_color("audio-clipping", diagnostics::color(0.3f, 0.6f, 0.3f));
         transform_stack_.push(core::audio_transform());
+        pool_->set_capacity(8);
     }
 
     void push(const frame_transform& transform)
@@ -74,7 +245,8 @@ struct audio_mixer::impl
 
     void visit(const const_frame& frame)
     {
-        if (transform_stack_.top().volume < 0.002 || !frame.audio_data())
+        const auto& transform = transform_stack_.top();
+        if ((transform.volume < 0.002 && transform.previous_volume.value_or(0.0) < 0.002) || !frame.audio_data())
             return;
 
         audio_item item;
@@ -90,56 +262,93 @@ struct audio_mixer::impl
 
     float get_master_volume() { return master_volume_; }
 
-    array<const int32_t> mix(const video_format_desc& format_desc, int nb_samples)
+    // Result buffers are returned to the pool once every consumer has released the frame.
+    std::shared_ptr<std::vector<int32_t>> create_buffer(std::size_t size)
     {
-        auto channels = format_desc.audio_channels;
-        auto items    = std::move(items_);
-        auto result   = std::vector<int32_t>(nb_samples * channels, 0);
-
-        auto mixed = std::vector<double>(nb_samples * channels, 0.0f);
-
-        for (auto& item : items) {
-            auto ptr  = item.samples.data();
-            auto size = result.size();
-            for (auto n = 0; n < size; ++n) {
-                if (n < item.samples.size()) {
-                    mixed[n] = static_cast<double>(ptr[n]) * item.transform.volume + mixed[n];
-                } else {
-                    auto offset = (item.samples.size()) - (channels - (n % channels));
-                    mixed[n]    = static_cast<double>(ptr[offset]) * item.transform.volume + mixed[n];
-                }
-            }
+        std::shared_ptr<std::vector<int32_t>> buffer;
+        if (!pool_->try_pop(buffer)) {
+            buffer = std::make_shared<std::vector<int32_t>>();
         }
+        buffer->resize(size);
 
+        std::weak_ptr<buffer_pool> weak_pool = pool_;
+        return std::shared_ptr<std::vector<int32_t>>(buffer.get(), [buffer, weak_pool](std::vector<int32_t>*) {
+            auto pool = weak_pool.lock();
+            if (pool) {
+                pool->try_push(buffer);
+            }
+        });
+    }
+
+    array<const int32_t> mix(const video_format_desc& format_desc, int nb_samples)
+    {
+        auto channels      = format_desc.audio_channels;
+        auto items         = std::move(items_);
+        auto size          = static_cast<std::size_t>(nb_samples) * channels;
         auto master_volume = master_volume_.load();
-        for (auto n = 0; n < mixed.size(); ++n) {
-            auto sample = mixed[n] * master_volume;
-            if (sample > std::numeric_limits<int32_t>::max()) {
-                result[n] = std::numeric_limits<int32_t>::max();
-            } else if (sample < std::numeric_limits<int32_t>::min()) {
-                result[n] = std::numeric_limits<int32_t>::min();
-            } else {
-                result[n] = static_cast<int32_t>(sample);
+
+        items_.clear();
+        peaks_.assign(channels, 0.0f);
+
+        array<const int32_t> result;
+
+        if (items.size() == 1 && items[0].transform.volume == 1.0 && !items[0].transform.previous_volume &&
+            master_volume == 1.0f && items[0].samples.size() >= size) {
+            // Fast path, pass the samples through untouched and only scan them for peaks.
+            auto& samples = items[0].samples;
+            finalize<int32_t>(nullptr, samples.data(), 1.0f, peaks_.data(), channels, nb_samples);
+            result = array<const int32_t>(samples.data(), size, samples);
+        } else {
+            mixed_.resize(size);
+
+            if (items.empty()) {
+                std::fill(mixed_.begin(), mixed_.end(), 0.0f);
             }
-        }
 
-        auto max = std::vector<int32_t>(channels, std::numeric_limits<int32_t>::min());
-        for (size_t n = 0; n < result.size(); n += channels) {
-            for (int ch = 0; ch < channels; ++ch) {
-                max[ch] = std::max(max[ch], std::abs(result[n + ch]));
+            for (std::size_t i = 0; i < items.size(); ++i) {
+                auto  ptr       = items[i].samples.data();
+                auto  count     = std::min(size, items[i].samples.size());
+                auto  volume    = static_cast<float>(items[i].transform.volume);
+                auto  begin     = static_cast<float>(items[i].transform.previous_volume.value_or(volume));
+                auto  step      = (volume - begin) / static_cast<float>(size);
+                auto  overwrite = i == 0;
+                auto* dest      = mixed_.data();
+
+                accumulate(dest, ptr, begin, step, count, overwrite);
+
+                // Pad short items by repeating their last sample frame.
+                for (auto n = count; n < size; ++n) {
+                    auto sample = count >= static_cast<std::size_t>(channels)
+                                      ? static_cast<float>(ptr[count - channels + n % channels]) *
+                                            (begin + step * static_cast<float>(n))
+                                      : 0.0f;
+                    dest[n]     = sample + (overwrite ? 0.0f : dest[n]);
+                }
             }
+
+            auto buffer = create_buffer(size);
+            finalize<float>(buffer->data(), mixed_.data(), master_volume, peaks_.data(), channels, nb_samples);
+            result = array<const int32_t>(buffer->data(), size, std::move(buffer));
         }
 
-        if (boost::range::count_if(max, [](auto val) { return val >= std::numeric_limits<int32_t>::max(); }) > 0) {
-            graph_->set_tag(diagnostics::tag_severity::WARNING, "audio-clipping");
+        auto max = std::vector<int32_t>(channels);
+        for (int ch = 0; ch < channels; ++ch) {
+            max[ch] = static_cast<int32_t>(
+                std::min(static_cast<double>(peaks_[ch]), static_cast<double>(std::numeric_limits<int32_t>::max())));
         }
 
-        state_["volume"] = std::move(max);
+        if (boost::range::count_if(peaks_, [](auto val) { return val >= sample_limit; }) > 0) {
+            graph_->set_tag(diagnostics::tag_severity::WARNING, "audio-clipping");
+        }
 
         graph_->set_value("volume",
-                          static_cast<double>(*boost::max_element(max)) / std::numeric_limits<int32_t>::max());
+                          max.empty() ? 0.0
+                                      : static_cast<double>(*boost::max_element(max)) /
+                                            std::numeric_limits<int32_t>::max());
+
+        state_["volume"] = std::move(max);
 
-        return std::move(result);
+        return result;
     }
 };
 
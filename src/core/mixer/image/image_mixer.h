@@ -21,6 +21,9 @@
 
 #pragma once
 
+#include <common/forward.h>
+#include <common/memory.h>
+
 #include <core/frame/frame.h>
 #include <core/frame/frame_factory.h>
 #include <core/frame/frame_visitor.h>
@@ -28,6 +31,8 @@
 #include <cstdint>
 #include <future>
 
+FORWARD2(caspar, diagnostics, class graph);
+
 namespace caspar { namespace core {
 
 class image_mixer
@@ -47,6 +52,9 @@ class image_mixer
 
     virtual std::future<array<const uint8_t>> operator()(const struct video_format_desc& format_desc) = 0;
 
+    // Lets the backend report its own timings on the channel graph.
+    virtual void set_graph(const spl::shared_ptr<caspar::diagnostics::graph>& graph) {}
+
     class mutable_frame create_frame(const void* tag, const struct pixel_format_desc& desc) override = 0;
 
 #ifdef WIN32
@@ -57,6 +57,7 @@ struct mixer::impl
         , graph_(std::move(graph))
         , image_mixer_(std::move(image_mixer))
     {
+        image_mixer_->set_graph(graph_);
     }
 
     const_frame operator()(std::vector<draw_frame> frames, const video_format_desc& format_desc, int nb_samples)
@@ -0,0 +1,280 @@
+#include "../StdAfx.h"
+
+#include "monitor.h"
+
+#include <common/scope_exit.h>
+
+#include <tbb/concurrent_queue.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace caspar { namespace core { namespace monitor {
+
+namespace {
+
+// Entries per thread local cache, enough for every path of a few busy channels.
+const std::size_t max_cached = 1 << 16;
+
+// Returns the entry for str with a reference added. Entries are only removed here, under the lock, so a count can
+// only go from zero to one through this function.
+key::entry* intern(const std::string& str)
+{
+    static std::mutex mutex;
+    // Never destroyed, keys with static storage duration may outlive it.
+    static auto strings  = new std::unordered_map<std::string, std::atomic<int>>();
+    static auto prune_at = std::size_t(1024);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Strings which are no longer referred to by any key are dropped whenever the table has doubled.
+    if (strings->size() >= prune_at) {
+        for (auto it = strings->begin(); it != strings->end();) {
+            it = it->second.load(std::memory_order_acquire) == 0 ? strings->erase(it) : std::next(it);
+        }
+        prune_at = std::max<std::size_t>(1024, strings->size() * 2);
+    }
+
+    auto& entry = *strings->emplace(std::piecewise_construct, std::forward_as_tuple(str), std::forward_as_tuple(0))
+                       .first;
+    entry.second.fetch_add(1, std::memory_order_relaxed);
+    return &entry;
+}
+
+const key& empty_key()
+{
+    static const key empty(std::string{});
+    return empty;
+}
+
+template <typename Cache>
+void bound(Cache& cache)
+{
+    if (cache.size() >= max_cached) {
+        cache.clear();
+    }
+}
+
+using key_ptr_pair = std::pair<const std::string*, const std::string*>;
+
+struct key_ptr_pair_hash
+{
+    std::size_t operator()(const key_ptr_pair& p) const
+    {
+        return std::hash<const std::string*>()(p.first) * 31 + std::hash<const std::string*>()(p.second);
+    }
+};
+
+// Holds on to the parts so that their addresses can't be reused while the entry exists.
+struct joined
+{
+    key parent;
+    key child;
+    key path;
+};
+
+// The join cache is not cleared while a for_each on this thread holds references into it.
+thread_local int iterating = 0;
+
+const key& cached_join(const key& parent, const key& child)
+{
+    thread_local std::unordered_map<key_ptr_pair, joined, key_ptr_pair_hash> cache;
+
+    const auto ptrs = key_ptr_pair(&parent.str(), &child.str());
+
+    auto it = cache.find(ptrs);
+    if (it == cache.end()) {
+        if (iterating == 0) {
+            bound(cache);
+        }
+        it = cache.emplace(ptrs, joined{parent, child, key(parent.str() + "/" + child.str())}).first;
+    }
+    return it->second.path;
+}
+
+} // namespace
+
+key::key()
+    : key(empty_key())
+{
+}
+
+key::key(const std::string& str)
+    : entry_(intern(str))
+{
+}
+
+key segment(const std::string& str)
+{
+    thread_local std::unordered_map<std::string, key> cache;
+
+    auto it = cache.find(str);
+    if (it == cache.end()) {
+        bound(cache);
+        it = cache.emplace(str, key(str)).first;
+    }
+    return it->second;
+}
+
+key segment(const char* str) { return segment(std::string(str)); }
+
+key segment(std::int64_t value)
+{
+    thread_local std::unordered_map<std::int64_t, key> cache;
+
+    auto it = cache.find(value);
+    if (it == cache.end()) {
+        bound(cache);
+        it = cache.emplace(value, key(std::to_string(value))).first;
+    }
+    return it->second;
+}
+
+key join(const key& parent, const key& child) { return cached_join(parent, child); }
+
+// state
+
+struct state::node
+{
+    data_map_t                          data;
+    std::vector<std::pair<key, state>> children;
+
+    void clear()
+    {
+        data.clear();
+        children.clear();
+    }
+};
+
+state::node& state::mutable_node()
+{
+    static auto pool = [] {
+        auto pool = std::make_shared<tbb::concurrent_bounded_queue<node*>>();
+        pool->set_capacity(4096);
+        return pool;
+    }();
+
+    if (node_ && node_.use_count() == 1) {
+        return *node_;
+    }
+
+    node* ptr = nullptr;
+    if (!pool->try_pop(ptr)) {
+        ptr = new node();
+    }
+
+    // Nodes are cleared but keep their capacity when they are returned to the pool.
+    std::weak_ptr<tbb::concurrent_bounded_queue<node*>> weak_pool = pool;
+    std::shared_ptr<node> result(ptr, [weak_pool](node* ptr) {
+        ptr->clear();
+        auto pool = weak_pool.lock();
+        if (!pool || !pool->try_push(ptr)) {
+            delete ptr;
+        }
+    });
+
+    if (node_) {
+        result->data     = node_->data;
+        result->children = node_->children;
+    }
+
+    node_ = std::move(result);
+    return *node_;
+}
+
+void state::set(const key& path, vector_t data) { mutable_node().data[path] = std::move(data); }
+
+void state::attach(const key& path, const state& other)
+{
+    auto& children = mutable_node().children;
+
+    auto it = std::find_if(children.begin(), children.end(), [&](const auto& p) { return p.first == path; });
+    if (it != children.end()) {
+        it->second = other;
+    } else {
+        children.emplace_back(path, other);
+    }
+}
+
+void state::for_each(const func_t& func) const
+{
+    if (!node_) {
+        return;
+    }
+
+    const auto& data = node_->data;
+
+    ++iterating;
+    CASPAR_SCOPE_EXIT { --iterating; };
+
+    for (const auto& p : data) {
+        func(p.first, p.second);
+    }
+
+    for (const auto& child : node_->children) {
+        const auto& prefix = child.first;
+        child.second.for_each([&](const key& path, const vector_t& value) {
+            const auto& full_path = cached_join(prefix, path);
+            if (data.empty() || data.find(full_path) == data.end()) {
+                func(full_path, value);
+            }
+        });
+    }
+}
+
+bool state::empty() const
+{
+    if (!node_) {
+        return true;
+    }
+    return node_->data.empty() && std::all_of(node_->children.begin(), node_->children.end(), [](const auto& p) {
+               return p.second.empty();
+           });
+}
+
+// state_tracker
+
+state_tracker::state_tracker(clock_t::duration refresh_interval)
+    : refresh_interval_(refresh_interval)
+    , last_prune_(clock_t::now())
+{
+}
+
+void state_tracker::update(const state& state, const func_t& func)
+{
+    auto now = clock_t::now();
+
+    state.for_each([&](const key& path, const vector_t& data) {
+        auto it = entries_.find(path);
+
+        if (it == entries_.end()) {
+            it = entries_.emplace(path, entry{data, now}).first;
+        } else if (it->second.data != data || now - it->second.reported >= refresh_interval_) {
+            it->second.data     = data;
+            it->second.reported = now;
+        } else {
+            return;
+        }
+
+        func(it->first, it->second.data);
+    });
+
+    // Paths which have disappeared are only forgotten once they have missed a couple of refreshes, if they
+    // reappear they are simply reported as new.
+    if (now - last_prune_ >= refresh_interval_ * 2) {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            it = now - it->second.reported >= refresh_interval_ * 2 ? entries_.erase(it) : std::next(it);
+        }
+        last_prune_ = now;
+    }
+}
+
+void state_tracker::reset() { entries_.clear(); }
+
+void state_tracker::refresh_interval(clock_t::duration interval) { refresh_interval_ = interval; }
+
+state_tracker::clock_t::duration state_tracker::refresh_interval() const { return refresh_interval_; }
+
+}}} // namespace caspar::core::monitor
@@ -23,8 +23,14 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/variant.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/container/flat_map.hpp>
@@ -32,91 +38,198 @@
 
 namespace caspar { namespace core { namespace monitor {
 
-using data_t     = boost::variant<bool, std::int32_t, std::int64_t, float, double, std::string, std::wstring>;
-using vector_t   = boost::container::small_vector<data_t, 2>;
-using data_map_t = boost::container::flat_map<std::string, vector_t>;
+using data_t   = boost::variant<bool, std::int32_t, std::int64_t, float, double, std::string, std::wstring>;
+using vector_t = boost::container::small_vector<data_t, 2>;
 
+// Interned path, equal paths share the same storage so keys compare and hash by address. Keys count their
+// references so that storage which is no longer used can be reclaimed.
+class key final
+{
+  public:
+    using entry = std::pair<const std::string, std::atomic<int>>;
+
+    key();
+    explicit key(const std::string& str);
+
+    key(const key& other) noexcept
+        : entry_(other.entry_)
+    {
+        entry_->second.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    key(key&& other) noexcept
+        : entry_(other.entry_)
+    {
+        other.entry_ = nullptr;
+    }
+
+    ~key()
+    {
+        if (entry_) {
+            entry_->second.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    key& operator=(key other) noexcept
+    {
+        std::swap(entry_, other.entry_);
+        return *this;
+    }
+
+    const std::string& str() const { return entry_->first; }
+
+    bool operator==(const key& other) const { return entry_ == other.entry_; }
+    bool operator!=(const key& other) const { return entry_ != other.entry_; }
+    bool operator<(const key& other) const { return entry_ < other.entry_; }
+
+    struct hash
+    {
+        std::size_t operator()(const key& k) const { return std::hash<const entry*>()(k.entry_); }
+    };
+
+  private:
+    entry* entry_;
+};
+
+// Path segments and joined paths are interned once and then looked up through per thread caches, so building the
+// same paths every tick neither allocates nor locks. The caches are bounded and start over when they fill up.
+key segment(const std::string& str);
+key segment(const char* str);
+key segment(std::int64_t value);
+key join(const key& parent, const key& child);
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, key>::type segment_of(const T& value)
+{
+    return segment(static_cast<std::int64_t>(value));
+}
+
+template <typename T>
+typename std::enable_if<std::is_convertible<const T&, std::string>::value, key>::type segment_of(const T& value)
+{
+    return segment(value);
+}
+
+template <typename T>
+typename std::enable_if<!std::is_integral<T>::value && !std::is_convertible<const T&, std::string>::value, key>::type
+segment_of(const T& value)
+{
+    return segment(boost::lexical_cast<std::string>(value));
+}
+
+using data_map_t = boost::container::flat_map<key, vector_t>;
+
+// Copies share their storage until either side is modified. Assigning a state to a path attaches it by reference
+// instead of copying and re-prefixing its values. Storage is recycled through a pool so that states rebuilt every tick
+// keep their capacity.
 class state
 {
-    data_map_t data_;
+    struct node;
+
+    std::shared_ptr<node> node_;
+
+    node& mutable_node();
 
     class state_proxy
     {
-        std::string key_;
-        data_map_t& data_;
+        key    key_;
+        state& state_;
 
       public:
-        state_proxy(const std::string& key, data_map_t& data)
-            : key_(key)
-            , data_(data)
+        state_proxy(key key, state& state)
+            : key_(std::move(key))
+            , state_(state)
         {
         }
 
         state_proxy& operator=(data_t data)
         {
-            data_[key_] = {std::move(data)};
+            state_.set(key_, vector_t{std::move(data)});
             return *this;
         }
 
         state_proxy& operator=(vector_t data)
         {
-            data_[key_] = std::move(data);
+            state_.set(key_, std::move(data));
             return *this;
         }
 
         template <typename T>
         state_proxy operator[](const T& key)
         {
-            return state_proxy(key_ + "/" + boost::lexical_cast<std::string>(key), data_);
+            return state_proxy(join(key_, segment_of(key)), state_);
         }
 
         template <typename T>
         state_proxy& operator=(const std::vector<T>& data)
         {
-            data_[key_] = vector_t(data.begin(), data.end());
+            state_.set(key_, vector_t(data.begin(), data.end()));
             return *this;
         }
 
         state_proxy& operator=(std::initializer_list<data_t> data)
         {
-            data_[key_] = vector_t(std::move(data));
+            state_.set(key_, vector_t(std::move(data)));
             return *this;
         }
 
         state_proxy& operator=(const state& other)
         {
-            for (auto& p : other) {
-                data_[key_ + "/" + p.first] = std::move(p.second);
-            }
+            state_.attach(key_, other);
             return *this;
         }
     };
 
   public:
+    using func_t = std::function<void(const key& path, const vector_t& data)>;
+
     state() = default;
-    state(const state& other)
-        : data_(other.data_)
-    {
-    }
-    state(data_map_t data)
-        : data_(std::move(data))
-    {
-    }
-    state& operator=(const state& other)
-    {
-        data_ = other.data_;
-        return *this;
-    }
 
     template <typename T>
     state_proxy operator[](const T& key)
     {
-        return state_proxy(boost::lexical_cast<std::string>(key), data_);
+        return state_proxy(segment_of(key), *this);
     }
 
-    data_map_t::const_iterator begin() const { return data_.begin(); }
+    void set(const key& path, vector_t data);
+    void attach(const key& path, const state& other);
+
+    // Calls func with the full path of every value, including those of attached states. Values set directly take
+    // precedence over values with the same path in attached states.
+    void for_each(const func_t& func) const;
+
+    bool empty() const;
+};
+
+// Remembers what was last reported for every path so that only changes need to be published. Paths which have not
+// been reported for refresh_interval are reported again even if unchanged.
+class state_tracker final
+{
+  public:
+    using clock_t = std::chrono::steady_clock;
+    using func_t  = state::func_t;
+
+    explicit state_tracker(clock_t::duration refresh_interval = std::chrono::seconds(1));
+
+    // Calls func for every value in state which changed since it was last reported or is due for a refresh.
+    void update(const state& state, const func_t& func);
+
+    // Forget everything, the next update reports all values.
+    void reset();
+
+    void              refresh_interval(clock_t::duration interval);
+    clock_t::duration refresh_interval() const;
+
+  private:
+    struct entry
+    {
+        vector_t            data;
+        clock_t::time_point reported;
+    };
 
-    data_map_t::const_iterator end() const { return data_.end(); }
+    std::unordered_map<key, entry, key::hash> entries_;
+    clock_t::duration                         refresh_interval_;
+    clock_t::time_point                       last_prune_;
 };
 
 }}} // namespace caspar::core::monitor
@@ -177,6 +177,11 @@ class destroy_producer_proxy : public frame_producer
     draw_frame           last_frame() override { return producer_->last_frame(); }
     draw_frame           first_frame() override { return producer_->first_frame(); }
     core::monitor::state state() const override { return producer_->state(); }
+    bool                 is_ready() const override { return producer_->is_ready(); }
+    bool                 wait_ready(std::chrono::steady_clock::time_point deadline) const override
+    {
+        return producer_->wait_ready(deadline);
+    }
 };
 
 spl::shared_ptr<core::frame_producer> create_destroy_proxy(spl::shared_ptr<core::frame_producer> producer)
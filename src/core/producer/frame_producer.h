@@ -32,6 +32,7 @@
 
 #include <boost/optional.hpp>
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <future>
@@ -114,6 +115,13 @@ class frame_producer
     virtual void                            leading_producer(const spl::shared_ptr<frame_producer>&) {}
     virtual spl::shared_ptr<frame_producer> following_producer() const { return core::frame_producer::empty(); }
     virtual boost::optional<int64_t>        auto_play_delta() const { return boost::none; }
+
+    // Whether the producer is prerolled, i.e. its first frames are buffered so that receive delivers from the
+    // first call on. Background producers report it in their layer state, LOADBG PREROLL waits for it.
+    virtual bool is_ready() const { return true; }
+
+    // Blocks until is_ready() or until deadline, and returns is_ready().
+    virtual bool wait_ready(std::chrono::steady_clock::time_point deadline) const { return is_ready(); }
 };
 
 class frame_producer_registry;
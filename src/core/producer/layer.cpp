@@ -119,6 +119,7 @@ struct layer::impl
 
             state_["background"]             = background_->state();
             state_["background"]["producer"] = background_->name();
+            state_["background"]["ready"]    = background_->is_ready();
 
             return frame;
         } catch (...) {
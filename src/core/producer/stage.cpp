@@ -36,6 +36,9 @@
 
 #include <boost/range/adaptors.hpp>
 
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
 #include <functional>
 #include <future>
 #include <map>
@@ -51,6 +54,7 @@ struct stage::impl : public std::enable_shared_from_this<impl>
     std::map<int, layer>                layers_;
     std::map<int, tweened_transform>    tweens_;
     std::set<int>                       routeSources;
+    tbb::task_arena                     arena_;
 
     executor executor_{L"stage " + std::to_wstring(channel_index_)};
 
@@ -135,22 +139,65 @@ struct stage::impl : public std::enable_shared_from_this<impl>
                 for (auto& p : layers_)
                     orderSourceLayers(layerVec, routed_layers, p.first, 0);
 
-                for (auto& l : layerVec) {
-                    auto  p     = layers_.find(l.first);
-                    auto& layer = p->second;
-                    auto& tween = tweens_[p->first];
+                // group layers into dependency levels, a same-channel route is pulled after its source
+                std::map<int, int>               levels;
+                std::vector<std::vector<size_t>> level_layers;
+                for (size_t n = 0; n < layerVec.size(); ++n) {
+                    auto level   = 0;
+                    auto routeIt = routed_layers.find(layerVec[n].first);
+                    if (routeIt != routed_layers.end() && routeIt->second.first == channel_index_ &&
+                        layerVec[n].second) {
+                        auto srcIt = levels.find(routeIt->second.second);
+                        if (srcIt != levels.end()) {
+                            level = srcIt->second + 1;
+                        }
+                    }
+                    levels[layerVec[n].first] = level;
+
+                    if (level_layers.size() <= static_cast<size_t>(level)) {
+                        level_layers.resize(level + 1);
+                    }
+                    level_layers[level].push_back(n);
+                }
+
+                std::vector<layer*>          layer_ptrs(layerVec.size());
+                std::vector<frame_transform> transforms(layerVec.size());
+                std::vector<layer_frame>     results(layerVec.size());
+                for (size_t n = 0; n < layerVec.size(); ++n) {
+                    layer_ptrs[n] = &layers_.find(layerVec[n].first)->second;
+                    transforms[n] = tweens_[layerVec[n].first].fetch();
+                }
+
+                auto receive = [&](size_t n) {
+                    auto  index = layerVec[n].first;
+                    auto& layer = *layer_ptrs[n];
 
                     layer_frame res    = {};
-                    res.foreground     = draw_frame::push(l.second ? layer.receive(format_desc, nb_samples) : draw_frame(), tween.fetch());
+                    res.foreground     = draw_frame::push(
+                        layerVec[n].second ? layer.receive(format_desc, nb_samples) : draw_frame(), transforms[n]);
                     res.has_background = layer.has_background();
-                    if (std::find(fetch_background.begin(), fetch_background.end(), p->first) !=
+                    if (std::find(fetch_background.begin(), fetch_background.end(), index) !=
                         fetch_background.end()) {
                         res.background = layer.receive_background(format_desc, nb_samples);
                     }
-                    frames[p->first] = res;
+                    results[n] = res;
 
                     // push received foreground frame to any configured route producer
-                    routesCb(p->first, res);
+                    routesCb(index, res);
+                };
+
+                for (auto& level : level_layers) {
+                    if (level.size() == 1) {
+                        receive(level.front());
+                    } else {
+                        arena_.execute([&] {
+                            tbb::parallel_for(size_t(0), level.size(), [&](size_t i) { receive(level[i]); });
+                        });
+                    }
+                }
+
+                for (size_t n = 0; n < layerVec.size(); ++n) {
+                    frames[layerVec[n].first] = results[n];
                 }
 
                 for (auto& p : frames) {
@@ -193,6 +240,11 @@ struct stage::impl : public std::enable_shared_from_this<impl>
                 auto& tween = tweens_[std::get<0>(transform)];
                 auto  src   = tween.fetch();
                 auto  dst   = std::get<1>(transform)(tween.dest());
+
+                // A ramp belongs to the frame it was fetched for, not to the new tween.
+                src.audio_transform.previous_volume.reset();
+                dst.audio_transform.previous_volume.reset();
+
                 tweens_[std::get<0>(transform)] =
                     tweened_transform(src, dst, std::get<2>(transform), std::get<3>(transform));
             }
@@ -205,8 +257,12 @@ struct stage::impl : public std::enable_shared_from_this<impl>
                                       const tweener&                 tween)
     {
         return executor_.begin_invoke([=] {
-            auto src       = tweens_[index].fetch();
-            auto dst       = transform(src);
+            auto src = tweens_[index].fetch();
+            src.audio_transform.previous_volume.reset();
+
+            auto dst = transform(src);
+            dst.audio_transform.previous_volume.reset();
+
             tweens_[index] = tweened_transform(src, dst, mix_duration, tween);
         });
     }
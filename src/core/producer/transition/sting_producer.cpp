@@ -169,6 +169,17 @@ class sting_producer : public frame_producer
 
     uint32_t frame_number() const override { return dst_producer_->frame_number(); }
 
+    bool is_ready() const override
+    {
+        return dst_producer_->is_ready() && mask_producer_->is_ready() && overlay_producer_->is_ready();
+    }
+
+    bool wait_ready(std::chrono::steady_clock::time_point deadline) const override
+    {
+        return dst_producer_->wait_ready(deadline) && mask_producer_->wait_ready(deadline) &&
+               overlay_producer_->wait_ready(deadline);
+    }
+
     std::wstring print() const override
     {
         return L"transition[" + src_producer_->print() + L"=>" + dst_producer_->print() + L"]";
@@ -186,9 +197,15 @@ class sting_producer : public frame_producer
     {
         const auto   duration = auto_play_delta();
         const double delta    = duration ? audio_tweener_(current_frame_, 0.0, 1.0, static_cast<double>(*duration)) : 0;
-
-        src_frame.transform().audio_transform.volume = 1.0 - delta;
-        dst_frame.transform().audio_transform.volume = delta;
+        const double previous_delta =
+            duration && current_frame_ > 0
+                ? audio_tweener_(current_frame_ - 1, 0.0, 1.0, static_cast<double>(*duration))
+                : delta;
+
+        src_frame.transform().audio_transform.volume          = 1.0 - delta;
+        src_frame.transform().audio_transform.previous_volume = 1.0 - previous_delta;
+        dst_frame.transform().audio_transform.volume          = delta;
+        dst_frame.transform().audio_transform.previous_volume = previous_delta;
 
         draw_frame mask_frame2                         = mask_frame;
         mask_frame.transform().image_transform.is_key  = true;
@@ -78,6 +78,13 @@ class transition_producer : public frame_producer
 
     boost::optional<int64_t> auto_play_delta() const override { return info_.duration; }
 
+    bool is_ready() const override { return dst_producer_->is_ready(); }
+
+    bool wait_ready(std::chrono::steady_clock::time_point deadline) const override
+    {
+        return dst_producer_->wait_ready(deadline);
+    }
+
     void update_state()
     {
         state_                     = dst_producer_->state();
@@ -150,11 +157,15 @@ class transition_producer : public frame_producer
         }
 
         const double delta = info_.tweener(current_frame_, 0.0, 1.0, static_cast<double>(info_.duration));
+        const double previous_delta =
+            info_.tweener(std::max(current_frame_ - 1, 0), 0.0, 1.0, static_cast<double>(info_.duration));
 
         const double dir = info_.direction == transition_direction::from_left ? 1.0 : -1.0;
 
-        src_frame.transform().audio_transform.volume = 1.0 - delta;
-        dst_frame.transform().audio_transform.volume = delta;
+        src_frame.transform().audio_transform.volume          = 1.0 - delta;
+        src_frame.transform().audio_transform.previous_volume = 1.0 - previous_delta;
+        dst_frame.transform().audio_transform.volume          = delta;
+        dst_frame.transform().audio_transform.previous_volume = previous_delta;
 
         if (info_.type == transition_type::mix) {
             dst_frame.transform().image_transform.opacity = delta;
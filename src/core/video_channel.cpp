@@ -39,6 +39,8 @@
 #include <core/diagnostics/call_context.h>
 #include <core/mixer/image/image_mixer.h>
 
+#include <algorithm>
+#include <future>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -50,9 +52,19 @@ bool operator<(const route_id& a, const route_id& b) { return a.mode + (a.index
 
 struct video_channel::impl final
 {
-    monitor::state state_;
+    struct pipeline_frame
+    {
+        const_frame             frame;
+        core::video_format_desc format_desc;
+        monitor::state          stage_state;
+        monitor::state          mixer_state;
+    };
+
+    mutable std::mutex state_mutex_;
+    monitor::state     state_;
 
     const int index_;
+    const int pipeline_depth_;
 
     mutable std::mutex      format_desc_mutex_;
     core::video_format_desc format_desc_;
@@ -72,6 +84,9 @@ struct video_channel::impl final
 
     std::function<void(core::monitor::state)> tick_;
 
+    std::unique_ptr<executor> mix_executor_;
+    std::unique_ptr<executor> consume_executor_;
+
     std::map<route_id, std::weak_ptr<core::route>> routes_;
     std::mutex                                     routes_mutex_;
 
@@ -103,8 +118,10 @@ struct video_channel::impl final
     impl(int                                       index,
          const core::video_format_desc&            format_desc,
          std::unique_ptr<image_mixer>              image_mixer,
+         int                                       pipeline_depth,
          std::function<void(core::monitor::state)> tick)
         : index_(index)
+        , pipeline_depth_(std::max(1, std::min(pipeline_depth, 3)))
         , format_desc_(format_desc)
         , output_(graph_, format_desc, index)
         , image_mixer_(std::move(image_mixer))
@@ -112,6 +129,13 @@ struct video_channel::impl final
         , stage_(index, graph_)
         , tick_(std::move(tick))
     {
+        if (pipeline_depth_ > 1) {
+            mix_executor_ = std::make_unique<executor>(L"channel-mix-" + std::to_wstring(index_));
+        }
+        if (pipeline_depth_ > 2) {
+            consume_executor_ = std::make_unique<executor>(L"channel-consume-" + std::to_wstring(index_));
+        }
+
         graph_->set_color("produce-time", caspar::diagnostics::color(0.0f, 1.0f, 0.0f));
         graph_->set_color("mix-time", caspar::diagnostics::color(1.0f, 0.0f, 0.9f, 0.8f));
         graph_->set_color("consume-time", caspar::diagnostics::color(1.0f, 0.4f, 0.0f, 0.8f));
@@ -128,6 +152,9 @@ struct video_channel::impl final
 #endif
             set_thread_name(L"channel-" + std::to_wstring(index_));
 
+            std::future<pipeline_frame> mix_future;
+            std::future<void>           consume_future;
+
             while (!abort_request_) {
                 try {
                     core::video_format_desc format_desc;
@@ -163,28 +190,34 @@ struct video_channel::impl final
                     auto          stage_frames = stage_(format_desc, nb_samples, background_routes, routesCb);
                     graph_->set_value("produce-time", produce_timer.elapsed() * format_desc.fps * 0.5);
 
-                    // Mix
-                    caspar::timer mix_timer;
-                    auto          mixed_frame = mixer_(stage_frames, format_desc, nb_samples);
-                    graph_->set_value("mix-time", mix_timer.elapsed() * format_desc.fps * 0.5);
-
-                    // Consume
-                    caspar::timer consume_timer;
-                    output_(std::move(mixed_frame), format_desc);
-                    graph_->set_value("consume-time", consume_timer.elapsed() * format_desc.fps * 0.5);
+                    if (pipeline_depth_ == 1) {
+                        consume(mix(std::move(stage_frames), stage_.state(), format_desc, nb_samples));
+                    } else if (pipeline_depth_ == 2) {
+                        // Mix and consume frame N while frame N + 1 is being produced.
+                        if (consume_future.valid()) {
+                            consume_future.get();
+                        }
+                        consume_future = mix_executor_->begin_invoke(
+                            [=, stage_frames = std::move(stage_frames), stage_state = stage_.state()]() mutable {
+                                consume(mix(std::move(stage_frames), std::move(stage_state), format_desc, nb_samples));
+                            });
+                    } else {
+                        // Consume frame N - 1 and mix frame N while frame N + 1 is being produced.
+                        if (mix_future.valid()) {
+                            auto frame = mix_future.get();
+                            if (consume_future.valid()) {
+                                consume_future.get();
+                            }
+                            consume_future = consume_executor_->begin_invoke(
+                                [=, frame = std::move(frame)]() mutable { consume(std::move(frame)); });
+                        }
+                        mix_future = mix_executor_->begin_invoke(
+                            [=, stage_frames = std::move(stage_frames), stage_state = stage_.state()]() mutable {
+                                return mix(std::move(stage_frames), std::move(stage_state), format_desc, nb_samples);
+                            });
+                    }
 
                     graph_->set_value("frame-time", frame_timer.elapsed() * format_desc.fps * 0.5);
-
-                    monitor::state state = {};
-                    state["stage"]       = stage_.state();
-                    state["mixer"]       = mixer_.state();
-                    state["output"]      = output_.state();
-                    state["framerate"]   = {format_desc_.framerate.numerator(), format_desc_.framerate.denominator()};
-                    state_               = state;
-
-                    caspar::timer osc_timer;
-                    tick_(state_);
-                    graph_->set_value("osc-time", osc_timer.elapsed() * format_desc.fps * 0.5);
                 } catch (...) {
                     CASPAR_LOG_CURRENT_EXCEPTION();
                 }
@@ -199,6 +232,55 @@ struct video_channel::impl final
         thread_.join();
     }
 
+    pipeline_frame mix(std::vector<draw_frame>        stage_frames,
+                       monitor::state                 stage_state,
+                       const core::video_format_desc& format_desc,
+                       int                            nb_samples)
+    {
+        caspar::timer mix_timer;
+
+        pipeline_frame result;
+        result.frame       = mixer_(std::move(stage_frames), format_desc, nb_samples);
+        result.format_desc = format_desc;
+        result.stage_state = std::move(stage_state);
+        result.mixer_state = mixer_.state();
+
+        graph_->set_value("mix-time", mix_timer.elapsed() * format_desc.fps * 0.5);
+
+        return result;
+    }
+
+    void consume(pipeline_frame frame)
+    {
+        const auto& format_desc = frame.format_desc;
+
+        caspar::timer consume_timer;
+        output_(std::move(frame.frame), format_desc);
+        graph_->set_value("consume-time", consume_timer.elapsed() * format_desc.fps * 0.5);
+
+        monitor::state state         = {};
+        state["stage"]               = frame.stage_state;
+        state["mixer"]               = frame.mixer_state;
+        state["output"]              = output_.state();
+        state["framerate"]           = {format_desc.framerate.numerator(), format_desc.framerate.denominator()};
+        state["pipeline"]["depth"]   = pipeline_depth_;
+        state["pipeline"]["latency"] = pipeline_depth_ - 1;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex_);
+            state_ = state;
+        }
+
+        caspar::timer osc_timer;
+        tick_(std::move(state));
+        graph_->set_value("osc-time", osc_timer.elapsed() * format_desc.fps * 0.5);
+    }
+
+    monitor::state state() const
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        return state_;
+    }
+
     std::shared_ptr<core::route> route(int index = -1, route_mode mode = route_mode::foreground)
     {
         std::lock_guard<std::mutex> lock(routes_mutex_);
@@ -253,8 +335,9 @@ struct video_channel::impl final
 video_channel::video_channel(int                                       index,
                              const core::video_format_desc&            format_desc,
                              std::unique_ptr<image_mixer>              image_mixer,
+                             int                                       pipeline_depth,
                              std::function<void(core::monitor::state)> tick)
-    : impl_(new impl(index, format_desc, std::move(image_mixer), std::move(tick)))
+    : impl_(new impl(index, format_desc, std::move(image_mixer), pipeline_depth, std::move(tick)))
 {
 }
 video_channel::~video_channel() {}
@@ -271,7 +354,7 @@ void                           core::video_channel::video_format_desc(const core
     impl_->video_format_desc(format_desc);
 }
 int                  video_channel::index() const { return impl_->index(); }
-core::monitor::state video_channel::state() const { return impl_->state_; }
+core::monitor::state video_channel::state() const { return impl_->state(); }
 
 std::shared_ptr<route> video_channel::route(int index, route_mode mode) { return impl_->route(index, mode); }
 
@@ -72,6 +72,7 @@ class video_channel final
     explicit video_channel(int                                       index,
                            const video_format_desc&                  format_desc,
                            std::unique_ptr<image_mixer>              image_mixer,
+                           int                                       pipeline_depth,
                            std::function<void(core::monitor::state)> on_tick);
     ~video_channel();
 
@@ -68,16 +68,18 @@ extern "C" {
 
 #include <tbb/concurrent_queue.h>
 #include <tbb/parallel_for.h>
-#include <tbb/parallel_invoke.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <thread>
+#include <vector>
 
 namespace caspar { namespace ffmpeg {
 
 // TODO multiple output streams
-// TODO multiple output files
-// TODO run video filter, video encoder, audio filter, audio encoder in separate threads.
 // TODO realtime with smaller buffer?
 
 struct Stream
@@ -86,19 +88,26 @@ struct Stream
     AVFilterContext*               sink   = nullptr;
     AVFilterContext*               source = nullptr;
 
-    std::shared_ptr<AVCodecContext> enc = nullptr;
-    AVStream*                       st  = nullptr;
+    std::shared_ptr<AVCodecContext>    enc   = nullptr;
+    std::shared_ptr<AVCodecParameters> par   = nullptr;
+    int                                index = 0;
 
     tbb::concurrent_bounded_queue<std::shared_ptr<SwsContext>> sws_;
 
+    tbb::concurrent_bounded_queue<core::const_frame> frames_;
+    std::atomic<bool>                                abort_{false};
+    std::thread                                      thread_;
+
     int64_t pts = 0;
 
-    Stream(AVFormatContext*                    oc,
+    Stream(bool                                global_header,
+           int                                 index,
            std::string                         suffix,
            AVCodecID                           codec_id,
            const core::video_format_desc&      format_desc,
            bool                                realtime,
            std::map<std::string, std::string>& options)
+        : index(index)
     {
         std::map<std::string, std::string> stream_options;
 
@@ -254,11 +263,6 @@ struct Stream
 
         FF(avfilter_graph_config(graph.get(), nullptr));
 
-        st = avformat_new_stream(oc, nullptr);
-        if (!st) {
-            FF_RET(AVERROR(ENOMEM), "avformat_new_stream");
-        }
-
         enc = std::shared_ptr<AVCodecContext>(avcodec_alloc_context3(codec),
                                               [](AVCodecContext* ptr) { avcodec_free_context(&ptr); });
 
@@ -267,22 +271,18 @@ struct Stream
         }
 
         if (codec->type == AVMEDIA_TYPE_VIDEO) {
-            st->time_base = av_inv_q(av_buffersink_get_frame_rate(sink));
-
             enc->width               = av_buffersink_get_w(sink);
             enc->height              = av_buffersink_get_h(sink);
             enc->framerate           = av_buffersink_get_frame_rate(sink);
             enc->sample_aspect_ratio = av_buffersink_get_sample_aspect_ratio(sink);
-            enc->time_base           = st->time_base;
+            enc->time_base           = av_inv_q(av_buffersink_get_frame_rate(sink));
             enc->pix_fmt             = static_cast<AVPixelFormat>(av_buffersink_get_format(sink));
         } else if (codec->type == AVMEDIA_TYPE_AUDIO) {
-            st->time_base = {1, av_buffersink_get_sample_rate(sink)};
-
             enc->sample_fmt     = static_cast<AVSampleFormat>(av_buffersink_get_format(sink));
             enc->sample_rate    = av_buffersink_get_sample_rate(sink);
             enc->channels       = av_buffersink_get_channels(sink);
             enc->channel_layout = av_buffersink_get_channel_layout(sink);
-            enc->time_base      = st->time_base;
+            enc->time_base      = {1, av_buffersink_get_sample_rate(sink)};
 
             if (!enc->channels) {
                 enc->channels = av_get_channel_layout_nb_channels(enc->channel_layout);
@@ -297,6 +297,10 @@ struct Stream
             enc->thread_type = FF_THREAD_SLICE;
         }
 
+        if (global_header) {
+            enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+
         auto dict = to_dict(std::move(stream_options));
         CASPAR_SCOPE_EXIT { av_dict_free(&dict); };
         FF(avcodec_open2(enc.get(), codec, &dict));
@@ -304,15 +308,16 @@ struct Stream
             options[p.first] = p.second + suffix;
         }
 
-        FF(avcodec_parameters_from_context(st->codecpar, enc.get()));
+        par = std::shared_ptr<AVCodecParameters>(avcodec_parameters_alloc(),
+                                                 [](AVCodecParameters* ptr) { avcodec_parameters_free(&ptr); });
+        if (!par) {
+            FF_RET(AVERROR(ENOMEM), "avcodec_parameters_alloc");
+        }
+        FF(avcodec_parameters_from_context(par.get(), enc.get()));
 
         if (codec->type == AVMEDIA_TYPE_AUDIO && !(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)) {
             av_buffersink_set_frame_size(sink, enc->frame_size);
         }
-
-        if (oc->oformat->flags & AVFMT_GLOBALHEADER) {
-            enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-        }
     }
 
     std::shared_ptr<SwsContext> get_sws(int width, int height)
@@ -353,6 +358,62 @@ struct Stream
         return std::shared_ptr<SwsContext>(sws.get(), [this, sws](SwsContext*) { sws_.push(sws); });
     }
 
+    ~Stream() { stop(); }
+
+    // Filters and encodes on a thread of its own, so that a slow encoder only holds back its own stream. An empty
+    // frame flushes the encoder and ends the thread. After an error frames are discarded until the empty frame.
+    void start(const core::video_format_desc&                 format_desc,
+               int                                            capacity,
+               std::function<void(std::shared_ptr<AVPacket>)> cb,
+               std::function<void(double)>                    on_time,
+               std::function<void(std::exception_ptr)>        on_error)
+    {
+        frames_.set_capacity(capacity);
+        thread_ = std::thread([=] {
+            auto failed = false;
+            while (true) {
+                core::const_frame frame;
+                frames_.pop(frame);
+
+                if (abort_) {
+                    break;
+                }
+
+                if (!failed) {
+                    try {
+                        caspar::timer frame_timer;
+                        send(frame, format_desc, cb);
+                        on_time(frame_timer.elapsed());
+                    } catch (...) {
+                        CASPAR_LOG_CURRENT_EXCEPTION();
+                        failed = true;
+                        on_error(std::current_exception());
+                    }
+                }
+
+                if (!frame) {
+                    break;
+                }
+            }
+        });
+    }
+
+    // Blocks while the stage is full.
+    void push(const core::const_frame& frame) { frames_.push(frame); }
+
+    void join() { thread_.join(); }
+
+    // Ends the stage without flushing. Must be called from the thread which pushes frames.
+    void stop()
+    {
+        if (thread_.joinable()) {
+            abort_ = true;
+            frames_.clear();
+            frames_.push(core::const_frame{});
+            thread_.join();
+        }
+    }
+
     void send(core::const_frame&                             in_frame,
               const core::video_format_desc&                 format_desc,
               std::function<void(std::shared_ptr<AVPacket>)> cb)
@@ -434,14 +495,302 @@ struct Stream
                 return;
             } else {
                 FF_RET(ret, "avcodec_receive_packet");
-                pkt->stream_index = st->index;
-                av_packet_rescale_ts(pkt.get(), enc->time_base, st->time_base);
+                // Timestamps are in the encoder time base, each output rescales them for its own streams.
+                pkt->stream_index = index;
                 cb(std::move(pkt));
             }
         }
     }
 };
 
+// Muxes the packets of the shared encoders to one destination, on a thread of its own. Outputs are separated by "|"
+// and may be prefixed with options in the style of the tee muxer, e.g. "[f=mpegts:onfail=reconnect]srt://host:9000".
+// "f" selects the format, "onfail" is one of abort (default), ignore or reconnect, and other options go to the muxer.
+struct Output
+{
+    enum class on_fail
+    {
+        abort,
+        ignore,
+        reconnect,
+    };
+
+    std::string                        path;
+    boost::filesystem::path            full_path;
+    std::string                        format;
+    std::map<std::string, std::string> options;
+    on_fail                            fail     = on_fail::abort;
+    bool                               blocking = true;
+
+    std::wstring                        name_;
+    std::string                         mux_time_;
+    std::vector<const Stream*>          streams_;
+    std::shared_ptr<diagnostics::graph> graph_;
+    double                              fps_ = 0.0;
+
+    tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>> packets_;
+    std::atomic<bool>                                        dropping_{false};
+    std::thread                                              thread_;
+
+    bool                 opened_ = false;
+    bool                 eof_    = false;
+    std::chrono::seconds delay_{1};
+
+    Output(const std::string& spec, std::string default_format, bool realtime, bool shared)
+        : path(spec)
+        , format(std::move(default_format))
+    {
+        if (boost::algorithm::starts_with(spec, "[")) {
+            const auto end = spec.find(']');
+            if (end == std::string::npos) {
+                CASPAR_THROW_EXCEPTION(user_error() << msg_info("Missing ] in ffmpeg output " + spec));
+            }
+
+            std::vector<std::string> opts;
+            boost::split(opts, spec.substr(1, end - 1), boost::is_any_of(":"));
+            for (auto& opt : opts) {
+                if (opt.empty()) {
+                    continue;
+                }
+
+                const auto sep   = opt.find('=');
+                const auto key   = opt.substr(0, sep);
+                const auto value = sep != std::string::npos ? opt.substr(sep + 1) : "";
+
+                if (key == "f") {
+                    format = value;
+                } else if (key == "onfail") {
+                    if (value == "abort") {
+                        fail = on_fail::abort;
+                    } else if (value == "ignore") {
+                        fail = on_fail::ignore;
+                    } else if (value == "reconnect") {
+                        fail = on_fail::reconnect;
+                    } else {
+                        CASPAR_THROW_EXCEPTION(user_error() << msg_info("Invalid onfail value " + value));
+                    }
+                } else {
+                    options[key] = value;
+                }
+            }
+
+            path = spec.substr(end + 1);
+        }
+
+        full_path = path;
+
+        static boost::regex prot_exp("^.+:.*");
+        if (!boost::regex_match(path, prot_exp)) {
+            if (!full_path.is_complete()) {
+                full_path = u8(env::media_folder()) + path;
+            }
+
+            // TODO -y?
+            if (boost::filesystem::exists(full_path)) {
+                boost::filesystem::remove(full_path);
+            }
+
+            boost::filesystem::create_directories(full_path.parent_path());
+        } else if (shared) {
+            // A network output which falls behind drops packets rather than holding back the other outputs.
+            blocking = false;
+        }
+
+        packets_.set_capacity(blocking && realtime ? 1 : 128);
+
+        name_ = L"ffmpeg[" + u16(path) + L"]";
+    }
+
+    ~Output() { close(); }
+
+    AVOutputFormat* guess_format() const
+    {
+        auto oformat = !format.empty() ? av_guess_format(format.c_str(), nullptr, nullptr)
+                                       : av_guess_format(nullptr, path.c_str(), nullptr);
+        if (!oformat) {
+            FF_RET(AVERROR(EINVAL), "av_guess_format");
+        }
+        return oformat;
+    }
+
+    // on_error is called when the output fails for good, with fatal set if the whole consumer should fail.
+    void start(std::vector<const Stream*>                     streams,
+               std::shared_ptr<diagnostics::graph>            graph,
+               std::string                                    mux_time,
+               double                                         fps,
+               std::function<void(std::exception_ptr, bool)> on_error)
+    {
+        streams_  = std::move(streams);
+        graph_    = std::move(graph);
+        mux_time_ = std::move(mux_time);
+        fps_      = fps;
+
+        thread_ = std::thread([=] {
+            while (true) {
+                try {
+                    write();
+                    return;
+                } catch (...) {
+                    CASPAR_LOG_CURRENT_EXCEPTION();
+                    if (fail != on_fail::reconnect || eof_) {
+                        on_error(std::current_exception(), fail == on_fail::abort);
+
+                        // Keep draining so that the encoders don't block.
+                        std::shared_ptr<AVPacket> pkt;
+                        while (!eof_) {
+                            packets_.pop(pkt);
+                            eof_ = !pkt;
+                        }
+                        return;
+                    }
+                }
+
+                graph_->set_tag(diagnostics::tag_severity::WARNING, "output-error");
+                CASPAR_LOG(warning) << name_ << L" Reconnecting in " << delay_.count() << L" s.";
+
+                if (!discard(delay_)) {
+                    return;
+                }
+                delay_ = std::min(delay_ * 2, std::chrono::seconds(30));
+            }
+        });
+    }
+
+    // Called from the encoders.
+    void push(const std::shared_ptr<AVPacket>& pkt)
+    {
+        if (blocking) {
+            packets_.push(pkt);
+            return;
+        }
+
+        // After a dropped packet everything up to the next key frame of the first stream is dropped.
+        const auto key = pkt->stream_index == 0 && (pkt->flags & AV_PKT_FLAG_KEY);
+        if (dropping_ && !key) {
+            return;
+        }
+
+        if (packets_.try_push(pkt)) {
+            if (key) {
+                dropping_ = false;
+            }
+        } else {
+            dropping_ = true;
+            graph_->set_tag(diagnostics::tag_severity::WARNING, "dropped-packet");
+        }
+    }
+
+    // Ends the stream, writes the trailer and joins the thread.
+    void close()
+    {
+        if (thread_.joinable()) {
+            packets_.push(nullptr);
+            thread_.join();
+        }
+    }
+
+    void write()
+    {
+        AVFormatContext* oc = nullptr;
+        FF(avformat_alloc_output_context2(&oc, nullptr, !format.empty() ? format.c_str() : nullptr, path.c_str()));
+        CASPAR_SCOPE_EXIT { avformat_free_context(oc); };
+
+        for (auto stream : streams_) {
+            auto st = avformat_new_stream(oc, nullptr);
+            if (!st) {
+                FF_RET(AVERROR(ENOMEM), "avformat_new_stream");
+            }
+            FF(avcodec_parameters_copy(st->codecpar, stream->par.get()));
+            st->time_base = stream->enc->time_base;
+        }
+
+        CASPAR_SCOPE_EXIT
+        {
+            if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&oc->pb);
+            }
+        };
+
+        auto opts = options;
+
+        if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+            // TODO (fix) interrupt_cb
+            auto dict = to_dict(std::move(opts));
+            CASPAR_SCOPE_EXIT { av_dict_free(&dict); };
+            FF(avio_open2(&oc->pb, full_path.string().c_str(), AVIO_FLAG_WRITE, nullptr, &dict));
+            opts = to_map(&dict);
+        }
+
+        {
+            auto dict = to_dict(std::move(opts));
+            CASPAR_SCOPE_EXIT { av_dict_free(&dict); };
+            FF(avformat_write_header(oc, &dict));
+            opts = to_map(&dict);
+        }
+
+        // A reconnected output starts at the next key frame.
+        auto resync = opened_;
+        if (!opened_) {
+            for (auto& p : opts) {
+                CASPAR_LOG(warning) << name_ << " Unused option " << p.first << "=" << p.second;
+            }
+            opened_ = true;
+        }
+        delay_ = std::chrono::seconds(1);
+
+        std::vector<int64_t> count(streams_.size());
+
+        std::shared_ptr<AVPacket> pkt;
+        while (true) {
+            packets_.pop(pkt);
+            if (!pkt) {
+                eof_ = true;
+                break;
+            }
+
+            if (resync) {
+                if (pkt->stream_index != 0 || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+                    continue;
+                }
+                resync = false;
+            }
+
+            count[pkt->stream_index] += 1;
+
+            auto pkt2 = alloc_packet();
+            FF(av_packet_ref(pkt2.get(), pkt.get()));
+            av_packet_rescale_ts(pkt2.get(),
+                                 streams_[pkt->stream_index]->enc->time_base,
+                                 oc->streams[pkt->stream_index]->time_base);
+
+            caspar::timer mux_timer;
+            FF(av_interleaved_write_frame(oc, pkt2.get()));
+            graph_->set_value(mux_time_, mux_timer.elapsed() * fps_ * 0.5);
+        }
+
+        if (std::all_of(count.begin(), count.end(), [](int64_t n) { return n > 0; })) {
+            FF(av_write_trailer(oc));
+        }
+    }
+
+    // Discards packets for the given duration. Returns false at the end of the stream.
+    bool discard(std::chrono::steady_clock::duration duration)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + duration;
+        while (std::chrono::steady_clock::now() < deadline) {
+            std::shared_ptr<AVPacket> pkt;
+            while (packets_.try_pop(pkt)) {
+                if (!pkt) {
+                    eof_ = true;
+                    return false;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+};
+
 struct ffmpeg_consumer : public core::frame_consumer
 {
     core::monitor::state    state_;
@@ -477,8 +826,12 @@ struct ffmpeg_consumer : public core::frame_consumer
         frame_buffer_.set_capacity(realtime_ ? 1 : 64);
 
         diagnostics::register_graph(graph_);
-        graph_->set_color("frame-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+        graph_->set_color("video-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+        graph_->set_color("audio-time", diagnostics::color(0.1f, 0.6f, 1.0f));
+        graph_->set_color("mux-time", diagnostics::color(1.0f, 0.8f, 0.1f));
         graph_->set_color("dropped-frame", diagnostics::color(0.3f, 0.6f, 0.3f));
+        graph_->set_color("dropped-packet", diagnostics::color(0.6f, 0.3f, 0.3f));
+        graph_->set_color("output-error", diagnostics::color(1.0f, 0.3f, 0.3f));
         graph_->set_color("input", diagnostics::color(0.7f, 0.4f, 0.4f));
     }
 
@@ -490,6 +843,14 @@ struct ffmpeg_consumer : public core::frame_consumer
         }
     }
 
+    void set_exception(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(exception_mutex_);
+        if (!exception_) {
+            exception_ = std::move(e);
+        }
+    }
+
     // frame consumer
 
     void initialize(const core::video_format_desc& format_desc, int channel_index) override
@@ -516,46 +877,54 @@ struct ffmpeg_consumer : public core::frame_consumer
                     }
                 }
 
-                boost::filesystem::path full_path = path_;
-
-                static boost::regex prot_exp("^.+:.*");
-                if (!boost::regex_match(path_, prot_exp)) {
-                    if (!full_path.is_complete()) {
-                        full_path = u8(env::media_folder()) + path_;
-                    }
-
-                    // TODO -y?
-                    if (boost::filesystem::exists(full_path)) {
-                        boost::filesystem::remove(full_path);
+                std::string format;
+                {
+                    const auto format_it = options.find("format");
+                    if (format_it != options.end()) {
+                        format = std::move(format_it->second);
+                        options.erase(format_it);
                     }
-
-                    boost::filesystem::create_directories(full_path.parent_path());
                 }
 
-                AVFormatContext* oc = nullptr;
+                // The tee muxer takes the same "|" separated syntax and is passed through as a single output.
+                std::vector<std::string> specs;
+                if (format == "tee") {
+                    specs.push_back(path_);
+                } else {
+                    boost::split(specs, path_, boost::is_any_of("|"));
+                }
 
-                {
-                    std::string format;
-                    {
-                        const auto format_it = options.find("format");
-                        if (format_it != options.end()) {
-                            format = std::move(format_it->second);
-                            options.erase(format_it);
+                std::atomic<int>                     alive{0};
+                std::vector<std::unique_ptr<Output>> outputs;
+                for (auto& spec : specs) {
+                    outputs.push_back(std::make_unique<Output>(spec, format, realtime_, specs.size() > 1));
+                }
+                alive = static_cast<int>(outputs.size());
+
+                // Encoders are shared by all outputs, the first output decides the codecs. The other outputs must
+                // be able to mux them, and any of them may need the codec headers out of band.
+                const auto oformat       = outputs.front()->guess_format();
+                auto       global_header = (oformat->flags & AVFMT_GLOBALHEADER) != 0;
+                for (auto n = 1; n < static_cast<int>(outputs.size()); ++n) {
+                    const auto fmt = outputs[n]->guess_format();
+                    for (auto codec_id : {oformat->video_codec, oformat->audio_codec}) {
+                        if (codec_id != AV_CODEC_ID_NONE &&
+                            avformat_query_codec(fmt, codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+                            CASPAR_THROW_EXCEPTION(user_error() << msg_info(
+                                                       "ffmpeg output " + outputs[n]->path + " (" + fmt->name +
+                                                       ") cannot mux " + avcodec_get_name(codec_id) + " from " +
+                                                       oformat->name + ", set its codecs on the first output"));
                         }
                     }
-
-                    FF(avformat_alloc_output_context2(
-                        &oc, nullptr, !format.empty() ? format.c_str() : nullptr, path_.c_str()));
+                    global_header |= (fmt->flags & AVFMT_GLOBALHEADER) != 0;
                 }
 
-                CASPAR_SCOPE_EXIT { avformat_free_context(oc); };
-
                 boost::optional<Stream> video_stream;
-                if (oc->oformat->video_codec != AV_CODEC_ID_NONE) {
-                    if (oc->oformat->video_codec == AV_CODEC_ID_H264 && options.find("preset:v") == options.end()) {
+                if (oformat->video_codec != AV_CODEC_ID_NONE) {
+                    if (oformat->video_codec == AV_CODEC_ID_H264 && options.find("preset:v") == options.end()) {
                         options["preset:v"] = "veryfast";
                     }
-                    video_stream.emplace(oc, ":v", oc->oformat->video_codec, format_desc, realtime_, options);
+                    video_stream.emplace(global_header, 0, ":v", oformat->video_codec, format_desc, realtime_, options);
 
                     {
                         std::lock_guard<std::mutex> lock(state_mutex_);
@@ -564,79 +933,80 @@ struct ffmpeg_consumer : public core::frame_consumer
                 }
 
                 boost::optional<Stream> audio_stream;
-                if (oc->oformat->audio_codec != AV_CODEC_ID_NONE) {
-                    audio_stream.emplace(oc, ":a", oc->oformat->audio_codec, format_desc, realtime_, options);
+                if (oformat->audio_codec != AV_CODEC_ID_NONE) {
+                    const auto index = video_stream ? 1 : 0;
+                    audio_stream.emplace(global_header, index, ":a", oformat->audio_codec, format_desc, realtime_, options);
                 }
 
-                if (!(oc->oformat->flags & AVFMT_NOFILE)) {
-                    // TODO (fix) interrupt_cb
-                    auto dict = to_dict(std::move(options));
-                    CASPAR_SCOPE_EXIT { av_dict_free(&dict); };
-                    FF(avio_open2(&oc->pb, full_path.string().c_str(), AVIO_FLAG_WRITE, nullptr, &dict));
-                    options = to_map(&dict);
+                std::vector<Stream*> streams;
+                if (video_stream) {
+                    streams.push_back(&*video_stream);
                 }
-
-                {
-                    auto dict = to_dict(std::move(options));
-                    CASPAR_SCOPE_EXIT { av_dict_free(&dict); };
-                    FF(avformat_write_header(oc, &dict));
-                    options = to_map(&dict);
+                if (audio_stream) {
+                    streams.push_back(&*audio_stream);
                 }
 
+                // The muxer threads read the stream parameters, so they must be joined before the streams are
+                // destroyed.
+                CASPAR_SCOPE_EXIT
                 {
-                    for (auto& p : options) {
-                        CASPAR_LOG(warning) << print() << " Unused option " << p.first << "=" << p.second;
+                    for (auto& output : outputs) {
+                        output->close();
                     }
-                }
+                };
 
-                tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>> packet_buffer;
-                packet_buffer.set_capacity(realtime_ ? 1 : 128);
-                auto packet_thread = std::thread([&] {
-                    try {
-                        CASPAR_SCOPE_EXIT
-                        {
-                            if (!(oc->oformat->flags & AVFMT_NOFILE)) {
-                                FF(avio_closep(&oc->pb));
-                            }
-                        };
+                auto output_error_cb = [&](std::exception_ptr e, bool fatal) {
+                    if (fatal || --alive == 0) {
+                        set_exception(std::move(e));
+                    }
+                };
 
-                        std::map<int, int64_t> count;
+                for (auto n = 0; n < static_cast<int>(outputs.size()); ++n) {
+                    auto& output = outputs[n];
 
-                        std::shared_ptr<AVPacket> pkt;
-                        while (true) {
-                            packet_buffer.pop(pkt);
-                            if (!pkt) {
-                                break;
-                            }
-                            count[pkt->stream_index] += 1;
-                            FF(av_interleaved_write_frame(oc, pkt.get()));
-                        }
-
-                        auto video_st = video_stream ? video_stream->st : nullptr;
-                        auto audio_st = audio_stream ? audio_stream->st : nullptr;
+                    // Options given in brackets take precedence.
+                    output->options.insert(options.begin(), options.end());
 
-                        if ((!video_st || count[video_st->index]) && (!audio_st || count[audio_st->index])) {
-                            FF(av_write_trailer(oc));
-                        }
+                    const auto mux_time = n == 0 ? std::string("mux-time") : "mux-time-" + std::to_string(n);
+                    output->start(std::vector<const Stream*>(streams.begin(), streams.end()),
+                                  graph_,
+                                  mux_time,
+                                  format_desc.fps,
+                                  output_error_cb);
+                }
 
-                    } catch (...) {
-                        CASPAR_LOG_CURRENT_EXCEPTION();
-                        // TODO
-                        packet_buffer.abort();
+                auto packet_cb = [&](std::shared_ptr<AVPacket> pkt) {
+                    for (auto& output : outputs) {
+                        output->push(pkt);
                     }
-                });
+                };
+                auto error_cb = [this](std::exception_ptr e) { set_exception(std::move(e)); };
+
+                // Video and audio are filtered and encoded in separate stages, each output interleaves the packets
+                // on its own muxer thread.
+                if (video_stream) {
+                    video_stream->start(
+                        format_desc,
+                        realtime_ ? 2 : 64,
+                        packet_cb,
+                        [=](double elapsed) { graph_->set_value("video-time", elapsed * format_desc.fps * 0.5); },
+                        error_cb);
+                }
+                if (audio_stream) {
+                    audio_stream->start(
+                        format_desc,
+                        realtime_ ? 2 : 64,
+                        packet_cb,
+                        [=](double elapsed) { graph_->set_value("audio-time", elapsed * format_desc.fps * 0.5); },
+                        error_cb);
+                }
                 CASPAR_SCOPE_EXIT
                 {
-                    if (packet_thread.joinable()) {
-                        // TODO Is nullptr needed?
-                        packet_buffer.push(nullptr);
-                        packet_buffer.abort();
-                        packet_thread.join();
+                    for (auto stream : streams) {
+                        stream->stop();
                     }
                 };
 
-                auto packet_cb = [&](std::shared_ptr<AVPacket>&& pkt) { packet_buffer.push(std::move(pkt)); };
-
                 std::int32_t frame_number = 0;
                 while (true) {
                     {
@@ -649,30 +1019,24 @@ struct ffmpeg_consumer : public core::frame_consumer
                     graph_->set_value("input",
                                       static_cast<double>(frame_buffer_.size() + 0.001) / frame_buffer_.capacity());
 
-                    caspar::timer frame_timer;
-                    tbb::parallel_invoke(
-                        [&] {
-                            if (video_stream) {
-                                video_stream->send(frame, format_desc, packet_cb);
-                            }
-                        },
-                        [&] {
-                            if (audio_stream) {
-                                audio_stream->send(frame, format_desc, packet_cb);
-                            }
-                        });
-                    graph_->set_value("frame-time", frame_timer.elapsed() * format_desc.fps * 0.5);
+                    for (auto stream : streams) {
+                        stream->push(frame);
+                    }
 
                     if (!frame) {
-                        packet_buffer.push(nullptr);
                         break;
                     }
                 }
 
-                packet_thread.join();
+                for (auto stream : streams) {
+                    stream->join();
+                }
+
+                for (auto& output : outputs) {
+                    output->close();
+                }
             } catch (...) {
-                std::lock_guard<std::mutex> lock(exception_mutex_);
-                exception_ = std::current_exception();
+                set_exception(std::current_exception());
             }
         });
     }
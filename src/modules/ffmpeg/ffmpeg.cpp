@@ -24,13 +24,19 @@
 #include "ffmpeg.h"
 
 #include "consumer/ffmpeg_consumer.h"
+#include "media_index.h"
 #include "producer/ffmpeg_producer.h"
 
+#include <common/env.h>
 #include <common/log.h>
 
 #include <core/consumer/frame_consumer.h>
 #include <core/producer/frame_producer.h>
 
+#include <protocol/amcp/amcp_command_repository.h>
+
+#include <boost/property_tree/ptree.hpp>
+
 #include <mutex>
 
 #if defined(_MSC_VER)
@@ -160,6 +166,56 @@ void init(core::module_dependencies dependencies)
     dependencies.consumer_registry->register_preconfigured_consumer_factory(L"ffmpeg", create_preconfigured_consumer);
 
     dependencies.producer_registry->register_producer_factory(L"FFmpeg Producer", create_producer);
+
+    if (env::properties().get(L"configuration.ffmpeg.media-index", false)) {
+        // Modules register their commands before the built-in ones, so these replace the media-scanner requests.
+        auto index = std::make_shared<MediaIndex>();
+
+        // Until the first scan is done a listing would be missing files, so CLS and CINF reply once it is, off the
+        // command queue.
+        auto when_ready = [index](protocol::amcp::command_context& ctx, std::function<std::wstring()> reply) {
+            if (index->ready()) {
+                return reply();
+            }
+            ctx.deferred_reply = [index, reply] {
+                index->wait_ready();
+                return reply();
+            };
+            return std::wstring();
+        };
+
+        auto repo = dependencies.command_repository;
+        repo->register_command(
+            L"Query Commands",
+            L"CLS",
+            [index, when_ready](protocol::amcp::command_context& ctx) {
+                return when_ready(ctx, [index] { return L"200 CLS OK\r\n" + index->cls() + L"\r\n"; });
+            },
+            0);
+        repo->register_command(L"Query Commands",
+                               L"CINF",
+                               [index, when_ready](protocol::amcp::command_context& ctx) {
+                                   const auto name = ctx.parameters.at(0);
+                                   return when_ready(ctx, [index, name]() -> std::wstring {
+                                       auto info = index->cinf(name);
+                                       if (!info) {
+                                           return L"404 CINF ERROR\r\n";
+                                       }
+                                       return L"200 CINF OK\r\n" + *info + L"\r\n";
+                                   });
+                               },
+                               1);
+        repo->register_command(
+            L"Query Commands",
+            L"TLS",
+            [index](protocol::amcp::command_context&) { return L"200 TLS OK\r\n" + index->tls() + L"\r\n"; },
+            0);
+        repo->register_command(
+            L"Query Commands",
+            L"FLS",
+            [index](protocol::amcp::command_context&) { return L"200 FLS OK\r\n" + index->fls() + L"\r\n"; },
+            0);
+    }
 }
 
 void uninit()
@@ -0,0 +1,713 @@
+#include "media_index.h"
+
+#include <common/env.h>
+#include <common/log.h>
+#include <common/os/filesystem_monitor.h>
+#include <common/os/thread.h>
+#include <common/scope_exit.h>
+#include <common/utf.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#endif
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const std::string CACHE_HEADER = "CasparCG media index 1";
+
+const int PROBE_THREADS = 4;
+
+// Without change notifications, or once they may have been missed, the media folder is rescanned this often.
+// Unchanged files aren't probed again.
+const auto RESCAN_INTERVAL = std::chrono::seconds(10);
+
+const auto SAVE_INTERVAL = std::chrono::seconds(10);
+
+struct Entry
+{
+    uint64_t    size  = 0;
+    std::time_t mtime = 0;
+
+    // MOVIE, STILL or AUDIO. Empty if the file isn't media, so that it isn't probed again.
+    std::string type;
+    int64_t     frames    = 0;
+    AVRational  time_base = {0, 1};
+};
+
+struct File
+{
+    std::wstring path; // Relative to the media folder, with / separators.
+    uint64_t     size  = 0;
+    std::time_t  mtime = 0;
+};
+
+std::wstring relative_path(const fs::path& root, const fs::path& path)
+{
+    const auto& root_str = root.wstring();
+    const auto& str      = path.wstring();
+
+    auto result = str.substr(std::min(root_str.size(), str.size()));
+    std::replace(result.begin(), result.end(), L'\\', L'/');
+    while (!result.empty() && result.front() == L'/') {
+        result.erase(0, 1);
+    }
+    return result;
+}
+
+// Relative path without extension in upper case, which is how the media-scanner names files.
+std::wstring make_id(const std::wstring& path)
+{
+    return boost::to_upper_copy(fs::path(path).replace_extension().generic_wstring());
+}
+
+bool is_ignored(const fs::path& path)
+{
+    const auto name = path.filename().wstring();
+    return name.empty() || name[0] == L'.' || boost::icontains(name, L".keyframes");
+}
+
+std::wstring format_time(std::time_t time)
+{
+    std::tm tm = {};
+#ifdef _WIN32
+    localtime_s(&tm, &time);
+#else
+    localtime_r(&time, &tm);
+#endif
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d%H%M%S", &tm);
+    return u16(buffer);
+}
+
+std::wstring make_line(const std::wstring& id, const Entry& entry)
+{
+    return L"\"" + id + L"\"  " + u16(entry.type) + L"  " + std::to_wstring(entry.size) + L" " +
+           format_time(entry.mtime) + L" " + std::to_wstring(entry.frames) + L" " +
+           std::to_wstring(entry.time_base.num) + L"/" + std::to_wstring(entry.time_base.den) + L"\r\n";
+}
+
+Entry probe_file(const fs::path& path, const File& file, const std::atomic<bool>& abort)
+{
+    Entry entry;
+    entry.size  = file.size;
+    entry.mtime = file.mtime;
+
+    AVFormatContext* ic = avformat_alloc_context();
+    if (!ic) {
+        return entry;
+    }
+    ic->interrupt_callback.callback = [](void* opaque) -> int {
+        return static_cast<const std::atomic<bool>*>(opaque)->load() ? 1 : 0;
+    };
+    ic->interrupt_callback.opaque = const_cast<std::atomic<bool>*>(&abort);
+
+    // Frees ic on failure.
+    if (avformat_open_input(&ic, u8(path.wstring()).c_str(), nullptr, nullptr) < 0) {
+        return entry;
+    }
+    CASPAR_SCOPE_EXIT { avformat_close_input(&ic); };
+
+    if (avformat_find_stream_info(ic, nullptr) < 0) {
+        return entry;
+    }
+
+    AVStream* video = nullptr;
+    AVStream* audio = nullptr;
+    for (auto n = 0U; n < ic->nb_streams; ++n) {
+        const auto st = ic->streams[n];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && !(st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            video = video ? video : st;
+        } else if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            audio = audio ? audio : st;
+        }
+    }
+
+    const auto duration = ic->duration != AV_NOPTS_VALUE ? ic->duration : 0;
+    const auto format   = std::string(ic->iformat->name);
+
+    if (video && (format == "image2" || boost::ends_with(format, "_pipe"))) {
+        entry.type = "STILL";
+    } else if (video) {
+        entry.type           = "MOVIE";
+        const auto framerate = av_guess_frame_rate(ic, video, nullptr);
+        if (framerate.num > 0 && framerate.den > 0) {
+            entry.time_base = av_inv_q(framerate);
+            entry.frames    = av_rescale_q(duration, {1, AV_TIME_BASE}, entry.time_base);
+        }
+    } else if (audio) {
+        entry.type = "AUDIO";
+        if (audio->codecpar->sample_rate > 0) {
+            entry.time_base = {1, audio->codecpar->sample_rate};
+            entry.frames    = av_rescale_q(duration, {1, AV_TIME_BASE}, entry.time_base);
+        }
+    }
+
+    return entry;
+}
+
+void run_parallel(const std::function<void()>& func)
+{
+    std::vector<std::thread> threads;
+    for (auto n = 0; n < PROBE_THREADS; ++n) {
+        threads.emplace_back([&] {
+            try {
+                func();
+            } catch (...) {
+                CASPAR_LOG_CURRENT_EXCEPTION();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace
+
+struct MediaIndex::Impl
+{
+    const fs::path media_folder_    = env::media_folder();
+    const fs::path template_folder_ = env::template_folder();
+    const fs::path font_folder_ =
+        env::properties().get(L"configuration.paths.font-path", env::initial_folder() + L"/font/");
+    const fs::path cache_path_ = fs::path(env::data_folder()) / L"media-index.cache";
+
+    mutable std::mutex                           mutex_;
+    std::map<std::wstring, Entry>                media_;
+    bool                                         changed_       = false;
+    mutable bool                                 listing_dirty_ = true;
+    mutable std::wstring                         cls_;
+    mutable std::map<std::wstring, std::wstring> cinf_;
+    std::set<std::wstring>                       pending_;
+    std::condition_variable                      cond_;
+    bool                                         ready_ = false;
+    mutable std::condition_variable              ready_cond_;
+    std::atomic<bool>                            abort_{false};
+
+    mutable std::mutex   folders_mutex_;
+    mutable bool         templates_dirty_ = true;
+    mutable std::wstring tls_;
+    mutable bool         fonts_dirty_ = true;
+    mutable std::wstring fls_;
+
+    std::unique_ptr<filesystem_monitor> media_monitor_;
+    std::unique_ptr<filesystem_monitor> template_monitor_;
+    std::unique_ptr<filesystem_monitor> font_monitor_;
+    std::thread                         thread_;
+
+    Impl()
+    {
+        load();
+
+        media_monitor_ = filesystem_monitor::create(media_folder_.wstring(), [this](const std::wstring& path) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.insert(path);
+            cond_.notify_one();
+        });
+        template_monitor_ = filesystem_monitor::create(template_folder_.wstring(), [this](const std::wstring&) {
+            std::lock_guard<std::mutex> lock(folders_mutex_);
+            templates_dirty_ = true;
+        });
+        if (fs::is_directory(font_folder_)) {
+            font_monitor_ = filesystem_monitor::create(font_folder_.wstring(), [this](const std::wstring&) {
+                std::lock_guard<std::mutex> lock(folders_mutex_);
+                fonts_dirty_ = true;
+            });
+        }
+
+        thread_ = std::thread([this] {
+            set_thread_name(L"[ffmpeg::MediaIndex]");
+            run();
+        });
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            abort_ = true;
+            cond_.notify_all();
+        }
+        thread_.join();
+        set_ready();
+
+        media_monitor_.reset();
+        template_monitor_.reset();
+        font_monitor_.reset();
+
+        try {
+            save();
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+        }
+    }
+
+    static bool is_watched(const std::unique_ptr<filesystem_monitor>& monitor)
+    {
+        return monitor && monitor->healthy();
+    }
+
+    void set_ready()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_ = true;
+        ready_cond_.notify_all();
+    }
+
+    void run()
+    {
+        try {
+            scan(media_folder_);
+            save();
+            CASPAR_LOG(info) << L"[ffmpeg::MediaIndex] Indexed " << media_folder_.wstring() << L".";
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+        }
+        set_ready();
+
+        auto last_save  = std::chrono::steady_clock::now();
+        auto rescanning = !is_watched(media_monitor_);
+
+        while (!abort_) {
+            std::set<std::wstring> pending;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (!rescanning) {
+                    // Woken regularly to notice if the monitor stops reporting changes.
+                    cond_.wait_for(lock, RESCAN_INTERVAL, [&] { return abort_ || !pending_.empty(); });
+
+                    if (!is_watched(media_monitor_)) {
+                        CASPAR_LOG(warning) << L"[ffmpeg::MediaIndex] Changes to " << media_folder_.wstring()
+                                            << L" may have been missed, rescanning it periodically.";
+                        rescanning = true;
+                    }
+                } else {
+                    cond_.wait_for(lock, RESCAN_INTERVAL, [&] { return abort_.load(); });
+                }
+
+                if (rescanning) {
+                    pending_.insert(media_folder_.wstring());
+                } else if (pending_.empty()) {
+                    continue;
+                }
+
+                // Coalesce bursts of changes, e.g. while a folder is being copied.
+                cond_.wait_for(lock, std::chrono::milliseconds(500), [&] { return abort_.load(); });
+                std::swap(pending, pending_);
+            }
+
+            for (auto& path : pending) {
+                if (abort_) {
+                    break;
+                }
+                try {
+                    update(path);
+                } catch (...) {
+                    CASPAR_LOG_CURRENT_EXCEPTION();
+                }
+            }
+
+            if (std::chrono::steady_clock::now() - last_save > SAVE_INTERVAL) {
+                try {
+                    save();
+                } catch (...) {
+                    CASPAR_LOG_CURRENT_EXCEPTION();
+                }
+                last_save = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    void update(const fs::path& path)
+    {
+        boost::system::error_code ec;
+        const auto                status = fs::status(path, ec);
+
+        if (fs::is_directory(status)) {
+            scan(path);
+        } else if (fs::is_regular_file(status)) {
+            if (is_ignored(path)) {
+                return;
+            }
+
+            File file;
+            file.path  = relative_path(media_folder_, path);
+            file.size  = fs::file_size(path, ec);
+            file.mtime = fs::last_write_time(path, ec);
+            if (!ec && !is_current(file)) {
+                probe({file});
+            }
+        } else {
+            remove(relative_path(media_folder_, path));
+        }
+    }
+
+    bool is_current(const File& file) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        const auto it = media_.find(file.path);
+        return it != media_.end() && it->second.size == file.size && it->second.mtime == file.mtime;
+    }
+
+    // Probes new and changed files below folder, and removes files which are gone.
+    void scan(const fs::path& folder)
+    {
+        auto files = walk(folder);
+        if (abort_) {
+            return;
+        }
+
+        std::vector<File> stale;
+        for (auto& file : files) {
+            if (!is_current(file)) {
+                stale.push_back(file);
+            }
+        }
+
+        {
+            std::set<std::wstring> present;
+            for (auto& file : files) {
+                present.insert(file.path);
+            }
+
+            auto prefix = relative_path(media_folder_, folder);
+            if (!prefix.empty()) {
+                prefix += L"/";
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = media_.lower_bound(prefix); it != media_.end() && boost::starts_with(it->first, prefix);) {
+                if (present.find(it->first) == present.end()) {
+                    it             = media_.erase(it);
+                    changed_       = true;
+                    listing_dirty_ = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        probe(stale);
+    }
+
+    void remove(const std::wstring& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto it = media_.lower_bound(path); it != media_.end() && boost::starts_with(it->first, path);) {
+            if (it->first.size() == path.size() || it->first[path.size()] == L'/') {
+                it             = media_.erase(it);
+                changed_       = true;
+                listing_dirty_ = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Lists the files below folder, walking sub folders in parallel.
+    std::vector<File> walk(const fs::path& folder)
+    {
+        std::mutex              mutex;
+        std::condition_variable cond;
+        std::vector<fs::path>   folders{folder};
+        std::vector<File>       files;
+        int                     busy = 0;
+
+        run_parallel([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cond.wait(lock, [&] { return !folders.empty() || busy == 0; });
+                if (folders.empty() || abort_) {
+                    cond.notify_all();
+                    return;
+                }
+
+                const auto current = std::move(folders.back());
+                folders.pop_back();
+                busy += 1;
+                lock.unlock();
+
+                std::vector<fs::path> found_folders;
+                std::vector<File>     found_files;
+
+                boost::system::error_code ec;
+                for (auto it = fs::directory_iterator(current, ec); !ec && it != fs::directory_iterator();
+                     it.increment(ec)) {
+                    const auto& path = it->path();
+                    if (is_ignored(path)) {
+                        continue;
+                    }
+
+                    boost::system::error_code ec2;
+                    const auto                status = it->status(ec2);
+                    if (fs::is_directory(status)) {
+                        found_folders.push_back(path);
+                    } else if (fs::is_regular_file(status)) {
+                        File file;
+                        file.path  = relative_path(media_folder_, path);
+                        file.size  = fs::file_size(path, ec2);
+                        file.mtime = fs::last_write_time(path, ec2);
+                        if (!ec2) {
+                            found_files.push_back(std::move(file));
+                        }
+                    }
+                }
+
+                lock.lock();
+                busy -= 1;
+                folders.insert(folders.end(), found_folders.begin(), found_folders.end());
+                files.insert(files.end(), found_files.begin(), found_files.end());
+                cond.notify_all();
+            }
+        });
+
+        return files;
+    }
+
+    void probe(const std::vector<File>& files)
+    {
+        if (files.empty()) {
+            return;
+        }
+
+        CASPAR_LOG(debug) << L"[ffmpeg::MediaIndex] Probing " << files.size() << L" files.";
+
+        std::atomic<std::size_t> next{0};
+        run_parallel([&] {
+            for (auto n = next++; n < files.size() && !abort_; n = next++) {
+                auto entry = probe_file(media_folder_ / files[n].path, files[n], abort_);
+                if (abort_) {
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                media_[files[n].path] = std::move(entry);
+                changed_              = true;
+                listing_dirty_        = true;
+            }
+        });
+    }
+
+    void load()
+    {
+        boost::filesystem::ifstream file(cache_path_, std::ios::binary);
+        if (!file) {
+            return;
+        }
+
+        std::string line;
+        if (!std::getline(file, line) || line != CACHE_HEADER) {
+            CASPAR_LOG(warning) << L"[ffmpeg::MediaIndex] Ignoring invalid cache " << cache_path_.wstring() << L".";
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (std::getline(file, line)) {
+            std::istringstream str(line);
+
+            Entry       entry;
+            std::string path;
+            str >> entry.size >> entry.mtime >> entry.type >> entry.frames >> entry.time_base.num >>
+                entry.time_base.den;
+            str.get();
+            std::getline(str, path);
+
+            if (!str || path.empty()) {
+                continue;
+            }
+            if (entry.type == "-") {
+                entry.type.clear();
+            }
+            media_[u16(path)] = std::move(entry);
+        }
+
+        CASPAR_LOG(info) << L"[ffmpeg::MediaIndex] Loaded " << media_.size() << L" files from "
+                         << cache_path_.wstring() << L".";
+    }
+
+    void save()
+    {
+        std::vector<std::pair<std::wstring, Entry>> entries;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!changed_) {
+                return;
+            }
+            entries.assign(media_.begin(), media_.end());
+            changed_ = false;
+        }
+
+        // Written to a temporary file first, so that a crash can't leave a truncated cache behind.
+        const auto tmp = fs::path(cache_path_).concat(L".tmp");
+        {
+            boost::filesystem::ofstream file(tmp, std::ios::trunc | std::ios::binary);
+            file << CACHE_HEADER << "\n";
+            for (auto& p : entries) {
+                const auto& entry = p.second;
+                file << entry.size << "\t" << entry.mtime << "\t" << (entry.type.empty() ? "-" : entry.type) << "\t"
+                     << entry.frames << "\t" << entry.time_base.num << "\t" << entry.time_base.den << "\t"
+                     << u8(p.first) << "\n";
+            }
+            if (!file) {
+                CASPAR_LOG(warning) << L"[ffmpeg::MediaIndex] Failed to write " << tmp.wstring() << L".";
+                return;
+            }
+        }
+
+        boost::system::error_code ec;
+        fs::rename(tmp, cache_path_, ec);
+        if (ec) {
+            CASPAR_LOG(warning) << L"[ffmpeg::MediaIndex] Failed to write " << cache_path_.wstring() << L".";
+        }
+    }
+
+    void update_listing() const
+    {
+        if (!listing_dirty_) {
+            return;
+        }
+
+        cinf_.clear();
+        for (auto& p : media_) {
+            if (!p.second.type.empty()) {
+                const auto id = make_id(p.first);
+                cinf_[id] += make_line(id, p.second);
+            }
+        }
+
+        cls_.clear();
+        for (auto& p : cinf_) {
+            cls_ += p.second;
+        }
+
+        listing_dirty_ = false;
+    }
+
+    bool ready() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ready_;
+    }
+
+    void wait_ready() const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_cond_.wait(lock, [&] { return ready_; });
+    }
+
+    std::wstring cls() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        update_listing();
+        return cls_;
+    }
+
+    boost::optional<std::wstring> cinf(const std::wstring& name) const
+    {
+        auto id = boost::to_upper_copy(name);
+        std::replace(id.begin(), id.end(), L'\\', L'/');
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        update_listing();
+
+        const auto it = cinf_.find(id);
+        if (it == cinf_.end()) {
+            return boost::none;
+        }
+        return it->second;
+    }
+
+    static std::wstring list_folder(const fs::path& folder, const std::function<bool(const fs::path&)>& filter)
+    {
+        std::set<std::wstring> ids;
+
+        boost::system::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(folder, ec); !ec && it != fs::recursive_directory_iterator();
+             it.increment(ec)) {
+            if (fs::is_regular_file(it->status()) && !is_ignored(it->path()) && filter(it->path())) {
+                ids.insert(make_id(relative_path(folder, it->path())));
+            }
+        }
+
+        std::wstring result;
+        for (auto& id : ids) {
+            result += id + L"\r\n";
+        }
+        return result;
+    }
+
+    std::wstring tls() const
+    {
+        std::lock_guard<std::mutex> lock(folders_mutex_);
+        if (templates_dirty_ || !is_watched(template_monitor_)) {
+            tls_ = list_folder(template_folder_, [](const fs::path& path) {
+                const auto ext = boost::to_lower_copy(path.extension().wstring());
+                return ext == L".ft" || ext == L".wt" || ext == L".ct" || ext == L".html";
+            });
+            templates_dirty_ = false;
+        }
+        return tls_;
+    }
+
+    std::wstring fls() const
+    {
+        std::lock_guard<std::mutex> lock(folders_mutex_);
+        if (fonts_dirty_ || !is_watched(font_monitor_)) {
+            fls_         = list_folder(font_folder_, [](const fs::path&) { return true; });
+            fonts_dirty_ = false;
+        }
+        return fls_;
+    }
+};
+
+MediaIndex::MediaIndex()
+    : impl_(new Impl())
+{
+}
+
+MediaIndex::~MediaIndex() {}
+
+bool MediaIndex::ready() const { return impl_->ready(); }
+
+void MediaIndex::wait_ready() const { impl_->wait_ready(); }
+
+std::wstring MediaIndex::cls() const { return impl_->cls(); }
+
+boost::optional<std::wstring> MediaIndex::cinf(const std::wstring& name) const { return impl_->cinf(name); }
+
+std::wstring MediaIndex::tls() const { return impl_->tls(); }
+
+std::wstring MediaIndex::fls() const { return impl_->fls(); }
+
+}} // namespace caspar::ffmpeg
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <boost/optional.hpp>
+
+#include <memory>
+#include <string>
+
+namespace caspar { namespace ffmpeg {
+
+// Answers CLS, CINF, TLS and FLS from memory, in the format of the media-scanner. The media folder is probed in the
+// background and kept current through change notifications, or by periodic rescans where changes may be missed.
+// Probe results are persisted in the data folder, so after a restart only files which changed are probed again.
+// Listings may be incomplete until the first scan is done, see ready.
+class MediaIndex
+{
+  public:
+    MediaIndex();
+    ~MediaIndex();
+
+    // Whether the first scan of the media folder is done.
+    bool ready() const;
+    void wait_ready() const;
+
+    // Listing lines, each ending with \r\n.
+    std::wstring                  cls() const;
+    boost::optional<std::wstring> cinf(const std::wstring& name) const;
+    std::wstring                  tls() const;
+    std::wstring                  fls() const;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}} // namespace caspar::ffmpeg
@@ -1,17 +1,27 @@
 #include "av_input.h"
+#include "file_reader.h"
 
 #include "../util/av_assert.h"
 #include "../util/av_util.h"
 
+#include <common/env.h>
 #include <common/except.h>
+#include <common/executor.h>
 #include <common/os/thread.h>
 #include <common/param.h>
 #include <common/scope_exit.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/format.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/property_tree/ptree.hpp>
 
+#include <functional>
 #include <set>
+#include <sstream>
+#include <string>
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -26,9 +36,77 @@ extern "C" {
 
 namespace caspar { namespace ffmpeg {
 
-Input::Input(const std::string& filename, std::shared_ptr<diagnostics::graph> graph, boost::optional<bool> seekable)
+namespace {
+
+const AVRational TIME_BASE_Q = {1, AV_TIME_BASE};
+
+const char* const INDEX_HEADER = "CasparCG keyframe index 2";
+
+// Keyframes further apart than this are not trusted to be neighbours, the index is built from whatever was read.
+const int64_t MAX_INDEX_GAP = 10 * AV_TIME_BASE;
+
+// Indexes are kept in a folder of their own, named by a hash of the full path of the file which is also stored in the
+// index, so nothing is written next to the media.
+boost::filesystem::path index_path(const boost::filesystem::path& path)
+{
+    static const auto folder = [] {
+        boost::filesystem::path result =
+            env::properties().get(L"configuration.ffmpeg.producer.keyframe-index-path", L"keyframes");
+        if (!result.is_complete()) {
+            result = env::data_folder() + result.wstring();
+        }
+        return result;
+    }();
+
+    return folder / ((boost::format("%016x.keyframes") % std::hash<std::wstring>()(path.wstring())).str());
+}
+
+// Index files are written on a thread of their own, off the producer's construction and destruction.
+executor& index_writer()
+{
+    static executor writer(L"ffmpeg keyframe index");
+    return writer;
+}
+
+void write_index(const boost::filesystem::path& path, int stream, AVRational time_base, const std::string& entries)
+{
+    try {
+        const auto index = index_path(path);
+        boost::filesystem::create_directories(index.parent_path());
+
+        // Written aside and moved into place, other producers may be reading it.
+        const auto tmp = boost::filesystem::path(index).concat(boost::filesystem::unique_path(L".%%%%%%%%").wstring());
+        {
+            boost::filesystem::ofstream file(tmp, std::ios::trunc);
+            file << INDEX_HEADER << "\n";
+            file << u8(path.wstring()) << "\n";
+            file << boost::filesystem::file_size(path) << " " << boost::filesystem::last_write_time(path) << " "
+                 << stream << " " << time_base.num << " " << time_base.den << "\n";
+            file << entries;
+            if (!file) {
+                CASPAR_LOG(warning) << L"av_input[" << path.wstring() << L"] Failed to write keyframe index.";
+                boost::system::error_code ec;
+                boost::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        boost::filesystem::rename(tmp, index);
+    } catch (...) {
+        CASPAR_LOG_CURRENT_EXCEPTION();
+    }
+}
+
+} // namespace
+
+Input::Input(const std::string&                  filename,
+             av_pool                             pool,
+             std::shared_ptr<diagnostics::graph> graph,
+             boost::optional<bool>               seekable,
+             std::function<void()>               notify)
     : filename_(filename)
+    , pool_(std::move(pool))
     , graph_(graph)
+    , notify_(std::move(notify))
     , seekable_(seekable)
 {
     graph_->set_color("seek", diagnostics::color(1.0f, 0.5f, 0.0f));
@@ -40,7 +118,8 @@ Input::Input(const std::string& filename, std::shared_ptr<diagnostics::graph> gr
             set_thread_name(L"[ffmpeg::av_producer::Input]");
 
             while (true) {
-                auto packet = alloc_packet();
+                auto packet = pool_.alloc_packet();
+                auto serial = 0;
 
                 {
                     std::unique_lock<std::mutex> lock(ic_mutex_);
@@ -50,6 +129,8 @@ Input::Input(const std::string& filename, std::shared_ptr<diagnostics::graph> gr
                         break;
                     }
 
+                    serial = serial_;
+
                     // TODO (perf) Non blocking av_read_frame when possible.
                     auto ret = av_read_frame(ic_.get(), packet.get());
 
@@ -60,11 +141,16 @@ Input::Input(const std::string& filename, std::shared_ptr<diagnostics::graph> gr
                         packet = nullptr;
                     } else {
                         FF_RET(ret, "av_read_frame");
+                        index_packet(*packet);
                     }
                 }
 
-                buffer_.push(std::move(packet));
+                buffer_.push(std::make_pair(serial, std::move(packet)));
                 graph_->set_value("input", (static_cast<double>(buffer_.size()) / buffer_.capacity()));
+
+                if (notify_) {
+                    notify_();
+                }
             }
         } catch (...) {
             CASPAR_LOG_CURRENT_EXCEPTION();
@@ -78,11 +164,13 @@ Input::~Input()
     abort_request_ = true;
     ic_cond_.notify_all();
 
-    std::shared_ptr<AVPacket> packet;
+    std::pair<int, std::shared_ptr<AVPacket>> packet;
     while (buffer_.try_pop(packet))
         ;
 
     thread_.join();
+
+    save_index();
 }
 
 int Input::interrupt_cb(void* ctx)
@@ -93,7 +181,17 @@ int Input::interrupt_cb(void* ctx)
 
 bool Input::try_pop(std::shared_ptr<AVPacket>& packet)
 {
-    auto result = buffer_.try_pop(packet);
+    const int serial = serial_;
+
+    std::pair<int, std::shared_ptr<AVPacket>> entry;
+    auto                                      result = false;
+    while ((result = buffer_.try_pop(entry)) && entry.first != serial)
+        ;
+
+    if (result) {
+        packet = std::move(entry.second);
+    }
+
     graph_->set_value("input", (static_cast<double>(buffer_.size()) / buffer_.capacity()));
     return result;
 }
@@ -106,7 +204,7 @@ void Input::abort()
     abort_request_ = true;
     ic_cond_.notify_all();
 
-    std::shared_ptr<AVPacket> packet;
+    std::pair<int, std::shared_ptr<AVPacket>> packet;
     while (buffer_.try_pop(packet))
         ;
 }
@@ -139,22 +237,37 @@ void Input::internal_reset()
         filename_    = u8(url_parts.second);
     }
 
+    const AVIOInterruptCB interrupt = {Input::interrupt_cb, this};
+
+    // Local files are read ahead by a reader of our own instead of FFmpeg's file protocol.
+    std::shared_ptr<FileReader> reader;
+    if (input_format == nullptr && (url_parts.first.empty() || url_parts.first == L"file")) {
+        reader = FileReader::open(u8(url_parts.second), !seekable_ || *seekable_, interrupt, graph_);
+    }
+
     if (seekable_) {
         CASPAR_LOG(debug) << "av_input[" + filename_ + "] Disabled seeking";
-        FF(av_dict_set(&options, "seekable", *seekable_ ? "1" : "0", 0));
+        if (!reader) {
+            FF(av_dict_set(&options, "seekable", *seekable_ ? "1" : "0", 0));
+        }
     }
 
-    if (input_format == nullptr) {
+    if (input_format == nullptr && !reader) {
         // TODO (fix) timeout?
         FF(av_dict_set(&options, "rw_timeout", "60000000", 0)); // 60 second IO timeout
     }
 
-    AVFormatContext* ic             = avformat_alloc_context();
-    ic->interrupt_callback.callback = Input::interrupt_cb;
-    ic->interrupt_callback.opaque   = this;
+    AVFormatContext* ic    = avformat_alloc_context();
+    ic->interrupt_callback = interrupt;
+    if (reader) {
+        ic->pb = reader->context();
+        ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
 
     FF(avformat_open_input(&ic, filename_.c_str(), input_format, &options));
-    auto ic2 = std::shared_ptr<AVFormatContext>(ic, [](AVFormatContext* ctx) { avformat_close_input(&ctx); });
+    // The reader is released after the format context, which reads through it until closed.
+    auto ic2 =
+        std::shared_ptr<AVFormatContext>(ic, [reader](AVFormatContext* ctx) { avformat_close_input(&ctx); });
 
     for (auto& p : to_map(&options)) {
         CASPAR_LOG(warning) << "av_input[" + filename_ + "]"
@@ -163,29 +276,154 @@ void Input::internal_reset()
 
     FF(avformat_find_stream_info(ic2.get(), nullptr));
     ic_ = std::move(ic2);
+    load_index();
     ic_cond_.notify_all();
 }
 
+void Input::index_packet(const AVPacket& packet)
+{
+    if (!generic_seek_ || packet.stream_index != video_stream_ || !(packet.flags & AV_PKT_FLAG_KEY) ||
+        packet.dts == AV_NOPTS_VALUE || packet.pos < 0) {
+        return;
+    }
+
+    av_add_index_entry(ic_->streams[video_stream_], packet.pos, packet.dts, 0, 0, AVINDEX_KEYFRAME);
+}
+
+void Input::load_index()
+{
+    video_stream_ = av_find_best_stream(ic_.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    generic_seek_ = video_stream_ >= 0 && !ic_->iformat->read_seek && !ic_->iformat->read_seek2;
+    keep_index_   = generic_seek_ && !boost::contains(filename_, "://") &&
+                  env::properties().get(L"configuration.ffmpeg.producer.keyframe-index", false);
+    index_size_ = 0;
+
+    if (!keep_index_) {
+        return;
+    }
+
+    try {
+        const auto path = boost::filesystem::absolute(u16(filename_));
+        const auto st   = ic_->streams[video_stream_];
+
+        boost::filesystem::ifstream file(index_path(path));
+        std::string                 header;
+        std::string                 indexed;
+        if (!std::getline(file, header) || header != INDEX_HEADER || !std::getline(file, indexed) ||
+            indexed != u8(path.wstring())) {
+            return;
+        }
+
+        std::uintmax_t size   = 0;
+        std::time_t    mtime  = 0;
+        int            stream = 0;
+        AVRational     tb     = {0, 1};
+        if (!(file >> size >> mtime >> stream >> tb.num >> tb.den) || size != boost::filesystem::file_size(path) ||
+            mtime != boost::filesystem::last_write_time(path) || stream != video_stream_ ||
+            av_cmp_q(tb, st->time_base) != 0) {
+            CASPAR_LOG(debug) << "av_input[" + filename_ + "] Ignoring outdated keyframe index.";
+            return;
+        }
+
+        int64_t timestamp = 0;
+        int64_t pos       = 0;
+        while (file >> timestamp >> pos) {
+            av_add_index_entry(st, pos, timestamp, 0, 0, AVINDEX_KEYFRAME);
+        }
+        index_size_ = st->nb_index_entries;
+
+        CASPAR_LOG(debug) << "av_input[" + filename_ + "] Loaded " << index_size_ << " keyframes.";
+    } catch (...) {
+        CASPAR_LOG_CURRENT_EXCEPTION();
+    }
+}
+
+void Input::save_index()
+{
+    std::lock_guard<std::mutex> lock(ic_mutex_);
+
+    if (!ic_ || !keep_index_ || ic_->streams[video_stream_]->nb_index_entries <= index_size_) {
+        return;
+    }
+
+    const auto st = ic_->streams[video_stream_];
+
+    std::ostringstream entries;
+    for (auto n = 0; n < st->nb_index_entries; ++n) {
+        const auto& entry = st->index_entries[n];
+        if (entry.flags & AVINDEX_KEYFRAME) {
+            entries << entry.timestamp << " " << entry.pos << "\n";
+        }
+    }
+    index_size_ = st->nb_index_entries;
+
+    index_writer().begin_invoke([path      = boost::filesystem::absolute(u16(filename_)),
+                                 stream    = video_stream_,
+                                 time_base = st->time_base,
+                                 entries   = entries.str()] { write_index(path, stream, time_base, entries); });
+}
+
+int64_t Input::keyframe(int64_t ts) const
+{
+    std::lock_guard<std::mutex> lock(ic_mutex_);
+
+    if (!ic_ || video_stream_ < 0 || ts == AV_NOPTS_VALUE) {
+        return AV_NOPTS_VALUE;
+    }
+
+    const auto st = ic_->streams[video_stream_];
+    const auto n  = av_index_search_timestamp(st, av_rescale_q(ts, TIME_BASE_Q, st->time_base), AVSEEK_FLAG_BACKWARD);
+    return n >= 0 ? av_rescale_q(st->index_entries[n].timestamp, st->time_base, TIME_BASE_Q) : AV_NOPTS_VALUE;
+}
+
+bool Input::seek_index(int64_t ts)
+{
+    if (!generic_seek_) {
+        return false;
+    }
+
+    const auto st = ic_->streams[video_stream_];
+    const auto n  = av_index_search_timestamp(st, av_rescale_q(ts, TIME_BASE_Q, st->time_base), AVSEEK_FLAG_BACKWARD);
+
+    // Only if the keyframe is known to be the last one before ts, otherwise searching may land closer.
+    const auto max_gap = av_rescale_q(MAX_INDEX_GAP, TIME_BASE_Q, st->time_base);
+    if (n < 0 || n + 1 >= st->nb_index_entries ||
+        st->index_entries[n + 1].timestamp - st->index_entries[n].timestamp > max_gap) {
+        return false;
+    }
+
+    const auto& entry = st->index_entries[n];
+    if (entry.pos >= 0 && !(ic_->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+        return avformat_seek_file(ic_.get(), -1, entry.pos, entry.pos, entry.pos, AVSEEK_FLAG_BYTE) >= 0;
+    }
+    return avformat_seek_file(ic_.get(), video_stream_, INT64_MIN, entry.timestamp, entry.timestamp, 0) >= 0;
+}
+
 bool Input::eof() const { return eof_; }
 
-void Input::seek(int64_t ts, bool flush)
+bool Input::seek(int64_t ts, bool flush)
 {
     std::unique_lock<std::mutex> lock(ic_mutex_);
 
-    if (ic_ && ts != ic_->start_time && ts != AV_NOPTS_VALUE) {
-        FF(avformat_seek_file(ic_.get(), -1, INT64_MIN, ts, ts, 0));
-    } else {
+    // Seek in place when possible, so that streams (and decoders referring to them) stay valid.
+    auto in_place = ic_ && ts != AV_NOPTS_VALUE &&
+                    (seek_index(ts) || avformat_seek_file(ic_.get(), -1, INT64_MIN, ts, ts, 0) >= 0);
+    if (!in_place) {
         internal_reset();
     }
 
     if (flush) {
-        std::shared_ptr<AVPacket> packet;
+        serial_ += 1;
+
+        std::pair<int, std::shared_ptr<AVPacket>> packet;
         while (buffer_.try_pop(packet))
             ;
     }
     eof_ = false;
 
     graph_->set_tag(diagnostics::tag_severity::INFO, "seek");
+
+    return in_place;
 }
 
 }} // namespace caspar::ffmpeg
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../util/av_util.h"
+
 #include <common/diagnostics/graph.h>
 
 #include <atomic>
@@ -11,6 +13,7 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <utility>
 
 #include <tbb/concurrent_queue.h>
 
@@ -24,7 +27,11 @@ namespace caspar { namespace ffmpeg {
 class Input
 {
   public:
-    Input(const std::string& filename, std::shared_ptr<diagnostics::graph> graph, boost::optional<bool> seekable);
+    Input(const std::string&                  filename,
+          av_pool                             pool,
+          std::shared_ptr<diagnostics::graph> graph,
+          boost::optional<bool>               seekable,
+          std::function<void()>               notify = nullptr);
     ~Input();
 
     static int interrupt_cb(void* ctx);
@@ -38,21 +45,39 @@ class Input
     void reset();
     void abort();
     bool eof() const;
-    void seek(int64_t ts, bool flush = true);
+    bool seek(int64_t ts, bool flush = true);
+
+    // Time of the last known keyframe of the video stream at or before ts (AV_TIME_BASE units), or AV_NOPTS_VALUE.
+    int64_t keyframe(int64_t ts) const;
 
   private:
     void internal_reset();
+    bool seek_index(int64_t ts);
+    void index_packet(const AVPacket& packet);
+    void load_index();
+    void save_index();
 
     boost::optional<bool> seekable_;
 
     std::string                         filename_;
+    av_pool                             pool_;
     std::shared_ptr<diagnostics::graph> graph_;
+    std::function<void()>               notify_;
 
     mutable std::mutex               ic_mutex_;
     std::shared_ptr<AVFormatContext> ic_;
     std::condition_variable          ic_cond_;
 
-    tbb::concurrent_bounded_queue<std::shared_ptr<AVPacket>> buffer_;
+    // Formats without a seek function of their own are searched using the stream index, which can be kept in the
+    // keyframe index path so that it survives the producer. It is handed to a writer thread when the input closes.
+    int  video_stream_ = -1;
+    bool generic_seek_ = false;
+    bool keep_index_   = false;
+    int  index_size_   = 0;
+
+    // Packets are tagged with the seek serial they were read under, so that packets read before a seek are dropped.
+    std::atomic<int>                                                         serial_{0};
+    tbb::concurrent_bounded_queue<std::pair<int, std::shared_ptr<AVPacket>>> buffer_;
 
     std::atomic<bool> eof_{false};
 
@@ -1,8 +1,10 @@
 #include "av_producer.h"
 
 #include "av_input.h"
+#include "frame_cache.h"
 
 #include "../util/av_assert.h"
+#include "../util/av_scheduler.h"
 #include "../util/av_util.h"
 
 #include <boost/exception/exception.hpp>
@@ -14,13 +16,15 @@
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include <tbb/concurrent_queue.h>
+#include <tbb/parallel_invoke.h>
+
 #include <common/diagnostics/graph.h>
 #include <common/env.h>
 #include <common/except.h>
 #include <common/os/thread.h>
 #include <common/scope_exit.h>
 #include <common/timer.h>
-#include <common/executor.h>
 
 #include <core/frame/draw_frame.h>
 #include <core/frame/frame_factory.h>
@@ -48,17 +52,25 @@ extern "C" {
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <deque>
+#include <functional>
 #include <iomanip>
 #include <memory>
 #include <queue>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
 
 namespace caspar { namespace ffmpeg {
 
 const AVRational TIME_BASE_Q = {1, AV_TIME_BASE};
 
+// Frames buffered after a seek before next_frame starts delivering them.
+const std::size_t PREROLL_FRAMES = 4;
+
 struct Frame
 {
     std::shared_ptr<AVFrame> video;
@@ -83,24 +95,223 @@ class Decoder
 
     std::queue<std::shared_ptr<AVPacket>> input;
     mutable boost::mutex input_mutex;
-    boost::condition_variable input_cond;
     int input_capacity = 2;
+    std::atomic<int> input_size = { 0 };
+    int64_t next_loop_start = AV_NOPTS_VALUE;
+    int64_t next_loop_length = 0;
+    int64_t next_skip_until = AV_NOPTS_VALUE;
 
-    std::queue<std::shared_ptr<AVFrame>> output;
-    mutable boost::mutex output_mutex;
-    boost::condition_variable output_cond;
+    // Single producer (decode task), single consumer (scheduler). Decoding pauses while it is full.
+    tbb::concurrent_bounded_queue<std::shared_ptr<AVFrame>> output;
     int output_capacity = 8;
 
-    boost::thread thread;
+    // Set while a flush is in flight, frames decoded meanwhile are dropped.
+    std::atomic<bool> flushing = { false };
+    boost::mutex flush_mutex;
+    boost::condition_variable flush_cond;
+
+    // Decode state, only touched by the running decode task. Once looping, frames are trimmed to
+    // [loop_start, loop_end) and offset by the length of the preceding passes.
+    std::shared_ptr<AVFrame> pending;
+    bool draining = false;
+    int64_t loop_offset = 0;
+    int64_t loop_start = AV_NOPTS_VALUE;
+    int64_t loop_end = AV_NOPTS_VALUE;
+    // Video frames that end before this aren't shown and are only decoded if later frames refer to them.
+    int64_t skip_until = AV_NOPTS_VALUE;
+
+    // Number of times the decode task has been requested since it last ran out of work, see schedule().
+    std::atomic<int> scheduled = { 0 };
+    std::atomic<bool> aborted = { false };
+
+    av_pool pool;
+    frame_allocator allocator;
+
+    // Called whenever the decoder has taken a packet or produced a frame.
+    std::function<void()> notify;
+    std::function<av_priority()> priority;
+
+    void ready() const
+    {
+        if (notify) {
+            notify();
+        }
+    }
+
+    // Runs the decode task on the shared workers. If it is already queued or running, that run picks up the new
+    // work before it returns, so at most one runs at a time.
+    void schedule()
+    {
+        if (scheduled++ == 0) {
+            av_enqueue(priority ? priority() : av_priority::normal, [this] { run(); });
+        }
+    }
+
+    void run()
+    {
+        auto requests = scheduled.load();
+        do {
+            if (!aborted) {
+                try {
+                    decode();
+                } catch (...) {
+                    CASPAR_LOG_CURRENT_EXCEPTION();
+                    // End the stream rather than stalling the producer.
+                    eof = true;
+                    ready();
+                }
+            }
+            // Nothing may be touched once this reaches zero, the destructor waits for it.
+        } while ((requests = scheduled -= requests) != 0);
+    }
+
+    // Decodes until out of packets or out of room. Pushing packets and popping frames schedule it again.
+    void decode()
+    {
+        while (!aborted) {
+            if (pending) {
+                if (flushing) {
+                    pending = nullptr;
+                } else if (output.try_push(pending)) {
+                    pending = nullptr;
+                    ready();
+                } else {
+                    return;
+                }
+            }
+
+            auto av_frame = pool.alloc_frame();
+            auto ret = avcodec_receive_frame(ctx.get(), av_frame.get());
+
+            if (ret == AVERROR(EAGAIN)) {
+                std::shared_ptr<AVPacket> packet;
+                int64_t                   start  = AV_NOPTS_VALUE;
+                int64_t                   length = 0;
+                int64_t                   skip   = AV_NOPTS_VALUE;
+                {
+                    boost::lock_guard<boost::mutex> lock(input_mutex);
+                    if (input.empty()) {
+                        return;
+                    }
+                    packet = std::move(input.front());
+                    input.pop();
+                    input_size = static_cast<int>(input.size());
+                    start      = next_loop_start;
+                    length     = next_loop_length;
+                    skip       = next_skip_until;
+                }
+                ready();
+
+                if (packet == flush_packet()) {
+                    avcodec_flush_buffers(ctx.get());
+                    pending     = nullptr;
+                    draining    = false;
+                    loop_offset = 0;
+                    loop_start  = AV_NOPTS_VALUE;
+                    loop_end    = AV_NOPTS_VALUE;
+                    next_pts    = AV_NOPTS_VALUE;
+                    skip_until  = skip != AV_NOPTS_VALUE && ctx->codec_type == AVMEDIA_TYPE_VIDEO
+                                     ? av_rescale_q(skip, TIME_BASE_Q, st->time_base)
+                                     : AV_NOPTS_VALUE;
+                    ctx->skip_frame = AVDISCARD_DEFAULT;
+                    {
+                        boost::lock_guard<boost::mutex> lock(flush_mutex);
+                        eof      = false;
+                        flushing = false;
+                    }
+                    flush_cond.notify_all();
+                    ready();
+                } else if (packet == loop_packet()) {
+                    // Drain the frames of the current pass before decoding the next one.
+                    FF(avcodec_send_packet(ctx.get(), nullptr));
+                    draining   = true;
+                    skip_until = AV_NOPTS_VALUE;
+                    ctx->skip_frame = AVDISCARD_DEFAULT;
+                    loop_start = av_rescale_q(start, TIME_BASE_Q, st->time_base);
+                    loop_end   = av_rescale_q(start + length, TIME_BASE_Q, st->time_base);
+                } else {
+                    if (skip_until != AV_NOPTS_VALUE) {
+                        // Packets are in decoding order, so decide for each one.
+                        const auto skip_packet = packet->pts != AV_NOPTS_VALUE && packet->duration > 0 &&
+                                                 packet->pts + packet->duration <= skip_until;
+                        ctx->skip_frame = skip_packet ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+                    }
+                    FF(avcodec_send_packet(ctx.get(), packet.get()));
+                }
+            } else if (ret == AVERROR_EOF && draining) {
+                avcodec_flush_buffers(ctx.get());
+                draining = false;
+                loop_offset += loop_end - loop_start;
+                next_pts = AV_NOPTS_VALUE;
+            } else if (ret == AVERROR_EOF) {
+                avcodec_flush_buffers(ctx.get());
+                av_frame->pts = next_pts;
+                next_pts = AV_NOPTS_VALUE;
+                eof = true;
+                pending = std::move(av_frame);
+                ready();
+            } else {
+                FF_RET(ret, "avcodec_receive_frame");
+
+                // NOTE This is a workaround for DVCPRO HD.
+                if (av_frame->width > 1024 && av_frame->interlaced_frame) {
+                    av_frame->top_field_first = 1;
+                }
+
+                // TODO (fix) is this always best?
+                av_frame->pts = av_frame->best_effort_timestamp;
+
+                auto duration_pts = av_frame->pkt_duration;
+                if (duration_pts <= 0) {
+                    if (ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+                        const auto ticks =
+                            av_stream_get_parser(st) ? av_stream_get_parser(st)->repeat_pict + 1 : ctx->ticks_per_frame;
+                        duration_pts = static_cast<int64_t>(AV_TIME_BASE) * ctx->framerate.den * ticks /
+                            ctx->framerate.num / ctx->ticks_per_frame;
+                        duration_pts = av_rescale_q(duration_pts, { 1, AV_TIME_BASE }, st->time_base);
+                    } else if (ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
+                        duration_pts = av_rescale_q(av_frame->nb_samples, { 1, ctx->sample_rate }, st->time_base);
+                    }
+                }
+
+                if (av_frame->pts != AV_NOPTS_VALUE) {
+                    // Drop the tail beyond the out point and the preroll before the in point after a loop.
+                    if (loop_start != AV_NOPTS_VALUE &&
+                        (av_frame->pts < loop_start || av_frame->pts >= loop_end)) {
+                        continue;
+                    }
+                    av_frame->pts += loop_offset;
+                }
+
+                if (duration_pts > 0) {
+                    next_pts = av_frame->pts + duration_pts;
+                } else {
+                    next_pts = AV_NOPTS_VALUE;
+                }
+
+                pending = std::move(av_frame);
+            }
+        }
+    }
 
 public:
     std::shared_ptr<AVCodecContext> ctx;
 
     Decoder() = default;
 
-    explicit Decoder(AVStream* stream)
+    explicit Decoder(AVStream*                            stream,
+                     av_pool                              pool,
+                     std::function<void()>                notify,
+                     std::function<av_priority()>         priority,
+                     std::shared_ptr<core::frame_factory> frame_factory = nullptr,
+                     const void*                          tag           = nullptr)
         : st(stream)
+        , pool(std::move(pool))
+        , notify(std::move(notify))
+        , priority(std::move(priority))
     {
+        output.set_capacity(output_capacity);
+
         const auto codec = avcodec_find_decoder(stream->codecpar->codec_id);
         if (!codec) {
             FF_RET(AVERROR_DECODER_NOT_FOUND, "avcodec_find_decoder");
@@ -138,102 +349,89 @@ public:
             ctx->thread_type = FF_THREAD_SLICE;
         }
 
-        FF(avcodec_open2(ctx.get(), codec, nullptr));
-
-        thread = boost::thread([=]()
-        {
-            try {
-                while (!thread.interruption_requested()) {
-                    auto av_frame = alloc_frame();
-                    auto ret = avcodec_receive_frame(ctx.get(), av_frame.get());
-
-                    if (ret == AVERROR(EAGAIN)) {
-                        std::shared_ptr<AVPacket> packet;
-                        {
-                            boost::unique_lock<boost::mutex> lock(input_mutex);
-                            input_cond.wait(lock, [&]() { return !input.empty(); });
-                            packet = std::move(input.front());
-                            input.pop();
-                        }
-                        FF(avcodec_send_packet(ctx.get(), packet.get()));
-                    } else if (ret == AVERROR_EOF) {
-                        avcodec_flush_buffers(ctx.get());
-                        av_frame->pts = next_pts;
-                        next_pts = AV_NOPTS_VALUE;
-                        eof = true;
-
-                        {
-                            boost::unique_lock<boost::mutex> lock(output_mutex);
-                            output_cond.wait(lock, [&]() { return output.size() < output_capacity; });
-                            output.push(std::move(av_frame));
-                        }
-                    } else {
-                        FF_RET(ret, "avcodec_receive_frame");
+        if (frame_factory && ctx->codec_type == AVMEDIA_TYPE_VIDEO && (codec->capabilities & AV_CODEC_CAP_DR1)) {
+            allocator.frame_factory    = std::move(frame_factory);
+            allocator.tag              = tag;
+            ctx->opaque                = &allocator;
+            ctx->get_buffer2           = get_frame_buffer;
+            ctx->thread_safe_callbacks = 1;
+        }
 
-                        // NOTE This is a workaround for DVCPRO HD.
-                        if (av_frame->width > 1024 && av_frame->interlaced_frame) {
-                            av_frame->top_field_first = 1;
-                        }
+        FF(avcodec_open2(ctx.get(), codec, nullptr));
+    }
 
-                        // TODO (fix) is this always best?
-                        av_frame->pts = av_frame->best_effort_timestamp;
-
-                        auto duration_pts = av_frame->pkt_duration;
-                        if (duration_pts <= 0) {
-                            if (ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
-                                const auto ticks =
-                                    av_stream_get_parser(st) ? av_stream_get_parser(st)->repeat_pict + 1 : ctx->ticks_per_frame;
-                                duration_pts = static_cast<int64_t>(AV_TIME_BASE) * ctx->framerate.den * ticks /
-                                    ctx->framerate.num / ctx->ticks_per_frame;
-                                duration_pts = av_rescale_q(duration_pts, { 1, AV_TIME_BASE }, st->time_base);
-                            } else if (ctx->codec_type == AVMEDIA_TYPE_AUDIO) {
-                                duration_pts = av_rescale_q(av_frame->nb_samples, { 1, ctx->sample_rate }, st->time_base);
-                            }
-                        }
+    ~Decoder()
+    {
+        // Queued and running decode tasks reference this decoder.
+        aborted = true;
+        while (scheduled != 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
 
-                        if (duration_pts > 0) {
-                            next_pts = av_frame->pts + duration_pts;
-                        } else {
-                            next_pts = AV_NOPTS_VALUE;
-                        }
+    // Markers queued with the packets, which the decode task handles in order.
+    static const std::shared_ptr<AVPacket>& flush_packet()
+    {
+        static const auto packet = alloc_packet();
+        return packet;
+    }
 
-                        {
-                            boost::unique_lock<boost::mutex> lock(output_mutex);
-                            //output_cond.wait(lock, [&]() { return output.size() < 8; });
-                            output.push(std::move(av_frame));
-                        }
-                    }
-                }
-            } catch (boost::thread_interrupted&) {
-                // Do nothing...
-            }
-        });
+    static const std::shared_ptr<AVPacket>& loop_packet()
+    {
+        static const auto packet = alloc_packet();
+        return packet;
     }
 
-    ~Decoder()
+    // Discards queued packets and frames and resets the codec, keeping the codec context alive. When seeking, video
+    // frames that end before skip_until (AV_TIME_BASE units) are only decoded as far as needed for the ones after it.
+    void flush(int64_t skip_until = AV_NOPTS_VALUE)
     {
-        try {
-            if (thread.joinable()) {
-                thread.interrupt();
-                thread.join();
-            }
-        } catch (boost::thread_interrupted&) {
-            // Do nothing...
+        flushing = true;
+        {
+            boost::lock_guard<boost::mutex> lock(input_mutex);
+            next_skip_until = skip_until;
+            std::queue<std::shared_ptr<AVPacket>>().swap(input);
+            input.push(flush_packet());
+            input_size = static_cast<int>(input.size());
+        }
+
+        // Anything the decode task still pushes is dropped below.
+        std::shared_ptr<AVFrame> frame;
+        while (output.try_pop(frame))
+            ;
+
+        schedule();
+
+        {
+            boost::unique_lock<boost::mutex> lock(flush_mutex);
+            flush_cond.wait(lock, [&]() { return !flushing; });
         }
+
+        while (output.try_pop(frame))
+            ;
     }
 
-    bool want_packet() const
+    // Ends the current pass at start + length, which is where packets following this call continue from
+    // (start is in AV_TIME_BASE units). Frames of the following passes are offset to continue the timeline.
+    void loop(int64_t start, int64_t length)
     {
         if (eof) {
-            return false;
+            return;
         }
 
         {
             boost::lock_guard<boost::mutex> lock(input_mutex);
-            return input.size() < input_capacity;
+            next_loop_start  = start;
+            next_loop_length = length;
+            input.push(loop_packet());
+            input_size       = static_cast<int>(input.size());
         }
+
+        schedule();
     }
 
+    bool want_packet() const { return !eof && input_size < input_capacity; }
+
     void push(std::shared_ptr<AVPacket> packet)
     {
         if (eof) {
@@ -243,28 +441,21 @@ public:
         {
             boost::lock_guard<boost::mutex> lock(input_mutex);
             input.push(std::move(packet));
+            input_size = static_cast<int>(input.size());
         }
 
-        input_cond.notify_all();
+        schedule();
     }
 
     std::shared_ptr<AVFrame> pop()
     {
         std::shared_ptr<AVFrame> frame;
 
-        {
-            boost::lock_guard<boost::mutex> lock(output_mutex);
-
-            if (!output.empty()) {
-                frame = std::move(output.front());
-                output.pop();
-            }
-        }
-
-        if (frame) {
-            output_cond.notify_all();
+        if (output.try_pop(frame)) {
+            // Makes room for the decode task in case it paused on a full output.
+            schedule();
         } else if (eof) {
-            frame = alloc_frame();
+            frame = pool.alloc_frame();
         }
 
         return frame;
@@ -278,15 +469,22 @@ struct Filter
     std::map<int, AVFilterContext*> sources;
     std::shared_ptr<AVFrame>        frame;
     bool                            eof = false;
+    av_pool                         pool;
 
     Filter() = default;
 
-    Filter(std::string                    filter_spec,
-           const Input&                   input,
-           std::map<int, Decoder>&        streams,
-           int64_t                        start_time,
-           AVMediaType                    media_type,
-           const core::video_format_desc& format_desc)
+    Filter(std::string                                 filter_spec,
+           const Input&                                input,
+           std::map<int, Decoder>&                     streams,
+           int64_t                                     start_time,
+           AVMediaType                                 media_type,
+           const core::video_format_desc&              format_desc,
+           av_pool                                     pool,
+           const std::function<void()>&                notify,
+           const std::function<av_priority()>&         priority,
+           const std::shared_ptr<core::frame_factory>& frame_factory = nullptr,
+           const void*                                 tag           = nullptr)
+        : pool(std::move(pool))
     {
         if (media_type == AVMEDIA_TYPE_VIDEO) {
             if (filter_spec.empty()) {
@@ -440,7 +638,12 @@ struct Filter
 
                 auto it = streams.find(index);
                 if (it == streams.end()) {
-                    it = streams.emplace(index, input->streams[index]).first;
+                    it = streams
+                             .emplace(std::piecewise_construct,
+                                      std::forward_as_tuple(index),
+                                      std::forward_as_tuple(
+                                          input->streams[index], this->pool, notify, priority, frame_factory, tag))
+                             .first;
                 }
 
                 auto st = it->second.ctx;
@@ -568,7 +771,7 @@ struct Filter
             return true;
         }
 
-        auto av_frame = alloc_frame();
+        auto av_frame = pool.alloc_frame();
         auto ret      = nb_samples >= 0 ? av_buffersink_get_samples(sink, av_frame.get(), nb_samples)
                                    : av_buffersink_get_frame(sink, av_frame.get());
 
@@ -598,7 +801,18 @@ struct AVProducer::Impl
     const AVRational                           format_tb_;
     const std::string                          name_;
     const std::string                          path_;
+    const std::string                          cache_key_;
+    const std::shared_ptr<const CachedClip>    cached_;
+
+    // Signalled whenever a stage may be able to make progress, run() waits on it when idle.
+    boost::mutex              wakeup_mutex_;
+    boost::condition_variable wakeup_cond_;
+    bool                      wakeup_ = false;
 
+    // Steady clock milliseconds of the last next_frame(), see priority().
+    std::atomic<int64_t> receive_time_{0};
+
+    av_pool                pool_;
     Input                  input_;
     std::map<int, Decoder> decoders_;
     Filter                 video_filter_;
@@ -622,14 +836,23 @@ struct AVProducer::Impl
     int64_t          frame_duration_ = AV_NOPTS_VALUE;
     core::draw_frame frame_;
 
-    std::deque<Frame>         buffer_;
-    mutable boost::mutex      buffer_mutex_;
-    boost::condition_variable buffer_cond_;
-    std::atomic<bool>         buffer_eof_{false};
-    int                       buffer_capacity_ = static_cast<int>(format_desc_.fps) / 4;
-  
-    boost::optional<caspar::executor> video_executor_;
-    boost::optional<caspar::executor> audio_executor_;
+    // Frames ending before this are decoded but not buffered, for seeks a short distance ahead.
+    int64_t discard_until_ = AV_NOPTS_VALUE;
+
+    // Number of times the input has been wrapped around since the last seek.
+    int64_t       loop_count_   = 0;
+    int64_t       loop_packets_ = 0;
+    std::set<int> ended_streams_;
+
+    // The first pass over the file, handed to the frame cache once complete.
+    std::shared_ptr<CachedClip> recording_;
+    std::size_t                 cached_pos_ = 0;
+
+    std::deque<Frame>                 buffer_;
+    mutable boost::mutex              buffer_mutex_;
+    mutable boost::condition_variable buffer_cond_;
+    std::atomic<bool>                 buffer_eof_{false};
+    int                               buffer_capacity_ = static_cast<int>(format_desc_.fps) / 4;
 
     int latency_ = 0;
 
@@ -650,27 +873,51 @@ struct AVProducer::Impl
         , format_tb_({format_desc.duration, format_desc.time_scale})
         , name_(name)
         , path_(path)
-        , input_(path, graph_, seekable >= 0 && seekable < 2 ? boost::optional<bool>(false) : boost::optional<bool>())
+        , cache_key_(FrameCache::key(path, vfilter, afilter, format_desc))
+        , cached_(!cache_key_.empty() ? FrameCache::instance().find(cache_key_) : nullptr)
+        , input_(path,
+                 pool_,
+                 graph_,
+                 seekable >= 0 && seekable < 2 ? boost::optional<bool>(false) : boost::optional<bool>(),
+                 [this] { wakeup(); })
         , start_(start ? av_rescale_q(*start, format_tb_, TIME_BASE_Q) : AV_NOPTS_VALUE)
         , duration_(duration ? av_rescale_q(*duration, format_tb_, TIME_BASE_Q) : AV_NOPTS_VALUE)
         , loop_(loop)
         , afilter_(afilter)
         , vfilter_(vfilter)
         , seekable_(seekable)
-        , video_executor_(L"video-executor")
-        , audio_executor_(L"audio-executor")
     {
         diagnostics::register_graph(graph_);
         graph_->set_color("underflow", diagnostics::color(0.6f, 0.3f, 0.9f));
         graph_->set_color("frame-time", diagnostics::color(0.0f, 1.0f, 0.0f));
         graph_->set_color("decode-time", diagnostics::color(0.0f, 1.0f, 1.0f));
         graph_->set_color("buffer", diagnostics::color(1.0f, 1.0f, 0.0f));
+        graph_->set_color("frame-pool", diagnostics::color(0.3f, 0.6f, 1.0f));
+        graph_->set_color("packet-pool", diagnostics::color(0.6f, 0.3f, 0.3f));
 
         state_["file/name"] = u8(name_);
         state_["file/path"] = u8(path_);
         state_["loop"]      = loop;
         update_state();
 
+        if (cached_) {
+            input_duration_ = cached_->duration;
+            if (duration_ == AV_NOPTS_VALUE && cached_->duration > 0) {
+                duration_ = cached_->duration - (start_ != AV_NOPTS_VALUE ? start_.load() : 0);
+            }
+            cached_pos_ = find_cached(start_ != AV_NOPTS_VALUE ? start_.load() : 0);
+
+            boost::lock_guard<boost::mutex> lock(state_mutex_);
+            state_["file/streams"] = cached_->streams;
+
+            CASPAR_LOG(debug) << print() << " Playing from frame cache.";
+            return;
+        }
+
+        if (!cache_key_.empty() && start_ == AV_NOPTS_VALUE && FrameCache::instance().max_clip_size() > 0) {
+            recording_ = std::make_shared<CachedClip>();
+        }
+
         CASPAR_LOG(debug) << print() << " seekable: " << seekable_;
 
         thread_ = boost::thread([=] {
@@ -704,10 +951,10 @@ struct AVProducer::Impl
             // Do nothing...
         }
 
-        video_executor_.reset();
-        audio_executor_.reset();
-
         CASPAR_LOG(debug) << print() << " Joined";
+        CASPAR_LOG(debug) << print() << " Pool high water: " << pool_.frames_high_water() << "/"
+                          << pool_.frames_capacity() << " frames, " << pool_.packets_high_water() << "/"
+                          << pool_.packets_capacity() << " packets";
     }
 
     void run()
@@ -723,6 +970,10 @@ struct AVProducer::Impl
                 streams[std::to_string(n) + "/fps"] = {framerate.num, framerate.den};
             }
 
+            if (recording_) {
+                recording_->streams = streams;
+            }
+
             boost::lock_guard<boost::mutex> lock(state_mutex_);
             state_["file/streams"] = streams;
         }
@@ -756,22 +1007,25 @@ struct AVProducer::Impl
         timer frame_timer;
         timer decode_timer;
 
-        int warning_debounce = 0;
+        timer  stall_timer;
+        double stall_warning = 2.0;
 
         while (!thread_.interruption_requested()) {
             {
                 const auto seek = seek_.exchange(AV_NOPTS_VALUE);
 
                 if (seek != AV_NOPTS_VALUE) {
-                    seek_internal(seek);
-                    frame = Frame{};
-                    continue;
+                    if (!is_near(seek, frame)) {
+                        seek_internal(seek);
+                        frame = Frame{};
+                        continue;
+                    }
+                    discard_until_ = seek;
+                    frame_flush_   = true;
                 }
             }
 
             {
-                // TODO (perf) seek as soon as input is past duration or eof.
-
                 auto start    = start_.load();
                 auto duration = duration_.load();
 
@@ -782,14 +1036,24 @@ struct AVProducer::Impl
                 // check whether the next frame will last beyond the end time
                 auto time = next_pts ? next_pts + frame.duration : 0;
 
-                buffer_eof_ = (video_filter_.eof && audio_filter_.eof) || time > end;
+                // When the input is wrapped around by schedule() the next pass simply follows.
+                buffer_eof_ = (video_filter_.eof && audio_filter_.eof) || (time > end && !can_loop());
+
+                if (buffer_eof_) {
+                    // Wakes wait_ready(), a clip shorter than PREROLL_FRAMES is ready now.
+                    boost::lock_guard<boost::mutex> lock(buffer_mutex_);
+                    buffer_cond_.notify_all();
+                }
 
                 if (buffer_eof_) {
+                    if (recording_) {
+                        finish_recording();
+                    }
                     if (loop_ && frame_count_ > 2) {
                         frame = Frame{};
                         seek_internal(start);
                     } else {
-                        boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+                        wait_for_wakeup(boost::chrono::seconds(1));
                     }
                     // TODO (fix) Limit live polling due to bugs.
                     continue;
@@ -800,25 +1064,30 @@ struct AVProducer::Impl
             {
                 progress |= schedule();
 
-                std::vector<std::future<bool>> futures;
-
+                auto video_progress = false;
+                auto audio_progress = false;
 
-                if (!video_filter_.frame) {
-                    futures.push_back(video_executor_->begin_invoke([&]() { return video_filter_(); }));
-                }
-
-                if (!audio_filter_.frame) {
-                    futures.push_back(audio_executor_->begin_invoke([&]() { return audio_filter_(audio_cadence[0]);  }));
-                }
+                av_execute(priority(), [&] {
+                    tbb::parallel_invoke(
+                        [&] {
+                            if (!video_filter_.frame) {
+                                video_progress = video_filter_();
+                            }
+                        },
+                        [&] {
+                            if (!audio_filter_.frame) {
+                                audio_progress = audio_filter_(audio_cadence[0]);
+                            }
+                        });
+                });
 
-                for (auto& future : futures) {
-                    progress |= future.get();
-                }
+                progress |= video_progress || audio_progress;
             }
 
             if ((!video_filter_.frame && !video_filter_.eof) || (!audio_filter_.frame && !audio_filter_.eof)) {
                 if (!progress) {
-                    if (warning_debounce++ % 500 == 100) {
+                    if (stall_timer.elapsed() > stall_warning) {
+                        stall_warning += 10.0;
                         if (!video_filter_.frame && !video_filter_.eof) {
                             CASPAR_LOG(warning) << print() << " Waiting for video frame...";
                         } else if (!audio_filter_.frame && !audio_filter_.eof) {
@@ -828,13 +1097,14 @@ struct AVProducer::Impl
                         }
                     }
 
-                    // TODO (perf): Avoid live loop.
-                    boost::this_thread::sleep_for(boost::chrono::milliseconds(warning_debounce > 25 ? 20 : 5));
+                    // Nothing can move until the input or a decoder delivers, the timeout is only a safety net.
+                    wait_for_wakeup(boost::chrono::milliseconds(100));
                 }
                 continue;
             }
 
-            warning_debounce = 0;
+            stall_timer.restart();
+            stall_warning = 2.0;
 
             // TODO (fix)
             // if (start_ != AV_NOPTS_VALUE && frame.pts < start_) {
@@ -862,15 +1132,40 @@ struct AVProducer::Impl
                 frame.duration   = av_rescale_q(frame.audio->nb_samples, {1, sr}, TIME_BASE_Q);
             }
 
-            frame.frame = core::draw_frame(make_frame(this, *frame_factory_, frame.video, frame.audio));
+            // Map the continuous timeline of a looping input back into the clip.
+            if (loop_count_ > 0 && frame.pts != AV_NOPTS_VALUE) {
+                auto start    = start_.load();
+                auto duration = duration_.load();
+
+                start = start != AV_NOPTS_VALUE ? start : 0;
+                if (duration > 0) {
+                    const auto pass = (frame.pts - start + frame.duration / 2) / duration;
+                    frame.pts -= std::max<int64_t>(0, std::min(pass, loop_count_)) * duration;
+                }
+            }
+
+            const auto data = core::const_frame(make_frame(this, *frame_factory_, frame.video, frame.audio));
+            frame.frame     = core::draw_frame(data);
+
+            if (recording_) {
+                record(frame, data);
+            }
 
             graph_->set_value("decode-time", decode_timer.elapsed() * format_desc_.fps * 0.5);
 
+            if (discard_until_ != AV_NOPTS_VALUE) {
+                if (frame.pts + frame.duration <= discard_until_) {
+                    continue;
+                }
+                discard_until_ = AV_NOPTS_VALUE;
+            }
+
             {
                 boost::unique_lock<boost::mutex> buffer_lock(buffer_mutex_);
                 buffer_cond_.wait(buffer_lock, [&] { return buffer_.size() < buffer_capacity_; });
                 if (seek_ == AV_NOPTS_VALUE) {
                     buffer_.push_back(frame);
+                    buffer_cond_.notify_all();
                 }
             }
 
@@ -881,6 +1176,10 @@ struct AVProducer::Impl
 
             frame_count_ += 1;
             graph_->set_value("buffer", static_cast<double>(buffer_.size()) / static_cast<double>(buffer_capacity_));
+            graph_->set_value("frame-pool",
+                              std::min(1.0, static_cast<double>(pool_.frames_in_use()) / pool_.frames_capacity()));
+            graph_->set_value("packet-pool",
+                              std::min(1.0, static_cast<double>(pool_.packets_in_use()) / pool_.packets_capacity()));
 
             boost::range::rotate(audio_cadence, std::end(audio_cadence) - 1);
         }
@@ -899,7 +1198,15 @@ struct AVProducer::Impl
     {
         CASPAR_SCOPE_EXIT { update_state(); };
 
-        if (frame_flush_ || !frame_) {
+        if (cached_) {
+            if ((frame_flush_ || !frame_) && cached_pos_ < cached_->frames.size()) {
+                const auto& frame = cached_->frames[cached_pos_];
+                frame_            = frame.frame;
+                frame_time_       = frame.pts;
+                frame_duration_   = frame.duration;
+                frame_flush_      = false;
+            }
+        } else if (frame_flush_ || !frame_) {
             boost::lock_guard<boost::mutex> lock(buffer_mutex_);
 
             if (!buffer_.empty()) {
@@ -917,9 +1224,15 @@ struct AVProducer::Impl
     {
         CASPAR_SCOPE_EXIT { update_state(); };
 
+        receive_time_ = now();
+
+        if (cached_) {
+            return next_cached_frame();
+        }
+
         boost::lock_guard<boost::mutex> lock(buffer_mutex_);
 
-        if (buffer_.empty() || (frame_flush_ && buffer_.size() < 4)) {
+        if (buffer_.empty() || (frame_flush_ && buffer_.size() < PREROLL_FRAMES && !buffer_eof_)) {
             auto start    = start_.load();
             auto duration = duration_.load();
 
@@ -961,14 +1274,68 @@ struct AVProducer::Impl
     {
         CASPAR_SCOPE_EXIT { update_state(); };
 
-        seek_ = av_rescale_q(time, format_tb_, TIME_BASE_Q);
+        const auto target = av_rescale_q(time, format_tb_, TIME_BASE_Q);
 
         {
             boost::lock_guard<boost::mutex> lock(buffer_mutex_);
+
+            // Frames that are already decoded are served without seeking.
+            if (seek_ == AV_NOPTS_VALUE) {
+                auto it = std::find_if(buffer_.begin(), buffer_.end(), [&](const Frame& frame) {
+                    return frame.pts != AV_NOPTS_VALUE && frame.pts + frame.duration > target;
+                });
+                if (it != buffer_.end() && it->pts <= target) {
+                    buffer_.erase(buffer_.begin(), it);
+                    frame_flush_ = true;
+                    buffer_cond_.notify_all();
+                    graph_->set_value("buffer",
+                                      static_cast<double>(buffer_.size()) / static_cast<double>(buffer_capacity_));
+                    return;
+                }
+            }
+
+            seek_ = target;
             buffer_.clear();
             buffer_cond_.notify_all();
             graph_->set_value("buffer", static_cast<double>(buffer_.size()) / static_cast<double>(buffer_capacity_));
         }
+
+        wakeup();
+    }
+
+    // Requires buffer_mutex_.
+    bool buffer_ready() const
+    {
+        return !buffer_.empty() && (!frame_flush_ || buffer_.size() >= PREROLL_FRAMES || buffer_eof_);
+    }
+
+    bool is_ready() const
+    {
+        if (cached_) {
+            return true;
+        }
+
+        boost::lock_guard<boost::mutex> lock(buffer_mutex_);
+        return buffer_ready();
+    }
+
+    bool wait_ready(std::chrono::steady_clock::time_point deadline) const
+    {
+        if (cached_) {
+            return true;
+        }
+
+        // buffer_cond_ is notified whenever a frame is buffered or the buffer reaches the end of the clip.
+        boost::unique_lock<boost::mutex> lock(buffer_mutex_);
+        while (!buffer_ready()) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0) {
+                return false;
+            }
+            buffer_cond_.wait_for(lock, boost::chrono::milliseconds(remaining.count()));
+        }
+        return true;
     }
 
     int64_t time() const
@@ -986,6 +1353,7 @@ struct AVProducer::Impl
         CASPAR_SCOPE_EXIT { update_state(); };
 
         loop_ = loop;
+        wakeup();
     }
 
     bool loop() const { return loop_; }
@@ -994,6 +1362,7 @@ struct AVProducer::Impl
     {
         CASPAR_SCOPE_EXIT { update_state(); };
         start_ = av_rescale_q(start, format_tb_, TIME_BASE_Q);
+        wakeup();
     }
 
     boost::optional<int64_t> start() const
@@ -1007,6 +1376,7 @@ struct AVProducer::Impl
         CASPAR_SCOPE_EXIT { update_state(); };
 
         duration_ = av_rescale_q(duration, format_tb_, TIME_BASE_Q);
+        wakeup();
     }
 
     boost::optional<int64_t> duration() const
@@ -1025,6 +1395,130 @@ struct AVProducer::Impl
     }
 
   private:
+    static int64_t now()
+    {
+        using namespace std::chrono;
+
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Producers that have been played within the last second are considered on air.
+    av_priority priority() const
+    {
+        return now() - receive_time_ < 1000 ? av_priority::high : av_priority::normal;
+    }
+
+    void wakeup()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(wakeup_mutex_);
+            wakeup_ = true;
+        }
+        wakeup_cond_.notify_all();
+    }
+
+    template <typename Duration>
+    void wait_for_wakeup(const Duration& timeout)
+    {
+        boost::unique_lock<boost::mutex> lock(wakeup_mutex_);
+        wakeup_cond_.wait_for(lock, timeout, [&] { return wakeup_; });
+        wakeup_ = false;
+    }
+
+    // Index of the first cached frame ending after time.
+    std::size_t find_cached(int64_t time) const
+    {
+        const auto& frames = cached_->frames;
+        return std::partition_point(frames.begin(),
+                                    frames.end(),
+                                    [&](const CachedClip::Frame& frame) { return frame.pts + frame.duration <= time; }) -
+               frames.begin();
+    }
+
+    core::draw_frame next_cached_frame()
+    {
+        const auto& frames = cached_->frames;
+
+        auto start    = start_.load();
+        auto duration = duration_.load();
+
+        start    = start != AV_NOPTS_VALUE ? start : 0;
+        auto end = duration != AV_NOPTS_VALUE ? start + duration : INT64_MAX;
+
+        const auto seek = seek_.exchange(AV_NOPTS_VALUE);
+        if (seek != AV_NOPTS_VALUE) {
+            cached_pos_ = find_cached(seek);
+        }
+
+        const auto past_end = [&](std::size_t pos) {
+            return pos >= frames.size() || frames[pos].pts + frames[pos].duration / 2 > end;
+        };
+
+        if (past_end(cached_pos_) && loop_) {
+            cached_pos_ = find_cached(start);
+        }
+
+        if (past_end(cached_pos_)) {
+            if (frame_time_ < end && frame_duration_ != AV_NOPTS_VALUE) {
+                frame_time_ += frame_duration_;
+            }
+            return core::draw_frame::still(frame_);
+        }
+
+        const auto& frame = frames[cached_pos_++];
+        frame_            = frame.frame;
+        frame_time_       = frame.pts;
+        frame_duration_   = frame.duration;
+        frame_flush_      = false;
+
+        return frame_;
+    }
+
+    void record(const Frame& frame, const core::const_frame& data)
+    {
+        if (recording_->frames.empty() && frame.pts > frame.duration) {
+            // Not decoding from the start of the file.
+            recording_ = nullptr;
+            return;
+        }
+
+        if (!recording_->frames.empty() && frame.pts <= recording_->frames.back().pts) {
+            // The input has wrapped around, the first pass is complete.
+            finish_recording();
+            return;
+        }
+
+        for (std::size_t n = 0; n < data.pixel_format_desc().planes.size(); ++n) {
+            recording_->size += data.image_data(n).size();
+        }
+        recording_->size += data.audio_data().size() * sizeof(int32_t);
+
+        if (recording_->size > FrameCache::instance().max_clip_size()) {
+            recording_ = nullptr;
+            return;
+        }
+
+        CachedClip::Frame cached;
+        cached.frame    = frame.frame;
+        cached.pts      = frame.pts;
+        cached.duration = frame.duration;
+        recording_->frames.push_back(std::move(cached));
+    }
+
+    void finish_recording()
+    {
+        auto clip = std::move(recording_);
+
+        // Only complete passes over the whole file are cached, in and out points are applied on playback.
+        const auto start = start_.load();
+        if (clip->frames.empty() || (start != AV_NOPTS_VALUE && start != 0) || duration_ != input_duration_) {
+            return;
+        }
+
+        clip->duration = input_duration_;
+        FrameCache::instance().insert(cache_key_, std::move(clip));
+    }
+
     bool want_packet()
     {
         return std::any_of(
@@ -1040,14 +1534,29 @@ struct AVProducer::Impl
             result = true;
 
             if (!packet) {
+                if (can_loop() && loop_packets_ > 0) {
+                    if (!loop_input()) {
+                        return result;
+                    }
+                    continue;
+                }
                 for (auto& p : decoders_) {
                     p.second.push(nullptr);
                 }
             } else if (sources_.find(packet->stream_index) != sources_.end()) {
+                if (can_loop() && is_past_end(*packet)) {
+                    // Wrap around as soon as every stream has reached the out point instead of demuxing to eof.
+                    ended_streams_.insert(packet->stream_index);
+                    if (ended_streams_.size() >= sources_.size() && loop_packets_ > 0 && !loop_input()) {
+                        return result;
+                    }
+                    continue;
+                }
                 auto it = decoders_.find(packet->stream_index);
                 if (it != decoders_.end()) {
                     // TODO (fix): limit it->second.input.size()?
                     it->second.push(std::move(packet));
+                    loop_packets_ += 1;
                 }
             }
         }
@@ -1102,23 +1611,110 @@ struct AVProducer::Impl
         time = time != AV_NOPTS_VALUE ? time : 0;
         time = time + (input_->start_time != AV_NOPTS_VALUE ? input_->start_time : 0);
 
-        // TODO (fix) Dont seek if time is close future.
-        if (seekable_) {
-            input_.seek(time);
-        }
-        frame_flush_ = true;
-        frame_count_ = 0;
-        buffer_eof_  = false;
+        frame_flush_   = true;
+        frame_count_   = 0;
+        buffer_eof_    = false;
+        discard_until_ = AV_NOPTS_VALUE;
 
-        decoders_.clear();
+        // Decoders are kept alive and flushed unless the input had to be reopened.
+        if (seekable_ && !input_.seek(time)) {
+            decoders_.clear();
+        }
+        for (auto& p : decoders_) {
+            p.second.flush(time);
+        }
+        loop_count_   = 0;
+        loop_packets_ = 0;
+        ended_streams_.clear();
+        recording_.reset();
 
         reset(time);
     }
 
+    // Whether decoding on from the last frame reaches time (in clip time) sooner than seeking would. Seeking goes
+    // back to the keyframe at or before time, which only pays off if it is past the last frame.
+    bool is_near(int64_t time, const Frame& frame) const
+    {
+        if (frame.pts == AV_NOPTS_VALUE || loop_count_ > 0) {
+            return false;
+        }
+
+        const auto next = frame.pts + frame.duration;
+        if (time < next || time - next > AV_TIME_BASE) {
+            return false;
+        }
+
+        const auto start_time = input_->start_time != AV_NOPTS_VALUE ? input_->start_time : 0;
+        const auto keyframe   = input_.keyframe(time + start_time);
+        return keyframe == AV_NOPTS_VALUE || keyframe <= next + start_time;
+    }
+
+    bool can_loop() const
+    {
+        const auto duration = duration_.load();
+        return loop_ && seekable_ && duration != AV_NOPTS_VALUE && duration > 0;
+    }
+
+    bool is_past_end(const AVPacket& packet) const
+    {
+        const auto ts = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
+        if (ts == AV_NOPTS_VALUE) {
+            return false;
+        }
+
+        // Packets are in decoding order, anything decoded after the out point is not referenced before it.
+        const auto tb = input_->streams[packet.stream_index]->time_base;
+        return av_rescale_q(ts, tb, TIME_BASE_Q) >= loop_start() + duration_.load();
+    }
+
+    int64_t loop_start() const
+    {
+        const auto start = start_.load();
+        return (start != AV_NOPTS_VALUE ? start : 0) + (input_->start_time != AV_NOPTS_VALUE ? input_->start_time : 0);
+    }
+
+    // Wraps the input around to the in point while keeping decoders and filters running. Returns false if the
+    // input had to be reopened, in which case a regular seek is scheduled instead.
+    bool loop_input()
+    {
+        const auto start = loop_start();
+
+        for (auto& p : decoders_) {
+            p.second.loop(start, duration_);
+        }
+
+        ended_streams_.clear();
+        loop_packets_ = 0;
+
+        if (!input_.seek(start)) {
+            decoders_.clear();
+            seek_ = start_ != AV_NOPTS_VALUE ? start_.load() : 0;
+            return false;
+        }
+
+        loop_count_ += 1;
+
+        return true;
+    }
+
     void reset(int64_t start_time)
     {
-        video_filter_ = Filter(vfilter_, input_, decoders_, start_time, AVMEDIA_TYPE_VIDEO, format_desc_);
-        audio_filter_ = Filter(afilter_, input_, decoders_, start_time, AVMEDIA_TYPE_AUDIO, format_desc_);
+        const auto notify   = [this] { wakeup(); };
+        const auto priority = [this] { return this->priority(); };
+
+        video_filter_ = Filter(vfilter_,
+                               input_,
+                               decoders_,
+                               start_time,
+                               AVMEDIA_TYPE_VIDEO,
+                               format_desc_,
+                               pool_,
+                               notify,
+                               priority,
+                               frame_factory_,
+                               this);
+        audio_filter_ =
+            Filter(afilter_, input_, decoders_, start_time, AVMEDIA_TYPE_AUDIO, format_desc_, pool_, notify, priority);
 
         sources_.clear();
         for (auto& p : video_filter_.sources) {
@@ -1211,6 +1807,13 @@ AVProducer& AVProducer::duration(int64_t duration)
 
 int64_t AVProducer::duration() const { return impl_->duration().value_or(std::numeric_limits<int64_t>::max()); }
 
+bool AVProducer::is_ready() const { return impl_->is_ready(); }
+
+bool AVProducer::wait_ready(std::chrono::steady_clock::time_point deadline) const
+{
+    return impl_->wait_ready(deadline);
+}
+
 core::monitor::state AVProducer::state() const
 {
     boost::lock_guard<boost::mutex> lock(impl_->state_mutex_);
@@ -6,6 +6,7 @@
 
 #include <boost/optional.hpp>
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -40,6 +41,10 @@ class AVProducer
     AVProducer& duration(int64_t duration);
     int64_t     duration() const;
 
+    // Whether enough frames are buffered for next_frame to deliver without waiting.
+    bool is_ready() const;
+    bool wait_ready(std::chrono::steady_clock::time_point deadline) const;
+
     caspar::core::monitor::state state() const;
 
   private:
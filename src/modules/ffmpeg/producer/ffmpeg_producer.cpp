@@ -27,6 +27,7 @@
 
 #include <common/env.h>
 #include <common/os/filesystem.h>
+#include <common/os/folder_cache.h>
 #include <common/param.h>
 
 #include <core/frame/draw_frame.h>
@@ -192,6 +193,13 @@ struct ffmpeg_producer : public core::frame_producer
     std::wstring name() const override { return L"ffmpeg"; }
 
     core::monitor::state state() const override { return producer_->state(); }
+
+    bool is_ready() const override { return producer_->is_ready(); }
+
+    bool wait_ready(std::chrono::steady_clock::time_point deadline) const override
+    {
+        return producer_->wait_ready(deadline);
+    }
 };
 
 boost::tribool has_valid_extension(const std::wstring& filename)
@@ -276,6 +284,14 @@ bool is_valid_file(const std::wstring& filename)
 
 std::wstring probe_stem(const std::wstring& stem)
 {
+    if (folder_cache::covers(stem)) {
+        for (auto& path : folder_cache::find_stem(stem)) {
+            if (is_valid_file(path))
+                return path;
+        }
+        return L"";
+    }
+
     auto stem2  = boost::filesystem::path(stem);
     auto parent = find_case_insensitive(stem2.parent_path().wstring());
 
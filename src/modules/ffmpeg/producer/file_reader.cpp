@@ -0,0 +1,491 @@
+#include "file_reader.h"
+
+#include "../util/av_assert.h"
+
+#include <common/env.h>
+#include <common/log.h>
+#include <common/os/thread.h>
+#include <common/timer.h>
+#include <common/utf.h>
+
+#include <boost/align/aligned_allocator.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#endif
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <fcntl.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+namespace {
+
+// Block size and file offsets are multiples of this, as required for direct I/O.
+const std::size_t ALIGNMENT = 4096;
+
+const std::size_t BLOCK_SIZE     = 1024 * 1024;
+const int         IO_BUFFER_SIZE = 64 * 1024;
+
+class File
+{
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    std::string filename_;
+    bool        direct_ = false;
+    int         fd_     = -1;
+
+    void open()
+    {
+#ifdef _MSC_VER
+        _wsopen_s(&fd_, u16(filename_).c_str(), _O_RDONLY | _O_BINARY | _O_SEQUENTIAL, _SH_DENYNO, _S_IREAD);
+#else
+        if (direct_) {
+            fd_ = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        }
+        if (fd_ < 0) {
+            // Not every file system supports direct I/O.
+            direct_ = false;
+            fd_     = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd_ >= 0) {
+            posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    void close()
+    {
+        if (fd_ >= 0) {
+#ifdef _MSC_VER
+            _close(fd_);
+#else
+            ::close(fd_);
+#endif
+            fd_ = -1;
+        }
+    }
+
+  public:
+    File(std::string filename, bool direct)
+        : filename_(std::move(filename))
+        , direct_(direct)
+    {
+        open();
+    }
+
+    ~File() { close(); }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    // Returns the number of bytes read, 0 at the end of the file or an AVERROR.
+    int64_t read(void* data, std::size_t size, int64_t offset)
+    {
+#ifdef _MSC_VER
+        if (_lseeki64(fd_, offset, SEEK_SET) < 0) {
+            return AVERROR(errno);
+        }
+        const auto ret = _read(fd_, data, static_cast<unsigned int>(size));
+        return ret >= 0 ? ret : AVERROR(errno);
+#else
+        while (true) {
+            const auto ret = ::pread(fd_, data, size, offset);
+            if (ret >= 0) {
+                return ret;
+            }
+            if (errno == EINVAL && direct_) {
+                // The file system doesn't accept the alignment after all.
+                close();
+                direct_ = false;
+                open();
+            } else if (errno != EINTR) {
+                return AVERROR(errno);
+            }
+        }
+#endif
+    }
+};
+
+} // namespace
+
+struct FileReader::Impl
+{
+    using buffer_t = std::vector<std::uint8_t, boost::alignment::aligned_allocator<std::uint8_t, ALIGNMENT>>;
+
+    struct Block
+    {
+        int64_t     offset = 0;
+        std::size_t size   = 0;
+        buffer_t    data;
+    };
+
+    const std::string                   filename_;
+    const std::size_t                   capacity_;
+    const std::size_t                   block_size_;
+    const AVIOInterruptCB               interrupt_;
+    std::shared_ptr<diagnostics::graph> graph_;
+
+    File file_;
+
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    std::deque<Block>       blocks_; // Contiguous data of the file, ending at next_offset_.
+    std::vector<Block>      free_;
+    int64_t                 file_size_;
+    int64_t                 pos_         = 0; // Read position of the demuxer.
+    int64_t                 next_offset_ = 0; // Where the reader continues.
+    int                     generation_  = 0; // Incremented when a seek discards the buffered data.
+    int                     error_       = 0;
+    bool                    eof_         = false;
+    bool                    abort_       = false;
+
+    AVIOContext* ctx_ = nullptr;
+    std::thread  thread_;
+
+    Impl(std::string                         filename,
+         int64_t                             file_size,
+         std::size_t                         capacity,
+         bool                                direct,
+         const AVIOInterruptCB&              interrupt,
+         std::shared_ptr<diagnostics::graph> graph)
+        : filename_(std::move(filename))
+        , capacity_(capacity)
+        , block_size_(std::max(ALIGNMENT, std::min(BLOCK_SIZE, capacity / ALIGNMENT * ALIGNMENT)))
+        , interrupt_(interrupt)
+        , graph_(std::move(graph))
+        , file_(filename_, direct)
+        , file_size_(file_size)
+    {
+        graph_->set_color("read-ahead", diagnostics::color(0.4f, 0.8f, 0.4f));
+        graph_->set_color("io-busy", diagnostics::color(0.8f, 0.8f, 0.4f));
+        graph_->set_color("io-stall", diagnostics::color(1.0f, 0.3f, 0.3f));
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            abort_ = true;
+        }
+        cond_.notify_all();
+
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+
+        if (ctx_) {
+            av_freep(&ctx_->buffer);
+            avio_context_free(&ctx_);
+        }
+    }
+
+    void start(bool seekable)
+    {
+        auto buffer = static_cast<unsigned char*>(av_malloc(IO_BUFFER_SIZE));
+        if (!buffer) {
+            FF_RET(AVERROR(ENOMEM), "av_malloc");
+        }
+
+        ctx_ = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, this, &Impl::read_cb, nullptr, &Impl::seek_cb);
+        if (!ctx_) {
+            av_freep(&buffer);
+            FF_RET(AVERROR(ENOMEM), "avio_alloc_context");
+        }
+
+        if (!seekable) {
+            ctx_->seekable = 0;
+        }
+
+        thread_ = std::thread([this] {
+            try {
+                set_thread_name(L"[ffmpeg::av_producer::FileReader]");
+                run();
+            } catch (...) {
+                CASPAR_LOG_CURRENT_EXCEPTION();
+            }
+        });
+    }
+
+    int64_t buffered_ahead() const { return next_offset_ - pos_; }
+
+    // Blocks are only read once they fit entirely, so that the reader isn't woken by every small read.
+    bool has_room() const
+    {
+        return buffered_ahead() + static_cast<int64_t>(block_size_) <= static_cast<int64_t>(capacity_);
+    }
+
+    void recycle(Block block) { free_.push_back(std::move(block)); }
+
+    void run()
+    {
+        timer  busy_timer;
+        double busy = 0.0;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (true) {
+            cond_.wait(lock, [&] { return abort_ || (!eof_ && error_ == 0 && has_room()); });
+
+            if (abort_) {
+                break;
+            }
+
+            Block block;
+            if (!free_.empty()) {
+                block = std::move(free_.back());
+                free_.pop_back();
+            } else {
+                block.data.resize(block_size_);
+            }
+
+            const auto offset     = next_offset_;
+            const auto generation = generation_;
+
+            lock.unlock();
+
+            timer      read_timer;
+            const auto ret = file_.read(block.data.data(), block_size_, offset);
+            busy += read_timer.elapsed();
+
+            lock.lock();
+
+            if (busy_timer.elapsed() >= 1.0) {
+                graph_->set_value("io-busy", std::min(1.0, busy / busy_timer.elapsed()));
+                busy_timer.restart();
+                busy = 0.0;
+            }
+
+            if (generation != generation_) {
+                recycle(std::move(block));
+                continue;
+            }
+
+            if (ret < 0) {
+                CASPAR_LOG(error) << "file_reader[" + filename_ + "] Read failed at " << offset << ".";
+                error_ = static_cast<int>(ret);
+                recycle(std::move(block));
+            } else if (ret == 0) {
+                eof_ = true;
+                recycle(std::move(block));
+            } else {
+                block.offset = offset;
+                block.size   = static_cast<std::size_t>(ret);
+                next_offset_ += ret;
+                blocks_.push_back(std::move(block));
+                file_size_ = std::max(file_size_, next_offset_);
+
+                // Data behind the read position is kept while there is room, for seeks a short way back.
+                while (blocks_.front().offset + static_cast<int64_t>(blocks_.front().size) <= pos_ &&
+                       next_offset_ - blocks_.front().offset > static_cast<int64_t>(capacity_ + block_size_)) {
+                    recycle(std::move(blocks_.front()));
+                    blocks_.pop_front();
+                }
+            }
+
+            graph_->set_value("read-ahead", static_cast<double>(buffered_ahead()) / capacity_);
+            cond_.notify_all();
+        }
+    }
+
+    // Called at the end of the buffered data once the reader has hit the end of the file. Clips which are still being
+    // written keep growing, in which case the reader carries on. Requires mutex_.
+    bool file_grew()
+    {
+        boost::system::error_code ec;
+        const auto                size = static_cast<int64_t>(boost::filesystem::file_size(u16(filename_), ec));
+        if (ec || size <= next_offset_) {
+            return false;
+        }
+
+        file_size_ = size;
+        eof_       = false;
+        cond_.notify_all();
+        return true;
+    }
+
+    bool interrupted() const { return interrupt_.callback && interrupt_.callback(interrupt_.opaque); }
+
+    int read(std::uint8_t* buf, int size)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto stalled = false;
+
+        while (true) {
+            auto count = 0;
+            for (auto& block : blocks_) {
+                const auto end = block.offset + static_cast<int64_t>(block.size);
+                if (count == size || block.offset > pos_) {
+                    break;
+                }
+                if (end <= pos_) {
+                    continue;
+                }
+                const auto n = static_cast<int>(std::min<int64_t>(size - count, end - pos_));
+                std::memcpy(buf + count, block.data.data() + (pos_ - block.offset), n);
+                count += n;
+                pos_ += n;
+            }
+
+            if (count > 0) {
+                if (has_room()) {
+                    cond_.notify_all();
+                }
+                return count;
+            }
+
+            if (abort_) {
+                return AVERROR_EXIT;
+            }
+            if (error_ != 0) {
+                return error_;
+            }
+            if (eof_ && pos_ >= next_offset_ && !file_grew()) {
+                return AVERROR_EOF;
+            }
+
+            if (!stalled) {
+                stalled = true;
+                graph_->set_tag(diagnostics::tag_severity::WARNING, "io-stall");
+            }
+
+            cond_.wait_for(lock, std::chrono::milliseconds(20));
+
+            if (interrupted()) {
+                return AVERROR_EXIT;
+            }
+        }
+    }
+
+    int64_t seek(int64_t offset, int whence)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (whence & AVSEEK_SIZE) {
+            return file_size_;
+        }
+
+        int64_t target = 0;
+        switch (whence & ~AVSEEK_FORCE) {
+            case SEEK_SET:
+                target = offset;
+                break;
+            case SEEK_CUR:
+                target = pos_ + offset;
+                break;
+            case SEEK_END:
+                target = file_size_ + offset;
+                break;
+            default:
+                return AVERROR(EINVAL);
+        }
+
+        if (target < 0) {
+            return AVERROR(EINVAL);
+        }
+
+        pos_ = target;
+
+        const auto begin = blocks_.empty() ? next_offset_ : blocks_.front().offset;
+        if (target < begin || target > next_offset_) {
+            // Outside of the buffered data, discard it and start over at the target.
+            for (auto& block : blocks_) {
+                recycle(std::move(block));
+            }
+            blocks_.clear();
+            next_offset_ = target / ALIGNMENT * ALIGNMENT;
+            generation_ += 1;
+            error_ = 0;
+            eof_   = false;
+        }
+
+        cond_.notify_all();
+
+        return target;
+    }
+
+    static int read_cb(void* opaque, std::uint8_t* buf, int size)
+    {
+        return static_cast<Impl*>(opaque)->read(buf, size);
+    }
+
+    static int64_t seek_cb(void* opaque, int64_t offset, int whence)
+    {
+        return static_cast<Impl*>(opaque)->seek(offset, whence);
+    }
+};
+
+FileReader::FileReader(std::unique_ptr<Impl> impl)
+    : impl_(std::move(impl))
+{
+}
+
+FileReader::~FileReader() {}
+
+std::shared_ptr<FileReader> FileReader::open(const std::string&                  filename,
+                                             bool                                seekable,
+                                             const AVIOInterruptCB&              interrupt,
+                                             std::shared_ptr<diagnostics::graph> graph)
+{
+    const auto capacity =
+        env::properties().get(L"configuration.ffmpeg.producer.read-ahead", std::size_t(32)) * 1024 * 1024;
+    if (capacity == 0) {
+        return nullptr;
+    }
+
+    boost::system::error_code ec;
+    const auto                path = boost::filesystem::path(u16(filename));
+    if (!boost::filesystem::is_regular_file(path, ec)) {
+        return nullptr;
+    }
+
+    const auto file_size = boost::filesystem::file_size(path, ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    const auto direct = env::properties().get(L"configuration.ffmpeg.producer.direct-io", false);
+
+    std::unique_ptr<Impl> impl(new Impl(
+        filename, static_cast<int64_t>(file_size), capacity, direct, interrupt, std::move(graph)));
+    if (!impl->file_.is_open()) {
+        // Left to FFmpeg, which reports why.
+        return nullptr;
+    }
+
+    impl->start(seekable);
+
+    return std::shared_ptr<FileReader>(new FileReader(std::move(impl)));
+}
+
+AVIOContext* FileReader::context() const { return impl_->ctx_; }
+
+}} // namespace caspar::ffmpeg
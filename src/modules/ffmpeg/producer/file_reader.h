@@ -0,0 +1,37 @@
+#pragma once
+
+#include <common/diagnostics/graph.h>
+
+#include <memory>
+#include <string>
+
+struct AVIOContext;
+struct AVIOInterruptCB;
+
+namespace caspar { namespace ffmpeg {
+
+// Reads a local file for the demuxer on a thread of its own, in large blocks well ahead of the read position, so
+// that latency spikes of network storage are absorbed by buffered data instead of stalling playback.
+class FileReader
+{
+  public:
+    // Returns nullptr if read-ahead is disabled or filename isn't a regular file.
+    static std::shared_ptr<FileReader> open(const std::string&                  filename,
+                                            bool                                seekable,
+                                            const AVIOInterruptCB&              interrupt,
+                                            std::shared_ptr<diagnostics::graph> graph);
+
+    ~FileReader();
+
+    // Set as AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO. The reader must outlive the format context.
+    AVIOContext* context() const;
+
+  private:
+    struct Impl;
+
+    explicit FileReader(std::unique_ptr<Impl> impl);
+
+    std::unique_ptr<Impl> impl_;
+};
+
+}} // namespace caspar::ffmpeg
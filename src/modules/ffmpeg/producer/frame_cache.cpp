@@ -0,0 +1,119 @@
+#include "frame_cache.h"
+
+#include <common/env.h>
+#include <common/log.h>
+#include <common/utf.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace caspar { namespace ffmpeg {
+
+struct FrameCache::Impl
+{
+    struct Entry
+    {
+        std::shared_ptr<const CachedClip> clip;
+        std::list<std::string>::iterator  lru;
+    };
+
+    const std::size_t max_size_ =
+        env::properties().get(L"configuration.ffmpeg.producer.cache.max-size", 0ULL) * 1024 * 1024;
+    const std::size_t max_clip_size_ =
+        env::properties().get(L"configuration.ffmpeg.producer.cache.max-clip-size", 256ULL) * 1024 * 1024;
+
+    std::mutex                             mutex_;
+    std::list<std::string>                 lru_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::size_t                            size_ = 0;
+
+    std::shared_ptr<const CachedClip> find(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return nullptr;
+        }
+
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second.clip;
+    }
+
+    void insert(const std::string& key, std::shared_ptr<const CachedClip> clip)
+    {
+        if (!clip || clip->size > max_clip_size() || clip->size > max_size_) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (entries_.find(key) != entries_.end()) {
+            return;
+        }
+
+        size_ += clip->size;
+        lru_.push_front(key);
+        entries_[key] = Entry{std::move(clip), lru_.begin()};
+
+        while (size_ > max_size_ && !lru_.empty()) {
+            auto it = entries_.find(lru_.back());
+            size_ -= it->second.clip->size;
+            CASPAR_LOG(debug) << L"ffmpeg[" << u16(it->first) << L"] Evicted from frame cache.";
+            entries_.erase(it);
+            lru_.pop_back();
+        }
+
+        CASPAR_LOG(debug) << L"ffmpeg[" << u16(key) << L"] Cached. Frame cache size: " << size_ / (1024 * 1024)
+                          << L" MB";
+    }
+
+    std::size_t max_clip_size() const { return std::min(max_clip_size_, max_size_); }
+};
+
+FrameCache::FrameCache()
+    : impl_(new Impl())
+{
+}
+
+FrameCache& FrameCache::instance()
+{
+    static FrameCache cache;
+    return cache;
+}
+
+std::string FrameCache::key(const std::string&             path,
+                            const std::string&             vfilter,
+                            const std::string&             afilter,
+                            const core::video_format_desc& format_desc)
+{
+    if (boost::contains(path, "://")) {
+        return "";
+    }
+
+    boost::system::error_code ec;
+    const auto                mtime = boost::filesystem::last_write_time(boost::filesystem::path(u16(path)), ec);
+    if (ec) {
+        return "";
+    }
+
+    return path + "|" + std::to_string(mtime) + "|" + vfilter + "|" + afilter + "|" + u8(format_desc.name);
+}
+
+std::shared_ptr<const CachedClip> FrameCache::find(const std::string& key) { return impl_->find(key); }
+
+void FrameCache::insert(const std::string& key, std::shared_ptr<const CachedClip> clip)
+{
+    impl_->insert(key, std::move(clip));
+}
+
+std::size_t FrameCache::max_clip_size() const { return impl_->max_clip_size(); }
+
+}} // namespace caspar::ffmpeg
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <core/frame/draw_frame.h>
+#include <core/monitor/monitor.h>
+#include <core/video_format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace caspar { namespace ffmpeg {
+
+// A completely decoded clip, shared by every producer playing the same file with the same filters and format.
+struct CachedClip
+{
+    struct Frame
+    {
+        core::draw_frame frame;
+        int64_t          pts      = 0;
+        int64_t          duration = 0;
+    };
+
+    std::vector<Frame>           frames;
+    int64_t                      duration = 0; // AV_TIME_BASE units.
+    std::size_t                  size     = 0; // Bytes of image and audio data.
+    caspar::core::monitor::state streams;
+};
+
+// Process wide, memory budgeted cache of decoded clips, disabled unless ffmpeg/producer/cache/max-size is set.
+// Entries are evicted least recently used first, clips still being played stay alive until their last producer
+// releases them.
+class FrameCache
+{
+  public:
+    static FrameCache& instance();
+
+    // Returns an empty key if the file can't be cached, e.g. if it isn't a local file.
+    static std::string key(const std::string&             path,
+                           const std::string&             vfilter,
+                           const std::string&             afilter,
+                           const core::video_format_desc& format_desc);
+
+    std::shared_ptr<const CachedClip> find(const std::string& key);
+    void                              insert(const std::string& key, std::shared_ptr<const CachedClip> clip);
+
+    // Largest clip, in bytes, that will be kept. Zero if caching is disabled.
+    std::size_t max_clip_size() const;
+
+  private:
+    FrameCache();
+
+    struct Impl;
+    std::shared_ptr<Impl> impl_;
+};
+
+}} // namespace caspar::ffmpeg
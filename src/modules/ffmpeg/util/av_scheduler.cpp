@@ -0,0 +1,37 @@
+#include "av_scheduler.h"
+
+#include <common/log.h>
+
+#include <tbb/task_arena.h>
+
+#include <utility>
+
+namespace caspar { namespace ffmpeg {
+
+namespace {
+
+tbb::task_arena& arena(av_priority priority)
+{
+    // Both arenas share the tbb worker threads, which serve the high priority arena first.
+    static tbb::task_arena high(tbb::task_arena::automatic, 1, tbb::task_arena::priority::high);
+    static tbb::task_arena normal(tbb::task_arena::automatic, 1, tbb::task_arena::priority::normal);
+
+    return priority == av_priority::high ? high : normal;
+}
+
+} // namespace
+
+void av_enqueue(av_priority priority, std::function<void()> work)
+{
+    arena(priority).enqueue([work = std::move(work)] {
+        try {
+            work();
+        } catch (...) {
+            CASPAR_LOG_CURRENT_EXCEPTION();
+        }
+    });
+}
+
+void av_execute(av_priority priority, const std::function<void()>& work) { arena(priority).execute(work); }
+
+}} // namespace caspar::ffmpeg
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <functional>
+
+namespace caspar { namespace ffmpeg {
+
+// Decoding and filtering of all producers runs on one set of worker threads, sized to the number of cores, rather
+// than on threads of their own. Work of producers that are being played is preferred over preloaded ones.
+enum class av_priority
+{
+    normal,
+    high
+};
+
+// Queues work without waiting for it. Work of the same priority starts in the order it was queued. Exceptions
+// are logged.
+void av_enqueue(av_priority priority, std::function<void()> work);
+
+// Runs work, which may use tbb algorithms, on the workers and waits for it. Exceptions are rethrown.
+void av_execute(av_priority priority, const std::function<void()>& work);
+
+}} // namespace caspar::ffmpeg
@@ -19,8 +19,162 @@ extern "C" {
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_invoke.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
 namespace caspar { namespace ffmpeg {
 
+namespace {
+
+// Image planes of a decoded picture, allocated by the frame factory. The first make_frame of the picture takes
+// the factory frame, repeated ones (e.g. fps filter duplicates) share the planes with a new one.
+struct frame_buffer
+{
+    std::mutex                           mutex;
+    std::unique_ptr<core::mutable_frame> frame;
+    std::vector<array<std::uint8_t>>     planes;
+};
+
+void free_frame_buffer(void* opaque, uint8_t* data) { delete static_cast<std::shared_ptr<frame_buffer>*>(opaque); }
+
+std::unique_ptr<core::mutable_frame> share_frame_buffer(const void*                    tag,
+                                                        core::frame_factory&           frame_factory,
+                                                        const AVFrame&                 video,
+                                                        const core::pixel_format_desc& desc)
+{
+    // Only set by get_frame_buffer. Filters copy it to the frames they output, hence the checks below.
+    if (!video.opaque_ref) {
+        return nullptr;
+    }
+
+    const auto buffer = *static_cast<std::shared_ptr<frame_buffer>*>(av_buffer_get_opaque(video.opaque_ref));
+
+    if (buffer->planes.size() != desc.planes.size()) {
+        return nullptr;
+    }
+
+    for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n) {
+        if (video.data[n] != buffer->planes[n].data() || video.linesize[n] != desc.planes[n].linesize ||
+            static_cast<std::size_t>(desc.planes[n].size) > buffer->planes[n].size()) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<core::mutable_frame> frame;
+    {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        frame = std::move(buffer->frame);
+    }
+
+    const auto matches = [&](const core::pixel_format_desc& other) {
+        if (other.format != desc.format || other.planes.size() != desc.planes.size()) {
+            return false;
+        }
+        for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n) {
+            if (other.planes[n].width != desc.planes[n].width || other.planes[n].height != desc.planes[n].height ||
+                other.planes[n].linesize != desc.planes[n].linesize) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (!frame || !matches(frame->pixel_format_desc())) {
+        frame = std::make_unique<core::mutable_frame>(frame_factory.create_frame(tag, desc));
+    }
+
+    for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n) {
+        frame->image_data(n) =
+            array<std::uint8_t>(buffer->planes[n].data(), desc.planes[n].size, buffer->planes[n], buffer);
+    }
+
+    return frame;
+}
+
+} // namespace
+
+int get_frame_buffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+{
+    const auto allocator = static_cast<frame_allocator*>(ctx->opaque);
+
+    if (!allocator || !allocator->frame_factory || ctx->codec_type != AVMEDIA_TYPE_VIDEO || ctx->hw_frames_ctx) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    const auto format = static_cast<AVPixelFormat>(frame->format);
+
+    // The decoder writes into the aligned dimensions while the output is cropped to the context dimensions.
+    int width  = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesize_align);
+
+    const auto output_width  = ctx->width > 0 ? std::min(ctx->width, frame->width) : frame->width;
+    const auto output_height = ctx->height > 0 ? std::min(ctx->height, frame->height) : frame->height;
+
+    std::vector<int> data_map;
+    auto             desc         = pixel_format_desc(format, output_width, output_height, data_map);
+    const auto       aligned_desc = pixel_format_desc(format, width, height, data_map);
+
+    if (desc.format == core::pixel_format::invalid || !data_map.empty() ||
+        desc.planes.size() != aligned_desc.planes.size()) {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n) {
+        auto&      plane = desc.planes[n];
+        const auto align = std::max(1, linesize_align[n]);
+
+        if (aligned_desc.planes[n].linesize > plane.linesize || plane.linesize % align != 0) {
+            return avcodec_default_get_buffer2(ctx, frame, flags);
+        }
+
+        // Same padding as avcodec_default_get_buffer2.
+        plane.size = std::max(plane.size, plane.linesize * aligned_desc.planes[n].height + 16 + align - 1);
+    }
+
+    auto buffer   = std::make_shared<frame_buffer>();
+    buffer->frame = std::make_unique<core::mutable_frame>(allocator->frame_factory->create_frame(allocator->tag, desc));
+
+    for (int n = 0; n < static_cast<int>(desc.planes.size()); ++n) {
+        auto& data = buffer->frame->image_data(n);
+        if (reinterpret_cast<std::uintptr_t>(data.data()) % std::max(1, linesize_align[n]) != 0) {
+            return avcodec_default_get_buffer2(ctx, frame, flags);
+        }
+        buffer->planes.push_back(std::move(data));
+    }
+
+    for (int n = 0; n < static_cast<int>(buffer->planes.size()); ++n) {
+        auto& plane = buffer->planes[n];
+        auto  ref   = new std::shared_ptr<frame_buffer>(buffer);
+
+        frame->buf[n] = av_buffer_create(plane.data(), static_cast<int>(plane.size()), free_frame_buffer, ref, 0);
+        if (!frame->buf[n]) {
+            delete ref;
+            for (int m = 0; m < n; ++m) {
+                av_buffer_unref(&frame->buf[m]);
+            }
+            return AVERROR(ENOMEM);
+        }
+
+        frame->data[n]     = plane.data();
+        frame->linesize[n] = desc.planes[n].linesize;
+    }
+    frame->extended_data = frame->data;
+
+    frame->opaque_ref = av_buffer_ref(frame->buf[0]);
+    if (!frame->opaque_ref) {
+        for (int n = 0; n < static_cast<int>(buffer->planes.size()); ++n) {
+            av_buffer_unref(&frame->buf[n]);
+        }
+        return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
 std::shared_ptr<AVFrame> alloc_frame()
 {
     const auto frame = std::shared_ptr<AVFrame>(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
@@ -37,6 +191,129 @@ std::shared_ptr<AVPacket> alloc_packet()
     return packet;
 }
 
+namespace {
+
+template <typename T>
+struct av_free_list
+{
+    std::mutex               mutex;
+    std::vector<T*>          items;
+    const std::size_t        capacity;
+    std::atomic<std::size_t> in_use{0};
+    std::atomic<std::size_t> high_water{0};
+
+    explicit av_free_list(std::size_t capacity)
+        : capacity(capacity)
+    {
+    }
+
+    T* pop()
+    {
+        const auto count = ++in_use;
+        auto       prev  = high_water.load();
+        while (prev < count && !high_water.compare_exchange_weak(prev, count))
+            ;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return nullptr;
+        }
+        auto item = items.back();
+        items.pop_back();
+        return item;
+    }
+
+    // Returns false if the pool is full and the item should be freed.
+    bool push(T* item)
+    {
+        --in_use;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= capacity) {
+            return false;
+        }
+        items.push_back(item);
+        return true;
+    }
+};
+
+} // namespace
+
+struct av_pool::impl
+{
+    av_free_list<AVFrame>  frames{64};
+    av_free_list<AVPacket> packets{512};
+
+    ~impl()
+    {
+        for (auto frame : frames.items) {
+            av_frame_free(&frame);
+        }
+        for (auto packet : packets.items) {
+            av_packet_free(&packet);
+        }
+    }
+};
+
+av_pool::av_pool()
+    : impl_(std::make_shared<impl>())
+{
+}
+
+std::shared_ptr<AVFrame> av_pool::alloc_frame() const
+{
+    auto frame = impl_->frames.pop();
+    if (!frame) {
+        frame = av_frame_alloc();
+    }
+    if (!frame) {
+        --impl_->frames.in_use;
+        FF_RET(AVERROR(ENOMEM), "av_frame_alloc");
+    }
+
+    // The pool may be destroyed before the frames it handed out.
+    return std::shared_ptr<AVFrame>(frame, [weak = std::weak_ptr<impl>(impl_)](AVFrame* ptr) {
+        auto pool = weak.lock();
+        if (pool) {
+            av_frame_unref(ptr);
+            if (pool->frames.push(ptr)) {
+                return;
+            }
+        }
+        av_frame_free(&ptr);
+    });
+}
+
+std::shared_ptr<AVPacket> av_pool::alloc_packet() const
+{
+    auto packet = impl_->packets.pop();
+    if (!packet) {
+        packet = av_packet_alloc();
+    }
+    if (!packet) {
+        --impl_->packets.in_use;
+        FF_RET(AVERROR(ENOMEM), "av_packet_alloc");
+    }
+
+    return std::shared_ptr<AVPacket>(packet, [weak = std::weak_ptr<impl>(impl_)](AVPacket* ptr) {
+        auto pool = weak.lock();
+        if (pool) {
+            av_packet_unref(ptr);
+            if (pool->packets.push(ptr)) {
+                return;
+            }
+        }
+        av_packet_free(&ptr);
+    });
+}
+
+std::size_t av_pool::frames_in_use() const { return impl_->frames.in_use; }
+std::size_t av_pool::packets_in_use() const { return impl_->packets.in_use; }
+std::size_t av_pool::frames_high_water() const { return impl_->frames.high_water; }
+std::size_t av_pool::packets_high_water() const { return impl_->packets.high_water; }
+std::size_t av_pool::frames_capacity() const { return impl_->frames.capacity; }
+std::size_t av_pool::packets_capacity() const { return impl_->packets.capacity; }
+
 core::mutable_frame make_frame(void*                    tag,
                                core::frame_factory&     frame_factory,
                                std::shared_ptr<AVFrame> video,
@@ -48,10 +325,11 @@ core::mutable_frame make_frame(void*                    tag,
         video ? pixel_format_desc(static_cast<AVPixelFormat>(video->format), video->width, video->height, data_map)
               : core::pixel_format_desc(core::pixel_format::invalid);
 
-    auto frame = frame_factory.create_frame(tag, pix_desc);
+    auto shared = video ? share_frame_buffer(tag, frame_factory, *video, pix_desc) : nullptr;
+    auto frame  = shared ? std::move(*shared) : frame_factory.create_frame(tag, pix_desc);
 
     tbb::parallel_invoke([&]() {
-        if (video) {
+        if (video && !shared) {
             for (int n = 0; n < static_cast<int>(pix_desc.planes.size()); ++n) {
                 auto frame_plan_index = data_map.empty() ? n : data_map.at(n);
 
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <libavutil/pixfmt.h>
 
 #include <core/frame/frame.h>
@@ -15,9 +17,47 @@ struct AVDictionary;
 
 namespace caspar { namespace ffmpeg {
 
+// Set as AVCodecContext::opaque together with get_frame_buffer.
+struct frame_allocator
+{
+    std::shared_ptr<core::frame_factory> frame_factory;
+    const void*                          tag = nullptr;
+};
+
+// AVCodecContext::get_buffer2 callback which decodes video directly into frame_factory buffers, which make_frame
+// then passes on without copying. Falls back to the default allocator for layouts the frame factory can't describe.
+int get_frame_buffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+
 std::shared_ptr<AVFrame>  alloc_frame();
 std::shared_ptr<AVPacket> alloc_packet();
 
+// Recycles AVFrame and AVPacket structs between the threads of a producer. Frames and packets are unreferenced
+// when released, only the structs (and their side allocations) are reused. Copies share the same pool.
+class av_pool
+{
+  public:
+    av_pool();
+
+    std::shared_ptr<AVFrame>  alloc_frame() const;
+    std::shared_ptr<AVPacket> alloc_packet() const;
+
+    // Number of frames and packets currently in use.
+    std::size_t frames_in_use() const;
+    std::size_t packets_in_use() const;
+
+    // Largest number of frames and packets that have been in use at the same time.
+    std::size_t frames_high_water() const;
+    std::size_t packets_high_water() const;
+
+    // Number of unused frames and packets that are kept for reuse.
+    std::size_t frames_capacity() const;
+    std::size_t packets_capacity() const;
+
+  private:
+    struct impl;
+    std::shared_ptr<impl> impl_;
+};
+
 core::pixel_format      get_pixel_format(AVPixelFormat pix_fmt);
 core::pixel_format_desc pixel_format_desc(AVPixelFormat pix_fmt, int width, int height, std::vector<int>& data_map);
 core::mutable_frame     make_frame(void*                    tag,
@@ -29,6 +29,10 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <deque>
+#include <memory>
+#include <mutex>
+
 namespace caspar { namespace protocol { namespace amcp {
 
 struct command_context
@@ -47,6 +51,10 @@ struct command_context
     std::string                                          proxy_port;
     std::weak_ptr<accelerator::accelerator_device>       ogl_device;
 
+    // Set by a command whose reply has to wait for something, instead of blocking its queue. The queue calls it
+    // elsewhere and replies with what it returns.
+    std::function<std::wstring()> deferred_reply;
+
     int layer_index(int default_ = 0) const { return layer_id == -1 ? default_ : layer_id; }
 
     command_context(IO::ClientInfoPtr                                    client,
@@ -79,6 +87,57 @@ struct command_context
 
 using amcp_command_func = std::function<std::wstring(command_context& args)>;
 
+// Commands received on one connection execute on different queues. Their replies are held back here until the
+// replies to everything received before them are sent, so that a client can pipeline commands.
+class reply_sequence
+{
+  public:
+    struct slot
+    {
+        std::wstring reply;
+        bool         skip_log = false;
+        bool         done     = false;
+    };
+
+    explicit reply_sequence(IO::ClientInfoPtr client)
+        : client_(std::move(client))
+    {
+    }
+
+    std::shared_ptr<slot> reserve()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.push_back(std::make_shared<slot>());
+        return slots_.back();
+    }
+
+    // An empty reply only releases the replies after it.
+    void complete(const std::shared_ptr<slot>& s, std::wstring reply, bool skip_log = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (s->done)
+            return;
+
+        s->reply    = std::move(reply);
+        s->skip_log = skip_log;
+        s->done     = true;
+
+        while (!slots_.empty() && slots_.front()->done) {
+            auto front = std::move(slots_.front());
+            slots_.pop_front();
+
+            if (!front->reply.empty())
+                client_->send(std::move(front->reply), front->skip_log);
+        }
+    }
+
+  private:
+    IO::ClientInfoPtr                 client_;
+    std::mutex                        mutex_;
+    std::deque<std::shared_ptr<slot>> slots_;
+};
+
 class AMCPCommand
 {
   private:
@@ -89,6 +148,9 @@ class AMCPCommand
     std::wstring      replyString_;
     std::wstring      request_id_;
 
+    std::shared_ptr<reply_sequence>       sequence_;
+    std::shared_ptr<reply_sequence::slot> slot_;
+
   public:
     AMCPCommand(const command_context&   ctx,
                 const amcp_command_func& command,
@@ -101,6 +163,17 @@ class AMCPCommand
     {
     }
 
+    ~AMCPCommand()
+    {
+        // Don't hold back the replies after this one if it was never sent.
+        if (slot_) {
+            try {
+                sequence_->complete(slot_, L"");
+            } catch (...) {
+            }
+        }
+    }
+
     using ptr_type = std::shared_ptr<AMCPCommand>;
 
     bool Execute()
@@ -111,8 +184,15 @@ class AMCPCommand
 
     int minimum_parameters() const { return min_num_params_; }
 
+    std::function<std::wstring()> deferred_reply() const { return ctx_.deferred_reply; }
+
     void SendReply()
     {
+        if (slot_) {
+            sequence_->complete(slot_, std::move(replyString_));
+            return;
+        }
+
         if (replyString_.empty())
             return;
 
@@ -123,10 +203,21 @@ class AMCPCommand
 
     IO::ClientInfoPtr client() { return ctx_.client; }
 
+    // -1 for commands which don't target a channel, or which don't specify a layer.
+    int channel_index() const { return ctx_.channel_index; }
+    int layer_id() const { return ctx_.layer_id; }
+
     std::wstring print() const { return name_; }
 
     void set_request_id(std::wstring request_id) { request_id_ = std::move(request_id); }
 
+    // Must be called in the order the commands were received.
+    void set_reply_sequence(std::shared_ptr<reply_sequence> sequence)
+    {
+        slot_     = sequence->reserve();
+        sequence_ = std::move(sequence);
+    }
+
     void SetReplyString(const std::wstring& str)
     {
         if (request_id_.empty())
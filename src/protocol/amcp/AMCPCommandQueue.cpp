@@ -23,9 +23,11 @@
 
 #include "AMCPCommandQueue.h"
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include <common/except.h>
-#include <common/timer.h>
+
+#include <core/producer/cg_proxy.h>
 
 namespace caspar { namespace protocol { namespace amcp {
 
@@ -45,11 +47,65 @@ std::map<std::wstring, AMCPCommandQueue*>& get_instances()
     return queues;
 }
 
+bool is_load(AMCPCommand& command)
+{
+    const auto name = command.print();
+
+    // PLAY with a clip loads it to the background first.
+    return name == L"LOAD" || name == L"LOADBG" || name == L"CG ADD" || boost::starts_with(name, L"DATA ") ||
+           (name == L"PLAY" && !command.parameters().empty());
+}
+
+// Deferred MIXER commands are left alone since MIXER COMMIT applies all of them in order, as is MIXER GRID which sets
+// every layer. Without parameters a MIXER command is a query.
+bool is_coalescable(AMCPCommand& command)
+{
+    const auto  name   = command.print();
+    const auto& params = command.parameters();
+
+    return command.channel_index() >= 0 && boost::starts_with(name, L"MIXER ") && name != L"MIXER CLEAR" &&
+           name != L"MIXER COMMIT" && name != L"MIXER GRID" && !params.empty() &&
+           !boost::iequals(params.back(), L"DEFER");
+}
+
+// The layer a channel command acts on, or -1 for the whole channel. Without a layer id, loads, playback and MIXER
+// properties act on layer 0 and CG on its default layer. Anything else, e.g. CLEAR or MIXER CLEAR, is taken to act on
+// every layer.
+int target_layer(AMCPCommand& command)
+{
+    if (command.layer_id() != -1)
+        return command.layer_id();
+
+    const auto name = command.print();
+
+    if (boost::starts_with(name, L"CG "))
+        return static_cast<int>(core::cg_proxy::DEFAULT_LAYER);
+
+    if (name == L"LOAD" || name == L"LOADBG" || name == L"PLAY" || name == L"PAUSE" || name == L"RESUME" ||
+        name == L"CALL" || is_coalescable(command))
+        return 0;
+
+    return -1;
+}
+
+// Layer -1 is the whole channel.
+bool overlaps(int layer, int other) { return layer == -1 || other == -1 || layer == other; }
+
 } // namespace
 
-AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name)
-    : executor_(L"AMCPCommandQueue " + name)
+AMCPCommandQueue::AMCPCommandQueue(const std::wstring& name, std::function<void(core::monitor::state)> monitor)
+    : monitor_(std::move(monitor))
+    , executor_(L"AMCPCommandQueue " + name)
+    , load_executor_(L"AMCPCommandQueue " + name + L" loads")
+    , reply_executor_(L"AMCPCommandQueue " + name + L" replies")
 {
+    graph_->set_text(L"AMCPCommandQueue " + name);
+    graph_->set_color("queue-wait", diagnostics::color(0.9f, 0.9f, 0.1f));
+    graph_->set_color("execute-time", diagnostics::color(0.1f, 1.0f, 0.1f));
+    graph_->set_color("queue-overflow", diagnostics::color(0.6f, 0.3f, 0.9f));
+    graph_->set_color("coalesced", diagnostics::color(0.3f, 0.6f, 0.3f));
+    diagnostics::register_graph(graph_);
+
     std::lock_guard<std::mutex> lock(get_global_mutex());
 
     get_instances().insert(std::make_pair(name, this));
@@ -67,59 +123,200 @@ void AMCPCommandQueue::AddCommand(AMCPCommand::ptr_type pCurrentCommand)
     if (!pCurrentCommand)
         return;
 
-    if (executor_.size() > 128) {
-        try {
-            CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
-            CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
-            pCurrentCommand->SetReplyString(L"504 QUEUE OVERFLOW\r\n");
-            pCurrentCommand->SendReply();
-        } catch (...) {
-            CASPAR_LOG_CURRENT_EXCEPTION();
+    const auto is_channel_command = pCurrentCommand->channel_index() >= 0;
+    const auto layer              = target_layer(*pCurrentCommand);
+
+    auto on_load_lane = is_load(*pCurrentCommand);
+
+    superseded_flag superseded;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // A command to a layer which has a load queued must run after it.
+        if (!on_load_lane && is_channel_command) {
+            for (auto& pending : pending_loads_) {
+                if (overlaps(pending.first, layer))
+                    on_load_lane = true;
+            }
+        }
+
+        if ((on_load_lane ? load_executor_ : executor_).size() > 128) {
+            try {
+                graph_->set_tag(diagnostics::tag_severity::WARNING, "queue-overflow");
+                CASPAR_LOG(error) << "AMCP Command Queue Overflow.";
+                CASPAR_LOG(error) << "Failed to execute command:" << pCurrentCommand->print();
+                pCurrentCommand->SetReplyString(L"504 QUEUE OVERFLOW\r\n");
+                pCurrentCommand->SendReply();
+            } catch (...) {
+                CASPAR_LOG_CURRENT_EXCEPTION();
+            }
+            return;
+        }
+
+        if (is_coalescable(*pCurrentCommand)) {
+            superseded = std::make_shared<std::atomic<bool>>(false);
+
+            auto& latest = latest_mixer_[std::make_pair(layer, pCurrentCommand->print())];
+            if (latest)
+                *latest = true;
+            latest = superseded;
+        } else if (is_channel_command) {
+            // Anything else to the layer may depend on what the MIXER commands before it set.
+            for (auto it = latest_mixer_.begin(); it != latest_mixer_.end();) {
+                if (overlaps(it->first.first, layer))
+                    it = latest_mixer_.erase(it);
+                else
+                    ++it;
+            }
         }
+
+        if (on_load_lane && is_channel_command)
+            pending_loads_[layer] += 1;
+
+        (on_load_lane ? load_depth_ : depth_) += 1;
+        publish();
+    }
+
+    caspar::timer queued;
+
+    if (!on_load_lane) {
+        executor_.begin_invoke([=] { execute(pCurrentCommand, queued, superseded, false); });
         return;
     }
 
-    executor_.begin_invoke([=] {
-        try {
-            try {
-                caspar::timer timer;
+    // Everything queued before this on the real-time lane must run before it.
+    auto fence = executor_.begin_invoke([] {}).share();
 
-                auto print  = pCurrentCommand->print();
-                auto params = boost::join(pCurrentCommand->parameters(), L" ");
+    load_executor_.begin_invoke([=] {
+        fence.wait();
 
-                CASPAR_LOG(debug) << "Executing command: " << print;
+        execute(pCurrentCommand, queued, superseded, true);
 
-                if (pCurrentCommand->Execute())
-                    CASPAR_LOG(debug) << "Executed command (" << timer.elapsed() << "s): " << print;
-                else
-                    CASPAR_LOG(warning) << "Failed to execute command: " << print;
-            } catch (file_not_found&) {
-                CASPAR_LOG(error) << " Turn on log level debug for stacktrace.";
-                pCurrentCommand->SetReplyString(L"404 " + pCurrentCommand->print() + L" FAILED\r\n");
-            } catch (expected_user_error&) {
-                pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
-            } catch (user_error&) {
-                CASPAR_LOG(error) << " Check syntax. Turn on log level debug for stacktrace.";
-                pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
-            } catch (std::out_of_range&) {
-                CASPAR_LOG(error) << L"Missing parameter. Check syntax. Turn on log level debug for stacktrace.";
-                pCurrentCommand->SetReplyString(L"402 " + pCurrentCommand->print() + L" FAILED\r\n");
-            } catch (boost::bad_lexical_cast&) {
-                CASPAR_LOG(error) << L"Invalid parameter. Check syntax. Turn on log level debug for stacktrace.";
-                pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
-            } catch (...) {
-                CASPAR_LOG_CURRENT_EXCEPTION();
-                CASPAR_LOG(error) << "Failed to execute command: " << pCurrentCommand->print();
-                pCurrentCommand->SetReplyString(L"501 " + pCurrentCommand->print() + L" FAILED\r\n");
+        if (is_channel_command) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = pending_loads_.find(layer);
+            if (it != pending_loads_.end() && --it->second == 0)
+                pending_loads_.erase(it);
+        }
+    });
+}
+
+void AMCPCommandQueue::execute(const AMCPCommand::ptr_type& pCurrentCommand,
+                               const caspar::timer&         queued,
+                               const superseded_flag&       superseded,
+                               bool                         on_load_lane)
+{
+    try {
+        auto print = pCurrentCommand->print();
+        auto wait  = queued.elapsed();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            (on_load_lane ? load_depth_ : depth_) -= 1;
+            last_wait_ = wait;
+            publish();
+        }
+
+        if (superseded) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                auto it = latest_mixer_.find(std::make_pair(target_layer(*pCurrentCommand), print));
+                if (it != latest_mixer_.end() && it->second == superseded)
+                    latest_mixer_.erase(it);
             }
 
-            pCurrentCommand->SendReply();
+            if (*superseded) {
+                CASPAR_LOG(debug) << "Skipped superseded command (" << wait << "s queued): " << print;
+                graph_->set_tag(diagnostics::tag_severity::SILENT, "coalesced");
+                pCurrentCommand->SetReplyString(L"202 MIXER OK\r\n");
+                pCurrentCommand->SendReply();
+                return;
+            }
+        }
 
-            CASPAR_LOG(trace) << "Ready for a new command";
+        caspar::timer timer;
+
+        try {
+            CASPAR_LOG(debug) << "Executing command (" << wait << "s queued): " << print;
+
+            if (pCurrentCommand->Execute())
+                CASPAR_LOG(debug) << "Executed command (" << wait << "s queued, " << timer.elapsed()
+                                  << "s): " << print;
+            else
+                CASPAR_LOG(warning) << "Failed to execute command: " << print;
+        } catch (file_not_found&) {
+            CASPAR_LOG(error) << " Turn on log level debug for stacktrace.";
+            pCurrentCommand->SetReplyString(L"404 " + pCurrentCommand->print() + L" FAILED\r\n");
+        } catch (expected_user_error&) {
+            pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
+        } catch (user_error&) {
+            CASPAR_LOG(error) << " Check syntax. Turn on log level debug for stacktrace.";
+            pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
+        } catch (std::out_of_range&) {
+            CASPAR_LOG(error) << L"Missing parameter. Check syntax. Turn on log level debug for stacktrace.";
+            pCurrentCommand->SetReplyString(L"402 " + pCurrentCommand->print() + L" FAILED\r\n");
+        } catch (boost::bad_lexical_cast&) {
+            CASPAR_LOG(error) << L"Invalid parameter. Check syntax. Turn on log level debug for stacktrace.";
+            pCurrentCommand->SetReplyString(L"403 " + pCurrentCommand->print() + L" FAILED\r\n");
         } catch (...) {
             CASPAR_LOG_CURRENT_EXCEPTION();
+            CASPAR_LOG(error) << "Failed to execute command: " << pCurrentCommand->print();
+            pCurrentCommand->SetReplyString(L"501 " + pCurrentCommand->print() + L" FAILED\r\n");
         }
-    });
+
+        {
+            const auto execute_time = timer.elapsed();
+
+            // Half way up the graph is 100ms.
+            graph_->set_value("queue-wait", wait * 5.0);
+            graph_->set_value("execute-time", execute_time * 5.0);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            last_execute_ = execute_time;
+            publish();
+        }
+
+        if (auto deferred_reply = pCurrentCommand->deferred_reply()) {
+            reply_executor_.begin_invoke([=] {
+                try {
+                    try {
+                        pCurrentCommand->SetReplyString(deferred_reply());
+                    } catch (...) {
+                        CASPAR_LOG_CURRENT_EXCEPTION();
+                        pCurrentCommand->SetReplyString(L"501 " + pCurrentCommand->print() + L" FAILED\r\n");
+                    }
+
+                    pCurrentCommand->SendReply();
+                } catch (...) {
+                    CASPAR_LOG_CURRENT_EXCEPTION();
+                }
+            });
+        } else
+            pCurrentCommand->SendReply();
+
+        CASPAR_LOG(trace) << "Ready for a new command";
+    } catch (...) {
+        CASPAR_LOG_CURRENT_EXCEPTION();
+    }
+}
+
+void AMCPCommandQueue::publish()
+{
+    if (!monitor_)
+        return;
+
+    core::monitor::state state;
+    state["depth"]      = depth_;
+    state["load-depth"] = load_depth_;
+    state["wait"]       = last_wait_;
+    state["execute"]    = last_execute_;
+
+    // Under mutex_, so that the monitor never sees an older state after a newer one.
+    monitor_(std::move(state));
 }
 
 }}} // namespace caspar::protocol::amcp
@@ -23,8 +23,19 @@
 
 #include "AMCPCommand.h"
 
+#include <common/diagnostics/graph.h>
 #include <common/executor.h>
 #include <common/memory.h>
+#include <common/timer.h>
+
+#include <core/monitor/monitor.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
 
 namespace caspar { namespace protocol { namespace amcp {
 
@@ -36,13 +47,45 @@ class AMCPCommandQueue
   public:
     using ptr_type = spl::shared_ptr<AMCPCommandQueue>;
 
-    AMCPCommandQueue(const std::wstring& name);
+    // monitor receives the queue depths, and the queue wait and execute time of the last command, whenever they
+    // change.
+    AMCPCommandQueue(const std::wstring& name, std::function<void(core::monitor::state)> monitor = nullptr);
     ~AMCPCommandQueue();
 
+    // Loads, CG ADD and DATA run on a lane of their own, so that they don't hold up the commands after them. Commands
+    // to a layer with a load queued are queued behind the load. A MIXER command which sets a property is skipped if a
+    // later one to the same layer and property is queued before it runs.
     void AddCommand(AMCPCommand::ptr_type pCommand);
 
   private:
+    using superseded_flag = std::shared_ptr<std::atomic<bool>>;
+
+    void execute(const AMCPCommand::ptr_type& command,
+                 const caspar::timer&         queued,
+                 const superseded_flag&       superseded,
+                 bool                         on_load_lane);
+
+    // Requires mutex_.
+    void publish();
+
+    spl::shared_ptr<diagnostics::graph>       graph_;
+    std::function<void(core::monitor::state)> monitor_;
+
+    std::mutex mutex_;
+    // Commands waiting on each lane, and the timings of the last command executed.
+    int    depth_        = 0;
+    int    load_depth_   = 0;
+    double last_wait_    = 0.0;
+    double last_execute_ = 0.0;
+    // Commands queued on the load lane, by layer, see target_layer.
+    std::map<int, int> pending_loads_;
+    // The last coalescable MIXER command queued, by layer and command name.
+    std::map<std::pair<int, std::wstring>, superseded_flag> latest_mixer_;
+
     executor executor_;
+    executor load_executor_;
+    // Waits for the replies a command deferred, see command_context::deferred_reply.
+    executor reply_executor_;
 };
 
 }}} // namespace caspar::protocol::amcp
@@ -52,6 +52,7 @@
 #include <core/video_format.h>
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <future>
 #include <memory>
@@ -249,6 +250,18 @@ std::wstring loadbg_command(command_context& ctx)
 
     channel->stage().load(ctx.layer_index(), transition_producer, false, auto_play); // TODO: LOOP
 
+    // Reply once a following PLAY starts on the next frame, e.g. when the clip's first frames are decoded.
+    if (contains_param(L"PREROLL", ctx.parameters)) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        ctx.deferred_reply = [transition_producer, deadline] {
+            if (!transition_producer->wait_ready(deadline))
+                CASPAR_LOG(warning) << transition_producer->print() << L" Not prerolled within 5 seconds.";
+
+            return std::wstring(L"202 LOADBG OK\r\n");
+        };
+    }
+
     return L"202 LOADBG OK\r\n";
 }
 
@@ -268,9 +281,13 @@ std::wstring load_command(command_context& ctx)
 
 std::wstring play_command(command_context& ctx)
 {
-    if (!ctx.parameters.empty())
+    if (!ctx.parameters.empty()) {
         loadbg_command(ctx);
 
+        // PLAY doesn't wait for a preroll, it replies for itself.
+        ctx.deferred_reply = nullptr;
+    }
+
     ctx.channel.channel->stage().play(ctx.layer_index());
 
     return L"202 PLAY OK\r\n";
@@ -1316,8 +1333,13 @@ std::wstring info_channel_command(command_context& ctx)
     pt::wptree info;
     pt::wptree channel_info;
 
-    auto state = ctx.channel.channel->state();
-    for (const auto& p : state) {
+    std::vector<std::pair<std::string, core::monitor::vector_t>> values;
+    ctx.channel.channel->state().for_each([&](const core::monitor::key& path, const core::monitor::vector_t& data) {
+        values.emplace_back(path.str(), data);
+    });
+    std::sort(values.begin(), values.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (const auto& p : values) {
         const auto replaced = boost::algorithm::replace_all_copy(p.first, "/", ".");
         // avoid digit-only nodes in XML
         const auto path = boost::algorithm::replace_all_regex_copy(
@@ -27,11 +27,18 @@
 #include "amcp_command_repository.h"
 #include "amcp_shared.h"
 
+#include "../util/strategy_adapters.h"
+
 #include <algorithm>
+#include <climits>
+#include <iterator>
+#include <list>
+#include <vector>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/locale/encoding_utf.hpp>
+#include <boost/utility/string_view.hpp>
 
 #if defined(_MSC_VER)
 #pragma warning(push, 1) // TODO: Legacy code, just disable warnings
@@ -41,18 +48,191 @@ namespace caspar { namespace protocol { namespace amcp {
 
 using IO::ClientInfoPtr;
 
-template <typename Out, typename In>
-bool try_lexical_cast(const In& input, Out& result)
+namespace {
+
+std::wstring to_wstring(boost::string_view str)
+{
+    return boost::locale::conv::utf_to_utf<wchar_t>(str.data(), str.data() + str.size());
+}
+
+boost::string_view trim(boost::string_view str)
+{
+    const auto is_space = [](char c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+
+    while (!str.empty() && is_space(str.front()))
+        str.remove_prefix(1);
+    while (!str.empty() && is_space(str.back()))
+        str.remove_suffix(1);
+
+    return str;
+}
+
+// Accepts what lexical_cast<int> accepts for a channel spec, without its allocations.
+bool parse_int(boost::string_view str, int& result)
 {
-    Out  saved   = result;
-    bool success = boost::conversion::detail::try_lexical_convert(input, result);
+    if (!str.empty() && str.front() == '+')
+        str.remove_prefix(1);
+
+    if (str.empty())
+        return false;
 
-    if (!success)
-        result = saved; // Needed because of how try_lexical_convert is implemented.
+    long long value = 0;
+    for (auto c : str) {
+        if (c < '0' || c > '9')
+            return false;
 
-    return success;
+        value = value * 10 + (c - '0');
+        if (value > INT_MAX)
+            return false;
+    }
+
+    result = static_cast<int>(value);
+    return true;
 }
 
+// Parses channel[-layer]. The channel index is zero based, the layer index is left as is if missing or invalid.
+bool parse_channel_spec(boost::string_view spec, int& channel_index, int& layer_index)
+{
+    spec = trim(spec);
+
+    const auto dash = spec.find('-');
+    if (!parse_int(spec.substr(0, dash), channel_index))
+        return false;
+
+    --channel_index;
+
+    if (dash != boost::string_view::npos) {
+        auto layer = spec.substr(dash + 1);
+        parse_int(layer.substr(0, layer.find('-')), layer_index);
+    }
+
+    return true;
+}
+
+// Builds a token pointing into the message, or into the arena once unescaping has changed it.
+class token_builder
+{
+    boost::string_view message_;
+    std::string&       arena_;
+    std::size_t        begin_       = 0;
+    std::size_t        length_      = 0;
+    std::size_t        arena_begin_ = std::string::npos;
+
+    void to_arena()
+    {
+        if (arena_begin_ == std::string::npos) {
+            arena_begin_ = arena_.size();
+            arena_.append(message_.data() + begin_, length_);
+        }
+    }
+
+  public:
+    token_builder(boost::string_view message, std::string& arena)
+        : message_(message)
+        , arena_(arena)
+    {
+    }
+
+    bool empty() const { return arena_begin_ == std::string::npos ? length_ == 0 : arena_.size() == arena_begin_; }
+
+    // Appends the character at pos in the message.
+    void append(std::size_t pos)
+    {
+        if (arena_begin_ != std::string::npos) {
+            arena_.push_back(message_[pos]);
+        } else if (length_ == 0) {
+            begin_  = pos;
+            length_ = 1;
+        } else if (begin_ + length_ == pos) {
+            ++length_;
+        } else {
+            to_arena();
+            arena_.push_back(message_[pos]);
+        }
+    }
+
+    // Appends a character which doesn't appear as is in the message.
+    void append_char(char c)
+    {
+        to_arena();
+        arena_.push_back(c);
+    }
+
+    boost::string_view take()
+    {
+        auto result = arena_begin_ == std::string::npos
+                          ? message_.substr(begin_, length_)
+                          : boost::string_view(arena_.data() + arena_begin_, arena_.size() - arena_begin_);
+
+        length_      = 0;
+        arena_begin_ = std::string::npos;
+
+        return result;
+    }
+};
+
+// Splits on whitespace but keeps strings within quotation marks. \ starts an escape sequence, the following char
+// indicates what to actually put in the string. The arena must have room for message.size() more characters, so that
+// tokens pointing into it aren't invalidated.
+void tokenize(boost::string_view message, std::string& arena, std::vector<boost::string_view>& tokens)
+{
+    token_builder token(message, arena);
+
+    bool inQuote        = false;
+    bool getSpecialCode = false;
+
+    for (std::size_t n = 0; n < message.size(); ++n) {
+        const auto c = message[n];
+
+        if (getSpecialCode) {
+            switch (c) {
+                case '\\':
+                    token.append_char('\\');
+                    break;
+                case '\"':
+                    token.append_char('\"');
+                    break;
+                case 'n':
+                    token.append_char('\n');
+                    break;
+                default:
+                    // Unknown escape sequences are dropped, including all bytes of a multibyte character.
+                    while (n + 1 < message.size() && (static_cast<unsigned char>(message[n + 1]) & 0xC0) == 0x80)
+                        ++n;
+                    break;
+            }
+            getSpecialCode = false;
+            continue;
+        }
+
+        if (c == '\\') {
+            getSpecialCode = true;
+            continue;
+        }
+
+        if (c == ' ' && !inQuote) {
+            if (!token.empty())
+                tokens.push_back(token.take());
+            continue;
+        }
+
+        if (c == '\"') {
+            inQuote = !inQuote;
+
+            if (!token.empty() || !inQuote)
+                tokens.push_back(token.take());
+            continue;
+        }
+
+        token.append(n);
+    }
+
+    if (!token.empty())
+        tokens.push_back(token.take());
+}
+
+} // namespace
+
 struct AMCPProtocolStrategy::impl
 {
   private:
@@ -60,14 +240,17 @@ struct AMCPProtocolStrategy::impl
     spl::shared_ptr<amcp_command_repository> repo_;
 
   public:
-    impl(const std::wstring& name, const spl::shared_ptr<amcp_command_repository>& repo)
+    impl(const std::wstring&                                   name,
+         const spl::shared_ptr<amcp_command_repository>&       repo,
+         const std::function<void(int, core::monitor::state)>& monitor)
         : repo_(repo)
     {
-        commandQueues_.push_back(spl::make_shared<AMCPCommandQueue>(L"General Queue for " + name));
+        commandQueues_.push_back(
+            spl::make_shared<AMCPCommandQueue>(L"General Queue for " + name, queue_monitor(monitor, -1)));
 
         for (int i = 0; i < repo_->channels().size(); ++i) {
-            commandQueues_.push_back(
-                spl::make_shared<AMCPCommandQueue>(L"Channel " + std::to_wstring(i + 1) + L" for " + name));
+            commandQueues_.push_back(spl::make_shared<AMCPCommandQueue>(
+                L"Channel " + std::to_wstring(i + 1) + L" for " + name, queue_monitor(monitor, i)));
         }
     }
 
@@ -93,34 +276,41 @@ struct AMCPProtocolStrategy::impl
         std::shared_ptr<AMCPCommandQueue>           queue;
     };
 
-    // The paser method expects message to be complete messages with the delimiter stripped away.
-    // Thesefore the AMCPProtocolStrategy should be decorated with a delimiter_based_chunking_strategy
-    void Parse(const std::wstring& message, ClientInfoPtr client)
+    // Parses a complete message with the delimiter stripped away. Tokens are views into the message or the arena, see
+    // tokenize(). Without a reply sequence replies are sent as soon as they are ready.
+    void Parse(boost::string_view                     message,
+               const ClientInfoPtr&                   client,
+               const std::shared_ptr<reply_sequence>& replies,
+               std::vector<boost::string_view>&       tokens,
+               std::string&                           arena)
     {
-        std::list<std::wstring> tokens;
-        tokenize(message, tokens);
+        tokens.clear();
+        tokenize(message, arena, tokens);
 
-        if (!tokens.empty() && boost::iequals(tokens.front(), L"PING")) {
-            tokens.pop_front();
-            std::wstringstream answer;
-            answer << L"PONG";
+        if (!tokens.empty() && boost::iequals(tokens.front(), "PING")) {
+            std::wstring answer = L"PONG";
 
-            for (auto t : tokens)
-                answer << L" " << t;
+            for (auto it = std::next(tokens.begin()); it != tokens.end(); ++it)
+                answer += L" " + to_wstring(*it);
 
-            answer << "\r\n";
-            client->send(answer.str(), true);
+            answer += L"\r\n";
+            send(client, replies, std::move(answer), true);
             return;
         }
 
-        CASPAR_LOG(info) << L"Received message from " << client->address() << ": " << message << L"\\r\\n";
+        CASPAR_LOG(info) << L"Received message from " << client->address() << ": " << to_wstring(message)
+                         << L"\\r\\n";
 
         command_interpreter_result result;
         if (interpret_command_string(tokens, result, client)) {
             if (result.lock && !result.lock->check_access(client))
                 result.error = error_state::access_error;
-            else
+            else {
+                if (replies)
+                    result.command->set_reply_sequence(replies);
+
                 result.queue->AddCommand(result.command);
+            }
         }
 
         if (result.error != error_state::no_error) {
@@ -131,7 +321,7 @@ struct AMCPProtocolStrategy::impl
 
             switch (result.error) {
                 case error_state::command_error:
-                    answer << L"400 ERROR\r\n" << message << "\r\n";
+                    answer << L"400 ERROR\r\n" << to_wstring(message) << "\r\n";
                     break;
                 case error_state::channel_error:
                     answer << L"401 " << result.command_name << " ERROR\r\n";
@@ -150,85 +340,96 @@ struct AMCPProtocolStrategy::impl
                                            << msg_info(L"Unhandled error_state enum constant " +
                                                        std::to_wstring(static_cast<int>(result.error))));
             }
-            client->send(answer.str());
+            send(client, replies, answer.str());
         }
     }
 
   private:
-    bool
-    interpret_command_string(std::list<std::wstring> tokens, command_interpreter_result& result, ClientInfoPtr client)
+    static std::function<void(core::monitor::state)>
+    queue_monitor(const std::function<void(int, core::monitor::state)>& monitor, int channel_index)
+    {
+        if (!monitor)
+            return nullptr;
+
+        return [monitor, channel_index](core::monitor::state queue_state) {
+            monitor(channel_index, std::move(queue_state));
+        };
+    }
+
+    static void send(const ClientInfoPtr&                   client,
+                     const std::shared_ptr<reply_sequence>& replies,
+                     std::wstring&&                         answer,
+                     bool                                   skip_log = false)
+    {
+        if (replies)
+            replies->complete(replies->reserve(), std::move(answer), skip_log);
+        else
+            client->send(std::move(answer), skip_log);
+    }
+
+    bool interpret_command_string(const std::vector<boost::string_view>& tokens,
+                                  command_interpreter_result&            result,
+                                  const ClientInfoPtr&                   client)
     {
         try {
+            std::size_t n = 0;
+
             // Discard GetSwitch
-            if (!tokens.empty() && tokens.front().at(0) == L'/')
-                tokens.pop_front();
+            if (n < tokens.size() && tokens[n].at(0) == '/')
+                ++n;
 
-            if (!tokens.empty() && boost::iequals(tokens.front(), L"REQ")) {
-                tokens.pop_front();
+            if (n < tokens.size() && boost::iequals(tokens[n], "REQ")) {
+                ++n;
 
-                if (tokens.empty()) {
+                if (n == tokens.size()) {
                     result.error = error_state::parameters_error;
                     return false;
                 }
 
-                result.request_id = tokens.front();
-                tokens.pop_front();
+                result.request_id = to_wstring(tokens[n++]);
             }
 
             // Fail if no more tokens.
-            if (tokens.empty()) {
+            if (n == tokens.size()) {
                 result.error = error_state::command_error;
                 return false;
             }
 
             // Consume command name
-            result.command_name = boost::to_upper_copy(tokens.front());
-            tokens.pop_front();
+            result.command_name = boost::to_upper_copy(to_wstring(tokens[n++]));
 
             // Determine whether the next parameter is a channel spec or not
-            int          channel_index = -1;
-            int          layer_index   = -1;
-            std::wstring channel_spec;
+            int channel_index = -1;
+            int layer_index   = -1;
 
-            if (!tokens.empty()) {
-                channel_spec                            = tokens.front();
-                std::wstring              channelid_str = boost::trim_copy(channel_spec);
-                std::vector<std::wstring> split;
-                boost::split(split, channelid_str, boost::is_any_of("-"));
-
-                // Use non_throwing lexical cast to not hit exception break point all the time.
-                if (try_lexical_cast(split[0], channel_index)) {
-                    --channel_index;
-
-                    if (split.size() > 1)
-                        try_lexical_cast(split[1], layer_index);
-
-                    // Consume channel-spec
-                    tokens.pop_front();
-                }
-            }
+            const auto channel_spec = n;
+            if (n < tokens.size() && parse_channel_spec(tokens[n], channel_index, layer_index))
+                ++n; // Consume channel-spec
 
             bool is_channel_command = channel_index != -1;
 
             // Create command instance
+            std::list<std::wstring> parameters;
             if (is_channel_command) {
+                parameters = to_parameters(tokens, n);
                 result.command =
-                    repo_->create_channel_command(result.command_name, client, channel_index, layer_index, tokens);
+                    repo_->create_channel_command(result.command_name, client, channel_index, layer_index, parameters);
 
                 if (result.command) {
                     result.lock  = repo_->channels().at(channel_index).lock;
                     result.queue = commandQueues_.at(channel_index + 1);
                 } else // Might be a non channel command, although the first argument is numeric
                 {
-                    // Restore backed up channel spec string.
-                    tokens.push_front(channel_spec);
-                    result.command = repo_->create_command(result.command_name, client, tokens);
+                    // Include the channel spec in the parameters again.
+                    parameters     = to_parameters(tokens, channel_spec);
+                    result.command = repo_->create_command(result.command_name, client, parameters);
 
                     if (result.command)
                         result.queue = commandQueues_.at(0);
                 }
             } else {
-                result.command = repo_->create_command(result.command_name, client, tokens);
+                parameters     = to_parameters(tokens, n);
+                result.command = repo_->create_command(result.command_name, client, parameters);
 
                 if (result.command)
                     result.queue = commandQueues_.at(0);
@@ -237,9 +438,8 @@ struct AMCPProtocolStrategy::impl
             if (!result.command)
                 result.error = error_state::command_error;
             else {
-                std::vector<std::wstring> parameters(tokens.begin(), tokens.end());
-
-                result.command->parameters() = std::move(parameters);
+                result.command->parameters().assign(std::make_move_iterator(parameters.begin()),
+                                                    std::make_move_iterator(parameters.end()));
 
                 if (result.command->parameters().size() < result.command->minimum_parameters())
                     result.error = error_state::parameters_error;
@@ -258,82 +458,76 @@ struct AMCPProtocolStrategy::impl
         return result.error == error_state::no_error;
     }
 
-    template <typename C>
-    std::size_t tokenize(const std::wstring& message, C& pTokenVector)
+    static std::list<std::wstring> to_parameters(const std::vector<boost::string_view>& tokens, std::size_t first)
     {
-        // split on whitespace but keep strings within quotationmarks
-        // treat \ as the start of an escape-sequence: the following char will indicate what to actually put in the
-        // string
-
-        std::wstring currentToken;
-
-        bool inQuote        = false;
-        bool getSpecialCode = false;
-
-        for (unsigned int charIndex = 0; charIndex < message.size(); ++charIndex) {
-            if (getSpecialCode) {
-                // insert code-handling here
-                switch (message[charIndex]) {
-                    case L'\\':
-                        currentToken += L"\\";
-                        break;
-                    case L'\"':
-                        currentToken += L"\"";
-                        break;
-                    case L'n':
-                        currentToken += L"\n";
-                        break;
-                    default:
-                        break;
-                }
-                getSpecialCode = false;
-                continue;
-            }
-
-            if (message[charIndex] == L'\\') {
-                getSpecialCode = true;
-                continue;
-            }
+        std::list<std::wstring> result;
+        for (auto n = first; n < tokens.size(); ++n)
+            result.push_back(to_wstring(tokens[n]));
+        return result;
+    }
+};
 
-            if (message[charIndex] == L' ' && inQuote == false) {
-                if (!currentToken.empty()) {
-                    pTokenVector.push_back(currentToken);
-                    currentToken.clear();
-                }
-                continue;
-            }
+struct AMCPProtocolStrategy::connection : public IO::protocol_strategy<char>
+{
+    spl::shared_ptr<impl>                 impl_;
+    ClientInfoPtr                         client_;
+    const std::shared_ptr<reply_sequence> replies_;
+    std::string                           input_;
+    std::string                           arena_;
+    std::vector<boost::string_view>       tokens_;
+
+    connection(spl::shared_ptr<impl> impl, ClientInfoPtr client)
+        : impl_(std::move(impl))
+        , client_(client)
+        , replies_(std::make_shared<reply_sequence>(std::move(client)))
+    {
+    }
 
-            if (message[charIndex] == L'\"') {
-                inQuote = !inQuote;
+    void parse(const std::string& data) override { parse_buffer(data.data(), data.size()); }
 
-                if (!currentToken.empty() || !inQuote) {
-                    pTokenVector.push_back(currentToken);
-                    currentToken.clear();
-                }
-                continue;
-            }
+    // Everything complete which has been received is parsed as one batch. The arena is reserved for the whole batch up
+    // front, since unescaped tokens are never longer than the input they came from.
+    void parse_buffer(const char* data, std::size_t size) override
+    {
+        input_.append(data, size);
 
-            currentToken += message[charIndex];
-        }
+        arena_.clear();
+        arena_.reserve(input_.size());
 
-        if (!currentToken.empty()) {
-            pTokenVector.push_back(currentToken);
-            currentToken.clear();
+        std::size_t begin = 0;
+        for (auto end = input_.find("\r\n"); end != std::string::npos; end = input_.find("\r\n", begin)) {
+            try {
+                impl_->Parse(boost::string_view(input_.data() + begin, end - begin), client_, replies_, tokens_, arena_);
+            } catch (...) {
+                CASPAR_LOG_CURRENT_EXCEPTION();
+            }
+            begin = end + 2;
         }
 
-        return pTokenVector.size();
+        input_.erase(0, begin);
     }
 };
 
 AMCPProtocolStrategy::AMCPProtocolStrategy(const std::wstring&                             name,
-                                           const spl::shared_ptr<amcp_command_repository>& repo)
-    : impl_(spl::make_unique<impl>(name, repo))
+                                           const spl::shared_ptr<amcp_command_repository>& repo,
+                                           std::function<void(int, core::monitor::state)>  monitor)
+    : impl_(spl::make_shared<impl>(name, repo, monitor))
 {
 }
 AMCPProtocolStrategy::~AMCPProtocolStrategy() {}
 void AMCPProtocolStrategy::Parse(const std::wstring& msg, IO::ClientInfoPtr pClientInfo)
 {
-    impl_->Parse(msg, pClientInfo);
+    auto message = u8(msg);
+
+    std::string arena;
+    arena.reserve(message.size());
+    std::vector<boost::string_view> tokens;
+
+    impl_->Parse(message, pClientInfo, nullptr, tokens, arena);
+}
+IO::protocol_strategy<char>::ptr AMCPProtocolStrategy::create(const IO::client_connection<char>::ptr& client_connection)
+{
+    return spl::make_shared<connection>(impl_, IO::to_unicode_client_connection(client_connection, GetCodepage()));
 }
 
 }}} // namespace caspar::protocol::amcp
@@ -22,27 +22,42 @@
 #pragma once
 
 #include "../util/ProtocolStrategy.h"
+#include "../util/protocol_strategy.h"
 
 #include <common/memory.h>
 
+#include <core/monitor/monitor.h>
+
+#include <functional>
 #include <future>
 #include <string>
 
 namespace caspar { namespace protocol { namespace amcp {
 
-class AMCPProtocolStrategy : public IO::IProtocolStrategy
+class AMCPProtocolStrategy
+    : public IO::IProtocolStrategy
+    , public IO::protocol_strategy_factory<char>
 {
   public:
-    AMCPProtocolStrategy(const std::wstring& name, const spl::shared_ptr<class amcp_command_repository>& repo);
+    // monitor receives the state of a command queue whenever it changes, with the index of its channel or -1 for the
+    // general queue. It is called for every command, so it should only record the state.
+    AMCPProtocolStrategy(const std::wstring&                                   name,
+                         const spl::shared_ptr<class amcp_command_repository>& repo,
+                         std::function<void(int, core::monitor::state)>        monitor = nullptr);
 
     virtual ~AMCPProtocolStrategy();
 
     void        Parse(const std::wstring& msg, IO::ClientInfoPtr pClientInfo) override;
     std::string GetCodepage() const override { return "UTF-8"; }
 
+    // Parses UTF-8 straight from the receive buffer, without the legacy adapters. Replies to commands pipelined on
+    // the connection are sent in the order the commands were received.
+    IO::protocol_strategy<char>::ptr create(const IO::client_connection<char>::ptr& client_connection) override;
+
   private:
     struct impl;
-    spl::unique_ptr<impl> impl_;
+    struct connection;
+    spl::shared_ptr<impl> impl_;
 
     AMCPProtocolStrategy(const AMCPProtocolStrategy&) = delete;
     AMCPProtocolStrategy& operator=(const AMCPProtocolStrategy&) = delete;
@@ -53,6 +53,7 @@ class amcp_command_repository
 
     const std::vector<channel_context>& channels() const;
 
+    // The first command registered with a name is kept. Modules register theirs before the built-in commands.
     void register_command(std::wstring category, std::wstring name, amcp_command_func command, int min_num_params);
     void
     register_channel_command(std::wstring category, std::wstring name, amcp_command_func command, int min_num_params);
@@ -34,6 +34,7 @@
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
@@ -71,10 +72,15 @@ struct client::impl : public spl::enable_shared_from_this<client::impl>
     std::map<udp::endpoint, int>             reference_counts_by_endpoint_;
     std::vector<char>                        buffer_;
 
-    std::mutex              mutex_;
-    std::condition_variable cond_;
-    core::monitor::state    bundle_;
-    uint64_t                bundle_time_ = 0;
+    std::mutex                        mutex_;
+    std::condition_variable           cond_;
+    std::vector<core::monitor::state> bundles_;
+    uint64_t                          bundle_time_       = 0;
+    bool                              send_changes_only_ = false;
+    bool                              reset_tracker_     = false;
+    std::chrono::milliseconds         full_state_interval_{1000};
+
+    core::monitor::state_tracker tracker_; // Only used by the sending thread.
 
     uint64_t time_ = 0;
 
@@ -90,45 +96,66 @@ struct client::impl : public spl::enable_shared_from_this<client::impl>
         thread_ = std::thread([=] {
             try {
                 while (!abort_request_) {
-                    core::monitor::state       bundle;
-                    uint64_t                   bundle_time;
-                    std::vector<udp::endpoint> endpoints;
+                    std::vector<core::monitor::state> bundles;
+                    uint64_t                          bundle_time;
+                    bool                              send_changes_only;
+                    std::vector<udp::endpoint>        endpoints;
 
                     {
                         std::unique_lock<std::mutex> lock(mutex_);
-                        cond_.wait(lock, [&] { return bundle_time_ > 0 || abort_request_; });
+                        cond_.wait(lock, [&] { return !bundles_.empty() || abort_request_; });
 
                         if (abort_request_) {
                             return;
                         }
 
-                        bundle       = std::move(bundle_);
-                        bundle_time  = bundle_time_;
-                        bundle_time_ = 0;
+                        std::swap(bundles, bundles_);
+                        bundle_time       = bundle_time_;
+                        send_changes_only = send_changes_only_;
 
                         for (auto& p : reference_counts_by_endpoint_) {
                             endpoints.push_back(p.first);
                         }
+
+                        if (reset_tracker_ || endpoints.empty()) {
+                            tracker_.reset();
+                            tracker_.refresh_interval(full_state_interval_);
+                            reset_tracker_ = false;
+                        }
                     }
 
                     if (endpoints.empty()) {
                         continue;
                     }
 
-                    auto it = std::begin(bundle);
+                    std::vector<std::pair<const std::string*, const core::monitor::vector_t*>> messages;
+
+                    auto add_message = [&](const core::monitor::key& path, const core::monitor::vector_t& data) {
+                        messages.emplace_back(&path.str(), &data);
+                    };
+
+                    for (const auto& bundle : bundles) {
+                        if (send_changes_only) {
+                            tracker_.update(bundle, add_message);
+                        } else {
+                            bundle.for_each(add_message);
+                        }
+                    }
+
+                    auto it = std::begin(messages);
 
-                    while (it != std::end(bundle)) {
+                    while (it != std::end(messages)) {
                         ::osc::OutboundPacketStream o(reinterpret_cast<char*>(buffer_.data()),
                                                       static_cast<unsigned long>(buffer_.size()));
 
                         o << ::osc::BeginBundle(bundle_time);
 
                         // TODO (fix): < 2048 is a hack. Properly calculate if messages will fit.
-                        while (it != std::end(bundle) && o.Size() < 2048) {
-                            o << ::osc::BeginMessage(it->first.c_str());
+                        while (it != std::end(messages) && o.Size() < 2048) {
+                            o << ::osc::BeginMessage(it->first->c_str());
 
                             param_visitor<decltype(o)> param_visitor(o);
-                            for (const auto& element : it->second) {
+                            for (const auto& element : *it->second) {
                                 boost::apply_visitor(param_visitor, element);
                             }
 
@@ -163,7 +190,10 @@ struct client::impl : public spl::enable_shared_from_this<client::impl>
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        ++reference_counts_by_endpoint_[endpoint];
+        // New subscribers need the whole state, not just what changes from now on.
+        if (++reference_counts_by_endpoint_[endpoint] == 1) {
+            reset_tracker_ = true;
+        }
 
         std::weak_ptr<impl> weak_self = shared_from_this();
 
@@ -185,14 +215,29 @@ struct client::impl : public spl::enable_shared_from_this<client::impl>
         });
     }
 
-    void send(const core::monitor::state& state)
+    void send_changes_only(bool value, std::chrono::milliseconds full_state_interval)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        send_changes_only_   = value;
+        full_state_interval_ = full_state_interval;
+        reset_tracker_       = true;
+    }
+
+    void send(core::monitor::state state)
     {
         {
             std::lock_guard<std::mutex> lock(mutex_);
 
+            // Channels tick independently, keep every state until the sender has caught up but don't let a stalled
+            // sender grow the queue without bound.
+            if (bundles_.size() >= 64) {
+                bundles_.erase(bundles_.begin());
+            }
+
             // TODO: time_++ is a hack. Use proper channel time.
             bundle_time_ = time_++;
-            bundle_      = state;
+            bundles_.push_back(std::move(state));
         }
         cond_.notify_all();
     }
@@ -221,6 +266,11 @@ std::shared_ptr<void> client::get_subscription_token(const boost::asio::ip::udp:
     return impl_->get_subscription_token(endpoint);
 }
 
-void client::send(core::monitor::state state) { impl_->send(state); }
+void client::send_changes_only(bool value, std::chrono::milliseconds full_state_interval)
+{
+    impl_->send_changes_only(value, full_state_interval);
+}
+
+void client::send(core::monitor::state state) { impl_->send(std::move(state)); }
 
 }}} // namespace caspar::protocol::osc
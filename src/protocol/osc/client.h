@@ -27,6 +27,8 @@
 #include <common/memory.h>
 #include <core/monitor/monitor.h>
 
+#include <chrono>
+
 namespace caspar { namespace protocol { namespace osc {
 
 class client
@@ -55,6 +57,13 @@ class client
 
     client& operator=(client&&);
 
+    /**
+     * Only send values which changed since they were last sent. Unchanged
+     * values are still resent every full_state_interval so that listeners
+     * which missed a packet or joined late catch up.
+     */
+    void send_changes_only(bool value, std::chrono::milliseconds full_state_interval);
+
     void send(core::monitor::state state);
 
   private:
@@ -217,9 +217,7 @@ class connection : public spl::enable_shared_from_this<connection>
     {
         if (!error) {
             try {
-                std::string data(data_.begin(), data_.begin() + bytes_transferred);
-
-                protocol_->parse(data);
+                protocol_->parse_buffer(data_.data(), bytes_transferred);
             } catch (...) {
                 CASPAR_LOG_CURRENT_EXCEPTION();
             }
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 #include <common/memory.h>
@@ -49,6 +50,16 @@ class protocol_strategy
      * @param data The data received.
      */
     virtual void parse(const std::basic_string<CharT>& data) = 0;
+
+    /**
+     * Parse size characters received at data. The data is only valid during
+     * the call. Strategies which can work on the receive buffer directly
+     * override this to avoid the copy into a string for parse().
+     *
+     * @param data The data received.
+     * @param size The number of characters received.
+     */
+    virtual void parse_buffer(const CharT* data, std::size_t size) { parse(std::basic_string<CharT>(data, size)); }
 };
 
 /**
@@ -100,6 +100,12 @@ to_unicode_adapter_factory::to_unicode_adapter_factory(
 {
 }
 
+client_connection<wchar_t>::ptr to_unicode_client_connection(const client_connection<char>::ptr& client_connection,
+                                                             const std::string&                  codepage)
+{
+    return spl::make_shared<from_unicode_client_connection>(client_connection, codepage);
+}
+
 protocol_strategy<char>::ptr to_unicode_adapter_factory::create(const client_connection<char>::ptr& client_connection)
 {
     auto client = spl::make_shared<from_unicode_client_connection>(client_connection, codepage_);
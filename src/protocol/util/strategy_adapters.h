@@ -50,6 +50,13 @@ class to_unicode_adapter_factory : public protocol_strategy_factory<char>
     protocol_strategy<char>::ptr create(const client_connection<char>::ptr& client_connection) override;
 };
 
+/**
+ * Wraps a client_connection<char> for strategies working with utf-16,
+ * converting what is sent to the given codepage.
+ */
+client_connection<wchar_t>::ptr to_unicode_client_connection(const client_connection<char>::ptr& client_connection,
+                                                             const std::string&                  codepage);
+
 /**
  * Protocol strategy adapter for ensuring that only complete chunks or
  * "packets" are delivered to the wrapped strategy. The chunks are determined
@@ -234,7 +234,9 @@ int main(int argc, char** argv)
             wait_for_remote_debugging();
 
         // Start logging to file.
-        log::add_file_sink(env::log_folder() + L"caspar");
+        log::add_file_sink(env::log_folder() + L"caspar",
+                           env::properties().get(L"configuration.log-queue-size", 16384),
+                           env::properties().get(L"configuration.log-overflow", L"drop-oldest"));
         std::wcout << L"Logging [" << log::get_log_level() << L"] or higher severity to " << env::log_folder()
                    << std::endl
                    << std::endl;
@@ -57,6 +57,8 @@
 #include <boost/property_tree/xml_parser.hpp>
 
 #include <future>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <utility>
 
@@ -95,6 +97,54 @@ std::shared_ptr<boost::asio::io_service> create_running_io_service()
     });
 }
 
+accelerator::image_mixer_backend get_image_mixer_backend(const boost::property_tree::wptree& xml_channel)
+{
+    auto backend = xml_channel.get(L"image-mixer", L"ogl");
+
+    if (backend == L"ogl")
+        return accelerator::image_mixer_backend::ogl;
+    if (backend == L"cpu")
+        return accelerator::image_mixer_backend::cpu;
+
+    CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Invalid image-mixer: " + backend));
+}
+
+bool uses_ogl_image_mixer(const boost::property_tree::wptree& pt)
+{
+    for (auto& xml_channel : pt | witerate_children(L"configuration.channels") | welement_context_iteration) {
+        if (get_image_mixer_backend(xml_channel.second) == accelerator::image_mixer_backend::ogl)
+            return true;
+    }
+    return false;
+}
+
+// Latest state of the AMCP command queues. A queue changes with every command, so its state goes out with the next
+// tick of its channel rather than in an OSC bundle of its own. The general queues go out with channel 1.
+class amcp_queue_states
+{
+    std::mutex                                    mutex_;
+    std::map<std::pair<int, int>, monitor::state> states_; // By port and channel index, -1 for the general queue.
+
+  public:
+    void set(int port, int channel_index, monitor::state state)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states_[std::make_pair(port, channel_index)] = std::move(state);
+    }
+
+    void attach_to(monitor::state& state, int channel_index)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& p : states_) {
+            const auto port = p.first.first;
+            if (p.first.second == channel_index)
+                state[""]["amcp"][port]["channel"][channel_index + 1]["queue"] = p.second;
+            else if (p.first.second == -1 && channel_index == 0)
+                state[""]["amcp"][port]["general"]["queue"] = p.second;
+        }
+    }
+};
+
 struct server::impl
 {
     std::shared_ptr<boost::asio::io_service>           io_service_ = create_running_io_service();
@@ -104,6 +154,7 @@ struct server::impl
     std::shared_ptr<IO::AsyncEventServer>              primary_amcp_server_;
     std::shared_ptr<osc::client>                       osc_client_ = std::make_shared<osc::client>(io_service_);
     std::vector<std::shared_ptr<void>>                 predefined_osc_subscriptions_;
+    std::shared_ptr<amcp_queue_states>                 amcp_queue_states_ = std::make_shared<amcp_queue_states>();
     std::vector<spl::shared_ptr<video_channel>>        channels_;
     spl::shared_ptr<core::cg_producer_registry>        cg_registry_;
     spl::shared_ptr<core::frame_producer_registry>     producer_registry_;
@@ -121,7 +172,9 @@ struct server::impl
     {
         caspar::core::diagnostics::osd::register_sink();
 
-        auto ogl_device    = accelerator_.get_device();
+        // Only create the OpenGL device if some channel will use it, so that CPU only setups run without a GPU.
+        auto ogl_device = uses_ogl_image_mixer(env::properties()) ? accelerator_.get_device()
+                                                                  : std::shared_ptr<accelerator::accelerator_device>();
         amcp_command_repo_ = spl::make_shared<amcp::amcp_command_repository>(
             cg_registry_, producer_registry_, consumer_registry_, ogl_device, shutdown_server_now_);
 
@@ -177,20 +230,30 @@ struct server::impl
             if (format_desc.format == video_format::invalid)
                 CASPAR_THROW_EXCEPTION(user_error() << msg_info(L"Invalid video-mode: " + format_desc_str));
 
-            auto weak_client = std::weak_ptr<osc::client>(osc_client_);
-            auto channel_id  = static_cast<int>(channels_.size() + 1);
-            auto channel =
-                spl::make_shared<video_channel>(channel_id,
-                                                format_desc,
-                                                accelerator_.create_image_mixer(channel_id),
-                                                [channel_id, weak_client](core::monitor::state channel_state) {
-                                                    monitor::state state;
-                                                    state[""]["channel"][channel_id] = channel_state;
-                                                    auto client                      = weak_client.lock();
-                                                    if (client) {
-                                                        client->send(std::move(state));
-                                                    }
-                                                });
+            auto pipeline_depth = xml_channel.second.get(L"pipeline-depth", 1);
+            if (pipeline_depth < 1 || pipeline_depth > 3)
+                CASPAR_THROW_EXCEPTION(user_error()
+                                       << msg_info(L"Invalid pipeline-depth: " + std::to_wstring(pipeline_depth)));
+
+            auto image_mixer_backend = get_image_mixer_backend(xml_channel.second);
+
+            auto weak_client  = std::weak_ptr<osc::client>(osc_client_);
+            auto queue_states = amcp_queue_states_;
+            auto channel_id   = static_cast<int>(channels_.size() + 1);
+            auto channel      = spl::make_shared<video_channel>(
+                channel_id,
+                format_desc,
+                accelerator_.create_image_mixer(channel_id, image_mixer_backend),
+                pipeline_depth,
+                [channel_id, weak_client, queue_states](core::monitor::state channel_state) {
+                    monitor::state state;
+                    state[""]["channel"][channel_id] = channel_state;
+                    queue_states->attach_to(state, channel_id - 1);
+                    auto client = weak_client.lock();
+                    if (client) {
+                        client->send(std::move(state));
+                    }
+                });
 
             channels_.push_back(channel);
         }
@@ -224,6 +287,10 @@ struct server::impl
         auto default_port                 = pt.get<unsigned short>(L"configuration.osc.default-port", 6250);
         auto disable_send_to_amcp_clients = pt.get(L"configuration.osc.disable-send-to-amcp-clients", false);
         auto predefined_clients           = pt.get_child_optional(L"configuration.osc.predefined-clients");
+        auto send_changes_only            = pt.get(L"configuration.osc.send-changes-only", false);
+        auto full_state_interval          = pt.get(L"configuration.osc.full-state-interval", 1000);
+
+        osc_client_->send_changes_only(send_changes_only, std::chrono::milliseconds(full_state_interval));
 
         if (predefined_clients) {
             for (auto& predefined_client :
@@ -270,7 +337,7 @@ struct server::impl
                 try {
                     auto asyncbootstrapper = spl::make_shared<IO::AsyncEventServer>(
                         io_service_,
-                        create_protocol(protocol, L"TCP Port " + std::to_wstring(port)),
+                        create_protocol(protocol, static_cast<int>(port)),
                         static_cast<short>(port));
                     async_servers_.push_back(asyncbootstrapper);
 
@@ -287,15 +354,19 @@ struct server::impl
         }
     }
 
-    IO::protocol_strategy_factory<char>::ptr create_protocol(const std::wstring& name,
-                                                             const std::wstring& port_description) const
+    IO::protocol_strategy_factory<char>::ptr create_protocol(const std::wstring& name, int port) const
     {
         using namespace IO;
 
-        if (boost::iequals(name, L"AMCP"))
-            return wrap_legacy_protocol("\r\n",
-                                        spl::make_shared<amcp::AMCPProtocolStrategy>(
-                                            port_description, spl::make_shared_ptr(amcp_command_repo_)));
+        if (boost::iequals(name, L"AMCP")) {
+            auto queue_states = amcp_queue_states_;
+            return spl::make_shared<amcp::AMCPProtocolStrategy>(
+                L"TCP Port " + std::to_wstring(port),
+                spl::make_shared_ptr(amcp_command_repo_),
+                [port, queue_states](int channel_index, core::monitor::state queue_state) {
+                    queue_states->set(port, channel_index, std::move(queue_state));
+                });
+        }
         if (boost::iequals(name, L"CII"))
             return wrap_legacy_protocol(
                 "\r\n", spl::make_shared<cii::CIIProtocolStrategy>(channels_, cg_registry_, producer_registry_));
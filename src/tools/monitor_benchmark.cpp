@@ -0,0 +1,103 @@
+// Builds and flattens the monitor state of one channel the way stage and video_channel do every tick, with an
+// ffmpeg producer of the usual shape on every layer.
+//
+// Usage: monitor_benchmark [layers] [ticks]
+
+#include <core/monitor/monitor.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace caspar::core::monitor;
+
+namespace {
+
+struct producer
+{
+    state state_;
+    int   frame_ = 0;
+
+    state get()
+    {
+        state_["file/name"]              = std::string("clip.mov");
+        state_["file/path"]              = std::string("media/clip.mov");
+        state_["file/time"]              = {frame_ / 50.0, 100.0};
+        state_["file/clip"]              = {0.0, 100.0};
+        state_["file/streams"][0]["fps"] = {50, 1};
+        state_["file/streams"][1]["fps"] = {48000, 1};
+        state_["loop"]                   = false;
+        frame_ += 1;
+        return state_;
+    }
+};
+
+double elapsed_us(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::micro>(end - begin).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const int layers = argc > 1 ? std::atoi(argv[1]) : 500;
+    const int ticks  = argc > 2 ? std::atoi(argv[2]) : 500;
+
+    if (layers <= 0 || ticks <= 0) {
+        fprintf(stderr, "Usage: %s [layers] [ticks]\n", argv[0]);
+        return -1;
+    }
+
+    std::vector<producer> producers(layers);
+    std::vector<state>    layer_states(layers);
+
+    double      build  = 0.0;
+    double      flat   = 0.0;
+    std::size_t values = 0;
+
+    for (int tick = 0; tick < ticks; ++tick) {
+        const auto t0 = std::chrono::steady_clock::now();
+
+        for (int n = 0; n < layers; ++n) {
+            auto& layer                     = layer_states[n];
+            layer                           = state();
+            layer["foreground"]             = producers[n].get();
+            layer["foreground"]["producer"] = std::wstring(L"ffmpeg");
+            layer["foreground"]["paused"]   = false;
+            layer["background"]["producer"] = std::wstring(L"empty");
+        }
+
+        state stage;
+        for (int n = 0; n < layers; ++n) {
+            stage["layer"][n] = layer_states[n];
+        }
+
+        state channel;
+        channel["stage"]     = stage;
+        channel["framerate"] = {50, 1};
+
+        state root;
+        root[""]["channel"][1] = channel;
+
+        const auto t1 = std::chrono::steady_clock::now();
+
+        root.for_each([&](const key&, const vector_t& data) { values += data.size(); });
+
+        const auto t2 = std::chrono::steady_clock::now();
+
+        build += elapsed_us(t0, t1);
+        flat += elapsed_us(t1, t2);
+    }
+
+    printf("%d layers, %d ticks: build %.1f us/tick, flatten %.1f us/tick, %zu values/tick\n",
+           layers,
+           ticks,
+           build / ticks,
+           flat / ticks,
+           values / ticks);
+
+    return 0;
+}